@@ -0,0 +1,169 @@
+/* moses Find symbol in shared libraries.
+ * Copyright (C) 2022  Mathias Schmitt
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Compare the BK-tree to a linear scan of the distinct names of libraries.
+ *
+ * The queries are names of the libraries with a letter replaced, looked up
+ * with 1 to 3 edits allowed. Both methods must find the same names.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bktree.h"
+#include "levenshtein.h"
+#include "store.h"
+
+#define BENCH_QUERIES 200
+#define BENCH_MAX_EDITS 3
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static int name_compare(void const * n1, void const * n2)
+{
+	return strcmp(*(char const * const *)n1, *(char const * const *)n2);
+}
+
+int main(int argc, char * argv[])
+{
+	struct bktree_result result = { 0 };
+	struct store * store = store_create();
+	struct bktree tree;
+	char const ** names;
+	uint32_t * lens;
+	size_t name_nb = 0;
+	size_t distinct = 0;
+	double start;
+	int ret = 1;
+
+	if (argc < 2 || !store)
+	{
+		printf("Usage: bench_bktree library...\n");
+		return 1;
+	}
+
+	for (int i = 1; i < argc; ++i)
+		store_file(store, argv[i]);
+
+	names = malloc((store->symbol_nb + 1) * sizeof(*names));
+	lens = malloc((store->symbol_nb + 1) * sizeof(*lens));
+	if (!names || !lens)
+		goto END;
+
+	for (size_t i = 0; i < store->lib_nb; ++i)
+	{
+		memcpy(names + name_nb, store->libs[i].names,
+			store->libs[i].count * sizeof(*names));
+		name_nb += store->libs[i].count;
+	}
+
+	qsort(names, name_nb, sizeof(*names), name_compare);
+	for (size_t i = 0; i < name_nb; ++i)
+	{
+		if (distinct && !strcmp(names[distinct - 1], names[i]))
+			continue;
+		names[distinct] = names[i];
+		lens[distinct++] = (uint32_t)strlen(names[i]);
+	}
+	name_nb = distinct;
+
+	start = now();
+	if (bktree_build(&tree, names, name_nb) < 0)
+		goto END;
+	printf("%zu libraries, %zu distinct names, tree built in %.3f s\n",
+		store->lib_nb, name_nb, now() - start);
+
+	printf("edits  visited  tree (us)  linear (us)  speedup\n");
+
+	for (int k = 1; k <= BENCH_MAX_EDITS; ++k)
+	{
+		double tree_time = 0;
+		double linear_time = 0;
+		size_t visited = 0;
+
+		for (size_t q = 0; q < BENCH_QUERIES; ++q)
+		{
+			char const * name = names[q * name_nb / BENCH_QUERIES];
+			char * needle = strdup(name);
+			struct lev_ctx lev;
+			size_t found = 0;
+			size_t i;
+
+			if (!needle)
+				goto END;
+
+			i = strlen(needle) / 2;
+			needle[i] = needle[i] == 'x' ? 'y' : 'x';
+
+			if (lev_ctx_init(&lev, needle) < 0)
+			{
+				free(needle);
+				goto END;
+			}
+
+			start = now();
+			bktree_query(&tree, names, lens, &lev, k, &result);
+			tree_time += now() - start;
+			visited += result.visited;
+
+			start = now();
+			for (i = 0; i < name_nb; ++i)
+				found += lev_ctx_dist_bounded(&lev, names[i],
+						lens[i], k) <= k;
+			linear_time += now() - start;
+
+			if (found != result.count)
+			{
+				printf("Error: the tree found %zu names for "
+					"'%s' instead of %zu.\n", result.count,
+					needle, found);
+				lev_ctx_free(&lev);
+				free(needle);
+				goto END;
+			}
+
+			lev_ctx_free(&lev);
+			free(needle);
+		}
+
+		printf("%5d  %6.2f%%  %9.1f  %11.1f  %6.1fx\n", k,
+			100.0 * (double)visited / (double)(name_nb * BENCH_QUERIES),
+			tree_time * 1e6 / BENCH_QUERIES,
+			linear_time * 1e6 / BENCH_QUERIES,
+			linear_time / tree_time);
+	}
+
+	ret = 0;
+	bktree_free(&tree);
+
+END:
+	bktree_result_free(&result);
+	free(names);
+	free(lens);
+	store_destroy(store);
+
+	return ret;
+}
@@ -0,0 +1,390 @@
+/* moses Find symbol in shared libraries.
+ * Copyright (C) 2022  Mathias Schmitt
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Generate a synthetic corpus of shared objects for the benchmarks.
+ *
+ * Each library is a minimal 64-bit ELF object holding only a .dynsym table,
+ * its strings and an empty .text section. The names are built from a fixed
+ * vocabulary by a seeded generator: the same options always give the same
+ * files, byte for byte. The first symbol of each library is one of the
+ * needles of the end to end benchmark, defined, in turn.
+ */
+
+#include <elf.h>
+#include <errno.h>
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "needles.h"
+
+#define CORPUS_MAX_NAME 512
+
+/* Every fifth symbol is imported from another library. */
+#define CORPUS_UNDEFINED_RATE 5
+
+static char const * const words[] = {
+	"get", "set", "init", "free", "alloc", "buffer", "stream", "parse",
+	"config", "file", "read", "write", "open", "close", "lock", "unlock",
+	"list", "map", "node", "tree", "hash", "table", "string", "error",
+	"context", "thread", "pool", "queue", "event", "signal", "socket",
+	"message", "handle", "create", "destroy", "update", "query", "index",
+	"cache", "value", "key", "entry", "size", "count", "flags", "state",
+	"load", "save", "lookup", "insert", "remove", "find", "copy", "reset",
+};
+
+static char const * const prefixes[] = {
+	"g_", "xml", "png_", "ssl_", "av_", "sqlite3_", "curl_", "z", "",
+};
+
+static char const * const params[] = {
+	"v", "i", "Ki", "PKc", "RKSs", "m", "PvS_", "d", "b", "j",
+};
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof(*(a)))
+
+struct corpus
+{
+	unsigned libraries;
+	unsigned symbols;
+	unsigned name_len;
+	unsigned cxx_percent;
+	uint64_t seed;
+};
+
+/* @brief splitmix64, small and identical on every platform. */
+static uint64_t next(uint64_t * state)
+{
+	uint64_t z = (*state += 0x9e3779b97f4a7c15u);
+
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9u;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebu;
+
+	return z ^ (z >> 31);
+}
+
+static size_t pick(uint64_t * state, size_t n)
+{
+	return (size_t)(next(state) % n);
+}
+
+/* @brief Append a string to a name, as long as it fits. */
+static size_t append(char * name, size_t len, char const * str)
+{
+	size_t n = strlen(str);
+
+	if (len + n >= CORPUS_MAX_NAME)
+		return len;
+	memcpy(name + len, str, n + 1);
+
+	return len + n;
+}
+
+/* @brief Draw the length a name aims at, uniform around the mean. */
+static size_t target_len(struct corpus const * corpus, uint64_t * state)
+{
+	size_t mean = corpus->name_len ? corpus->name_len : 1;
+
+	return mean / 2 + pick(state, mean + 1);
+}
+
+/* @brief Build a C name such as png_read_buffer_state. */
+static size_t c_name(struct corpus const * corpus, uint64_t * state,
+		char const * prefix, char * name)
+{
+	size_t target = target_len(corpus, state);
+	size_t len = append(name, 0, prefix);
+
+	len = append(name, len, words[pick(state, ARRAY_SIZE(words))]);
+	while (len < target)
+	{
+		len = append(name, len, "_");
+		len = append(name, len, words[pick(state, ARRAY_SIZE(words))]);
+	}
+
+	return len;
+}
+
+/* @brief Build an Itanium mangled name such as _ZN6stream4readEPvm. */
+static size_t cxx_name(struct corpus const * corpus, uint64_t * state,
+		char * name)
+{
+	size_t target = target_len(corpus, state);
+	size_t len = append(name, 0, "_ZN");
+	char component[64];
+
+	do
+	{
+		char const * word = words[pick(state, ARRAY_SIZE(words))];
+
+		snprintf(component, sizeof(component), "%zu%s", strlen(word),
+				word);
+		len = append(name, len, component);
+	} while (len + 4 < target);
+
+	len = append(name, len, "E");
+	for (size_t i = 1 + pick(state, 3); i; --i)
+		len = append(name, len, params[pick(state, ARRAY_SIZE(params))]);
+
+	return len;
+}
+
+/* @brief Write one library of the corpus.
+ *
+ * The layout is the ELF header, .dynsym, .dynstr, .shstrtab and the section
+ * headers, in this order.
+ */
+static int write_library(struct corpus const * corpus, char const * dir,
+		unsigned lib)
+{
+	static char const shstrtab[] = "\0.text\0.dynsym\0.dynstr\0.shstrtab";
+	uint64_t state = corpus->seed * 0x100000001b3u + lib;
+	char const * prefix = prefixes[pick(&state, ARRAY_SIZE(prefixes))];
+	size_t sym_nb = (size_t)corpus->symbols + 1;
+	Elf64_Sym * syms = calloc(sym_nb, sizeof(*syms));
+	size_t str_capacity = sym_nb * 32;
+	size_t str_size = 1;
+	char * strs = malloc(str_capacity);
+	Elf64_Shdr shdrs[5] = { 0 };
+	Elf64_Ehdr ehdr = { 0 };
+	char path[4096];
+	size_t offset;
+	FILE * file;
+	int ret = -ENOMEM;
+
+	if (!syms || !strs)
+		goto END;
+	strs[0] = '\0';
+
+	for (size_t i = 1; i < sym_nb; ++i)
+	{
+		char name[CORPUS_MAX_NAME];
+		size_t len;
+
+		if (i == 1)
+			len = append(name, 0, bench_needles[lib %
+					ARRAY_SIZE(bench_needles)]);
+		else if (pick(&state, 100) < corpus->cxx_percent)
+			len = cxx_name(corpus, &state, name);
+		else
+			len = c_name(corpus, &state, prefix, name);
+
+		if (str_size + len + 1 > str_capacity)
+		{
+			char * grown = realloc(strs, str_capacity * 2);
+
+			if (!grown)
+				goto END;
+			strs = grown;
+			str_capacity *= 2;
+		}
+
+		syms[i].st_name = (uint32_t)str_size;
+		memcpy(strs + str_size, name, len + 1);
+		str_size += len + 1;
+
+		if (i == 1 || pick(&state, CORPUS_UNDEFINED_RATE))
+		{
+			syms[i].st_info = ELF64_ST_INFO(STB_GLOBAL, STT_FUNC);
+			syms[i].st_shndx = 1;
+			syms[i].st_value = i * 16;
+			syms[i].st_size = 16;
+		}
+		else
+		{
+			syms[i].st_info = ELF64_ST_INFO(STB_GLOBAL, STT_NOTYPE);
+			syms[i].st_shndx = SHN_UNDEF;
+		}
+	}
+
+	memcpy(ehdr.e_ident, ELFMAG, SELFMAG);
+	ehdr.e_ident[EI_CLASS] = ELFCLASS64;
+	ehdr.e_ident[EI_DATA] = ELFDATA2LSB;
+	ehdr.e_ident[EI_VERSION] = EV_CURRENT;
+	ehdr.e_type = ET_DYN;
+	ehdr.e_machine = EM_X86_64;
+	ehdr.e_version = EV_CURRENT;
+	ehdr.e_ehsize = sizeof(ehdr);
+	ehdr.e_shentsize = sizeof(Elf64_Shdr);
+	ehdr.e_shnum = ARRAY_SIZE(shdrs);
+	ehdr.e_shstrndx = 4;
+
+	offset = sizeof(ehdr);
+
+	shdrs[1].sh_name = 1;
+	shdrs[1].sh_type = SHT_PROGBITS;
+	shdrs[1].sh_flags = SHF_ALLOC | SHF_EXECINSTR;
+	shdrs[1].sh_offset = offset;
+
+	shdrs[2].sh_name = 7;
+	shdrs[2].sh_type = SHT_DYNSYM;
+	shdrs[2].sh_flags = SHF_ALLOC;
+	shdrs[2].sh_offset = offset;
+	shdrs[2].sh_size = sym_nb * sizeof(*syms);
+	shdrs[2].sh_link = 3;
+	shdrs[2].sh_info = 1;
+	shdrs[2].sh_entsize = sizeof(*syms);
+	shdrs[2].sh_addralign = 8;
+	offset += shdrs[2].sh_size;
+
+	shdrs[3].sh_name = 15;
+	shdrs[3].sh_type = SHT_STRTAB;
+	shdrs[3].sh_flags = SHF_ALLOC;
+	shdrs[3].sh_offset = offset;
+	shdrs[3].sh_size = str_size;
+	shdrs[3].sh_addralign = 1;
+	offset += str_size;
+
+	shdrs[4].sh_name = 23;
+	shdrs[4].sh_type = SHT_STRTAB;
+	shdrs[4].sh_offset = offset;
+	shdrs[4].sh_size = sizeof(shstrtab);
+	shdrs[4].sh_addralign = 1;
+	offset += sizeof(shstrtab);
+
+	offset = (offset + 7) & ~(size_t)7;
+	ehdr.e_shoff = offset;
+
+	snprintf(path, sizeof(path), "%s/libbench%04u.so", dir, lib);
+	file = fopen(path, "wb");
+	if (!file)
+	{
+		ret = -errno;
+		printf("Error: failed to open file %s: %s\n", path,
+			strerror(errno));
+		goto END;
+	}
+
+	fwrite(&ehdr, sizeof(ehdr), 1, file);
+	fwrite(syms, sizeof(*syms), sym_nb, file);
+	fwrite(strs, 1, str_size, file);
+	fwrite(shstrtab, 1, sizeof(shstrtab), file);
+	for (size_t pad = shdrs[4].sh_offset + sizeof(shstrtab); pad < offset;
+			++pad)
+		fputc(0, file);
+	fwrite(shdrs, sizeof(*shdrs), ARRAY_SIZE(shdrs), file);
+
+	ret = 0;
+	if (ferror(file) | fclose(file))
+	{
+		ret = -EIO;
+		printf("Error: failed to write file %s\n", path);
+	}
+
+END:
+	free(syms);
+	free(strs);
+
+	return ret;
+}
+
+static void usage(void)
+{
+	printf(
+		"Usage: bench_corpus [options] DIRECTORY\n"
+		"Write a deterministic corpus of shared objects in DIRECTORY.\n"
+		"  -l  number of libraries (default 200).\n"
+		"  -s  symbols per library (default 2000).\n"
+		"  -L  mean name length (default 24).\n"
+		"  -c  percentage of C++ mangled names (default 30).\n"
+		"  -r  seed of the generator (default 1).\n");
+}
+
+static int parse_unsigned(char const * str, unsigned * value)
+{
+	char * end = NULL;
+	unsigned long parsed = strtoul(str, &end, 10);
+
+	if (*end || parsed > 1000000)
+		return -EINVAL;
+	*value = (unsigned)parsed;
+
+	return 0;
+}
+
+int main(int argc, char * argv[])
+{
+	struct corpus corpus = {
+		.libraries = 200,
+		.symbols = 2000,
+		.name_len = 24,
+		.cxx_percent = 30,
+		.seed = 1,
+	};
+	unsigned seed = 1;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "l:s:L:c:r:")) != -1)
+	{
+		int ret = 0;
+
+		switch (opt)
+		{
+			case 'l':
+				ret = parse_unsigned(optarg, &corpus.libraries);
+				break;
+			case 's':
+				ret = parse_unsigned(optarg, &corpus.symbols);
+				break;
+			case 'L':
+				ret = parse_unsigned(optarg, &corpus.name_len);
+				break;
+			case 'c':
+				ret = parse_unsigned(optarg, &corpus.cxx_percent);
+				if (corpus.cxx_percent > 100)
+					ret = -EINVAL;
+				break;
+			case 'r':
+				ret = parse_unsigned(optarg, &seed);
+				corpus.seed = seed;
+				break;
+			default:
+				ret = -EINVAL;
+				break;
+		}
+
+		if (ret < 0)
+		{
+			usage();
+			return 1;
+		}
+	}
+
+	if (optind + 1 != argc)
+	{
+		usage();
+		return 1;
+	}
+
+	if (mkdir(argv[optind], 0755) < 0 && errno != EEXIST)
+	{
+		printf("Error: failed to create directory %s: %s\n",
+			argv[optind], strerror(errno));
+		return 1;
+	}
+
+	for (unsigned lib = 0; lib < corpus.libraries; ++lib)
+	{
+		if (write_library(&corpus, argv[optind], lib) < 0)
+			return 1;
+	}
+
+	return 0;
+}
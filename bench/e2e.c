@@ -0,0 +1,315 @@
+/* moses Find symbol in shared libraries.
+ * Copyright (C) 2022  Mathias Schmitt
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Run moses end to end over a corpus and report the results as JSON.
+ *
+ * Every case runs once to warm the page cache, then a fixed number of
+ * times. The median and the fastest wall times are reported, with the
+ * largest peak resident memory of the timed runs and the number of lines
+ * printed, so that a change of behaviour shows up next to a change of speed.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "elfsym.h"
+#include "needles.h"
+
+#define E2E_MAX_ARGS 16
+#define E2E_MAX_RUNS 100
+
+/* Placeholders of the case arguments. */
+static char const jobs_arg[] = "JOBS";
+static char const needles_arg[] = "NEEDLES";
+
+struct bench_case
+{
+	char const * name;
+	char const * args[E2E_MAX_ARGS];
+};
+
+struct corpus_stats
+{
+	size_t files;
+	size_t symbols;
+	size_t cxx;
+	size_t bytes;
+};
+
+struct run
+{
+	double wall;
+	long max_rss;
+	size_t lines;
+};
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/* @brief Count what moses will see in the corpus. */
+static int corpus_stats(char const * dir, struct corpus_stats * stats)
+{
+	DIR * d = opendir(dir);
+	struct dirent * entry;
+
+	memset(stats, 0, sizeof(*stats));
+	if (!d)
+	{
+		printf("Error: failed to open directory %s: %s\n", dir,
+			strerror(errno));
+		return -errno;
+	}
+
+	while ((entry = readdir(d)))
+	{
+		struct elf_file elf;
+		char path[4096];
+
+		snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+		if (entry->d_name[0] == '.' || elf_open(&elf, path) < 0)
+			continue;
+
+		stats->files++;
+		for (size_t i = 1; i < elf.dynsym_count; ++i)
+		{
+			struct elf_symbol sym;
+
+			if (elf_symbol(&elf, i, &sym) < 0 || !sym.name[0])
+				continue;
+			stats->symbols++;
+			stats->bytes += strlen(sym.name);
+			stats->cxx += !strncmp(sym.name, "_Z", 2);
+		}
+		elf_close(&elf);
+	}
+
+	closedir(d);
+
+	return 0;
+}
+
+/* @brief Run moses once, counting the lines it prints.
+ *
+ * @return 0 on success, -1 if it could not be run or did not exit with 0.
+ */
+static int run_once(char const * const * argv, struct run * run)
+{
+	struct rusage usage;
+	char buffer[65536];
+	double start = now();
+	int fds[2];
+	int status;
+	pid_t pid;
+	ssize_t len;
+
+	if (pipe(fds) < 0)
+		return -1;
+
+	pid = fork();
+	if (pid < 0)
+		return -1;
+	if (pid == 0)
+	{
+		dup2(fds[1], STDOUT_FILENO);
+		close(fds[0]);
+		close(fds[1]);
+		execv(argv[0], (char * const *)argv);
+		_exit(127);
+	}
+
+	close(fds[1]);
+	run->lines = 0;
+	while ((len = read(fds[0], buffer, sizeof(buffer))) > 0)
+	{
+		for (ssize_t i = 0; i < len; ++i)
+			run->lines += buffer[i] == '\n';
+	}
+	close(fds[0]);
+
+	if (wait4(pid, &status, 0, &usage) < 0)
+		return -1;
+
+	run->wall = now() - start;
+	run->max_rss = usage.ru_maxrss;
+
+	return WIFEXITED(status) && !WEXITSTATUS(status) ? 0 : -1;
+}
+
+static int run_compare(void const * r1, void const * r2)
+{
+	double a = ((struct run const *)r1)->wall;
+	double b = ((struct run const *)r2)->wall;
+
+	return (a > b) - (a < b);
+}
+
+static void usage(void)
+{
+	printf(
+		"Usage: bench_e2e [options] MOSES CORPUS\n"
+		"Time moses over the libraries of CORPUS, print JSON.\n"
+		"  -r  timed runs per case (default 5).\n"
+		"  -j  jobs of the parallel cases (default 4).\n");
+}
+
+int main(int argc, char * argv[])
+{
+	struct bench_case cases[] = {
+		{ "exact", { "-d", "100", "parse_config_file" } },
+		{ "fuzzy", { "-j", "1", "parse_config_file" } },
+		{ "fuzzy_jobs", { "-j", jobs_arg, "parse_config_file" } },
+		{ "strict_jobs", { "-j", jobs_arg, "-d", "90",
+				"g_hash_table_lookup" } },
+		{ "top", { "-j", jobs_arg, "-t", "10",
+				"parse_config_file" } },
+		{ "needles", { "-j", jobs_arg, "-N", needles_arg } },
+	};
+	struct corpus_stats stats;
+	struct run runs[E2E_MAX_RUNS];
+	char needles_path[] = "/tmp/moses_needles_XXXXXX";
+	char const * jobs = "4";
+	unsigned long run_nb = 5;
+	char const * moses;
+	char const * corpus;
+	FILE * file;
+	int ret = 1;
+	int fd;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "r:j:")) != -1)
+	{
+		switch (opt)
+		{
+			case 'r':
+				run_nb = strtoul(optarg, NULL, 10);
+				break;
+			case 'j':
+				jobs = optarg;
+				break;
+			default:
+				usage();
+				return 1;
+		}
+	}
+
+	if (optind + 2 != argc || !run_nb || run_nb > E2E_MAX_RUNS)
+	{
+		usage();
+		return 1;
+	}
+	moses = argv[optind];
+	corpus = argv[optind + 1];
+
+	if (corpus_stats(corpus, &stats) < 0)
+		return 1;
+
+	fd = mkstemp(needles_path);
+	if (fd < 0 || !(file = fdopen(fd, "w")))
+	{
+		printf("Error: failed to create the needle file: %s\n",
+			strerror(errno));
+		return 1;
+	}
+	for (size_t i = 0; i < sizeof(bench_needles) / sizeof(*bench_needles);
+			++i)
+		fprintf(file, "%s\n", bench_needles[i]);
+	fclose(file);
+
+	printf("{\n");
+	printf("  \"corpus\": {\"path\": \"%s\", \"files\": %zu, "
+		"\"symbols\": %zu, \"mean_name_len\": %.1f, "
+		"\"cxx_share\": %.3f},\n", corpus, stats.files, stats.symbols,
+		stats.symbols ? (double)stats.bytes / (double)stats.symbols : 0.0,
+		stats.symbols ? (double)stats.cxx / (double)stats.symbols : 0.0);
+	printf("  \"runs\": %lu,\n", run_nb);
+	printf("  \"jobs\": %s,\n", jobs);
+	printf("  \"cases\": [\n");
+
+	for (size_t c = 0; c < sizeof(cases) / sizeof(*cases); ++c)
+	{
+		char const * args[E2E_MAX_ARGS + 3] = { moses };
+		size_t arg_nb = 1;
+		struct run * median;
+		long max_rss = 0;
+
+		for (size_t a = 0; a < E2E_MAX_ARGS && cases[c].args[a]; ++a)
+		{
+			char const * arg = cases[c].args[a];
+
+			if (arg == jobs_arg)
+				arg = jobs;
+			else if (arg == needles_arg)
+				arg = needles_path;
+			args[arg_nb++] = arg;
+		}
+		args[arg_nb++] = corpus;
+		args[arg_nb] = NULL;
+
+		for (size_t r = 0; r <= run_nb; ++r)
+		{
+			/* The first run only warms the page cache. */
+			if (run_once(args, &runs[r ? r - 1 : 0]) < 0)
+			{
+				printf("Error: moses failed on case %s\n",
+					cases[c].name);
+				goto END;
+			}
+		}
+
+		for (size_t r = 0; r < run_nb; ++r)
+			max_rss = runs[r].max_rss > max_rss ? runs[r].max_rss :
+				max_rss;
+		qsort(runs, run_nb, sizeof(*runs), run_compare);
+		median = &runs[run_nb / 2];
+
+		printf("    {\"name\": \"%s\", \"args\": \"", cases[c].name);
+		for (size_t a = 1; a < arg_nb - 1; ++a)
+			printf("%s%s", a > 1 ? " " : "",
+				args[a] == needles_path ? needles_arg : args[a]);
+		printf("\", \"wall_median_s\": %.6f, \"wall_min_s\": %.6f, "
+			"\"files_per_s\": %.1f, \"symbols_per_s\": %.1f, "
+			"\"peak_rss_kib\": %ld, \"lines\": %zu}%s\n",
+			median->wall, runs[0].wall,
+			(double)stats.files / median->wall,
+			(double)stats.symbols / median->wall, max_rss,
+			median->lines,
+			c + 1 < sizeof(cases) / sizeof(*cases) ? "," : "");
+		fflush(stdout);
+	}
+
+	printf("  ]\n}\n");
+	ret = 0;
+
+END:
+	unlink(needles_path);
+
+	return ret;
+}
@@ -0,0 +1,700 @@
+/* moses Find symbol in shared libraries.
+ * Copyright (C) 2022  Mathias Schmitt
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Time every distance kernel and check it against the reference DP.
+ *
+ * The inputs are random strings of given lengths and the symbols of real
+ * libraries, or of text dumps with one symbol per line. Every kernel first
+ * scores the whole input once and must agree with lev_string_dist_dp, then it
+ * is timed until enough time has passed to give stable numbers. When the
+ * kernel allows it, hardware counters are read through perf_event_open.
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+
+#include "elfsym.h"
+#include "levenshtein.h"
+
+#define KERNELS_MAX_SETS 32
+#define KERNELS_STRINGS 1024
+#define KERNELS_NEEDLES 16
+#define KERNELS_MIN_TIME 0.2
+
+/* Strings some kernels are timed against, with the needles they are
+ * compared to. */
+struct input
+{
+	char label[64];
+	char ** needles;
+	size_t needle_nb;
+	char ** strs;
+	size_t * lens;
+	size_t count;
+
+	/* Number of DP cells of one pass over the input. */
+	double cells;
+};
+
+struct kernel;
+
+typedef int (*kernel_fn)(struct kernel const * kernel, struct lev_ctx * lev,
+		struct input const * input, int k, int * dists);
+
+struct kernel
+{
+	char const * name;
+	kernel_fn run;
+	enum lev_isa isa;
+	int bounded;
+};
+
+/* Hardware counters, disabled when perf_event_open is not permitted. */
+enum
+{
+	COUNTER_CYCLES,
+	COUNTER_INSTRUCTIONS,
+	COUNTER_BRANCH_MISSES,
+	COUNTER_NB
+};
+
+struct counters
+{
+	int fds[COUNTER_NB];
+	uint64_t values[COUNTER_NB];
+	int enabled;
+};
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static int run_dp(struct kernel const * kernel, struct lev_ctx * lev,
+		struct input const * input, int k, int * dists)
+{
+	(void)kernel;
+	(void)k;
+
+	for (size_t i = 0; i < input->count; ++i)
+		dists[i] = lev_string_dist_dp(lev->needle, input->strs[i]);
+
+	return 0;
+}
+
+static int run_myers(struct kernel const * kernel, struct lev_ctx * lev,
+		struct input const * input, int k, int * dists)
+{
+	(void)kernel;
+	(void)k;
+
+	for (size_t i = 0; i < input->count; ++i)
+		dists[i] = lev_string_dist(lev->needle, input->strs[i]);
+
+	return 0;
+}
+
+static int run_bounded(struct kernel const * kernel, struct lev_ctx * lev,
+		struct input const * input, int k, int * dists)
+{
+	(void)kernel;
+
+	for (size_t i = 0; i < input->count; ++i)
+		dists[i] = lev_string_dist_bounded(lev->needle, input->strs[i],
+				k);
+
+	return 0;
+}
+
+static int run_ctx(struct kernel const * kernel, struct lev_ctx * lev,
+		struct input const * input, int k, int * dists)
+{
+	(void)kernel;
+	(void)k;
+
+	for (size_t i = 0; i < input->count; ++i)
+		dists[i] = lev_ctx_dist(lev, input->strs[i], input->lens[i]);
+
+	return 0;
+}
+
+static int run_ctx_bounded(struct kernel const * kernel, struct lev_ctx * lev,
+		struct input const * input, int k, int * dists)
+{
+	(void)kernel;
+
+	for (size_t i = 0; i < input->count; ++i)
+		dists[i] = lev_ctx_dist_bounded(lev, input->strs[i],
+				input->lens[i], k);
+
+	return 0;
+}
+
+static int run_batch(struct kernel const * kernel, struct lev_ctx * lev,
+		struct input const * input, int k, int * dists)
+{
+	(void)k;
+
+	lev->isa = kernel->isa;
+
+	return lev_ctx_batch(lev, (char const * const *)input->strs,
+			input->lens, input->count, dists);
+}
+
+static int run_batch_bounded(struct kernel const * kernel,
+		struct lev_ctx * lev, struct input const * input, int k,
+		int * dists)
+{
+	int * maxes = malloc((input->count + 1) * sizeof(*maxes));
+	int ret;
+
+	if (!maxes)
+		return -ENOMEM;
+	for (size_t i = 0; i < input->count; ++i)
+		maxes[i] = k;
+
+	lev->isa = kernel->isa;
+	ret = lev_ctx_batch_bounded(lev, (char const * const *)input->strs,
+			input->lens, input->count, maxes, dists);
+	free(maxes);
+
+	return ret;
+}
+
+static struct kernel const kernels[] = {
+	{ "dp", run_dp, LEV_ISA_SCALAR, 0 },
+	{ "myers", run_myers, LEV_ISA_SCALAR, 0 },
+	{ "bounded", run_bounded, LEV_ISA_SCALAR, 1 },
+	{ "ctx", run_ctx, LEV_ISA_SCALAR, 0 },
+	{ "ctx_bounded", run_ctx_bounded, LEV_ISA_SCALAR, 1 },
+	{ "batch_scalar", run_batch, LEV_ISA_SCALAR, 0 },
+	{ "batch_sse41", run_batch, LEV_ISA_SSE41, 0 },
+	{ "batch_avx2", run_batch, LEV_ISA_AVX2, 0 },
+	{ "batch_avx512", run_batch, LEV_ISA_AVX512, 0 },
+	{ "bbatch_sse41", run_batch_bounded, LEV_ISA_SSE41, 1 },
+	{ "bbatch_avx2", run_batch_bounded, LEV_ISA_AVX2, 1 },
+	{ "bbatch_avx512", run_batch_bounded, LEV_ISA_AVX512, 1 },
+};
+
+#define KERNEL_NB (sizeof(kernels) / sizeof(*kernels))
+
+static int counter_open(uint64_t config, int group)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.config = config;
+	attr.disabled = group < 0;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+
+	return (int)syscall(SYS_perf_event_open, &attr, 0, -1, group, 0);
+}
+
+/* @brief Open the counters, as one group so they count the same code. */
+static void counters_open(struct counters * counters)
+{
+	static uint64_t const configs[COUNTER_NB] = {
+		PERF_COUNT_HW_CPU_CYCLES,
+		PERF_COUNT_HW_INSTRUCTIONS,
+		PERF_COUNT_HW_BRANCH_MISSES,
+	};
+
+	counters->enabled = 1;
+	for (size_t i = 0; i < COUNTER_NB; ++i)
+	{
+		counters->fds[i] = counter_open(configs[i],
+				i ? counters->fds[0] : -1);
+		if (counters->fds[i] < 0)
+		{
+			printf("Hardware counters unavailable: %s\n",
+				strerror(errno));
+			for (size_t j = 0; j < i; ++j)
+				close(counters->fds[j]);
+			counters->enabled = 0;
+			return;
+		}
+	}
+}
+
+static void counters_close(struct counters * counters)
+{
+	for (size_t i = 0; counters->enabled && i < COUNTER_NB; ++i)
+		close(counters->fds[i]);
+}
+
+static void counters_start(struct counters * counters)
+{
+	if (!counters->enabled)
+		return;
+	ioctl(counters->fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+	ioctl(counters->fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+static void counters_stop(struct counters * counters)
+{
+	if (!counters->enabled)
+		return;
+	ioctl(counters->fds[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+	for (size_t i = 0; i < COUNTER_NB; ++i)
+	{
+		if (read(counters->fds[i], &counters->values[i],
+					sizeof(counters->values[i])) !=
+				sizeof(counters->values[i]))
+			counters->values[i] = 0;
+	}
+}
+
+/* @brief xorshift64, the inputs must be the same from one run to the next. */
+static uint64_t next(uint64_t * state)
+{
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+
+	return *state;
+}
+
+/* @brief Draw a string over a small alphabet, so that the distances are
+ * not all the length of the longest string. */
+static char * random_string(uint64_t * state, size_t len)
+{
+	char * str = malloc(len + 1);
+
+	if (!str)
+		return NULL;
+	for (size_t i = 0; i < len; ++i)
+		str[i] = (char)('a' + next(state) % 16);
+	str[len] = '\0';
+
+	return str;
+}
+
+static void input_finish(struct input * input)
+{
+	input->cells = 0;
+	for (size_t n = 0; n < input->needle_nb; ++n)
+	{
+		double m = (double)strlen(input->needles[n]);
+
+		for (size_t i = 0; i < input->count; ++i)
+			input->cells += m * (double)input->lens[i];
+	}
+}
+
+static int input_alloc(struct input * input, size_t count, size_t needle_nb)
+{
+	input->strs = calloc(count + 1, sizeof(*input->strs));
+	input->lens = calloc(count + 1, sizeof(*input->lens));
+	input->needles = calloc(needle_nb + 1, sizeof(*input->needles));
+
+	return input->strs && input->lens && input->needles ? 0 : -ENOMEM;
+}
+
+static void input_free(struct input * input)
+{
+	for (size_t i = 0; input->strs && i < input->count; ++i)
+		free(input->strs[i]);
+	for (size_t i = 0; input->needles && i < input->needle_nb; ++i)
+		free(input->needles[i]);
+	free(input->strs);
+	free(input->lens);
+	free(input->needles);
+}
+
+/* @brief Random needles of length m against random strings of length n. */
+static int input_random(struct input * input, size_t m, size_t n)
+{
+	uint64_t state = 0x9e3779b97f4a7c15u ^ (m << 20) ^ n;
+
+	snprintf(input->label, sizeof(input->label), "random %zux%zu", m, n);
+	if (input_alloc(input, KERNELS_STRINGS, KERNELS_NEEDLES) < 0)
+		return -ENOMEM;
+
+	for (; input->needle_nb < KERNELS_NEEDLES; ++input->needle_nb)
+	{
+		input->needles[input->needle_nb] = random_string(&state, m);
+		if (!input->needles[input->needle_nb])
+			return -ENOMEM;
+	}
+
+	for (; input->count < KERNELS_STRINGS; ++input->count)
+	{
+		input->strs[input->count] = random_string(&state, n);
+		if (!input->strs[input->count])
+			return -ENOMEM;
+		input->lens[input->count] = n;
+	}
+
+	input_finish(input);
+
+	return 0;
+}
+
+static int input_add(struct input * input, size_t * capacity,
+		char const * name, size_t len)
+{
+	if (input->count == *capacity)
+	{
+		size_t grown = *capacity ? *capacity * 2 : 1024;
+		char ** strs = realloc(input->strs, grown * sizeof(*strs));
+		size_t * lens;
+
+		if (!strs)
+			return -ENOMEM;
+		input->strs = strs;
+
+		lens = realloc(input->lens, grown * sizeof(*lens));
+		if (!lens)
+			return -ENOMEM;
+		input->lens = lens;
+		*capacity = grown;
+	}
+
+	input->strs[input->count] = strndup(name, len);
+	if (!input->strs[input->count])
+		return -ENOMEM;
+	input->lens[input->count++] = len;
+
+	return 0;
+}
+
+/* @brief The symbols of an ELF file, or the lines of a text dump.
+ *
+ * The needles are symbols of the file taken at regular intervals.
+ */
+static int input_file(struct input * input, char const * path)
+{
+	struct elf_file elf;
+	size_t capacity = 0;
+	int ret;
+
+	snprintf(input->label, sizeof(input->label), "%s",
+			strrchr(path, '/') ? strrchr(path, '/') + 1 : path);
+
+	ret = elf_open(&elf, path);
+	if (ret == 0)
+	{
+		for (size_t i = 1; ret == 0 && i < elf.dynsym_count; ++i)
+		{
+			struct elf_symbol sym;
+
+			if (elf_symbol(&elf, i, &sym) < 0 || !sym.name[0])
+				continue;
+			ret = input_add(input, &capacity, sym.name,
+					strlen(sym.name));
+		}
+		elf_close(&elf);
+	}
+	else if (ret == -ENOEXEC)
+	{
+		FILE * file = fopen(path, "r");
+		char * line = NULL;
+		size_t size = 0;
+		ssize_t len;
+
+		if (!file)
+			return -errno;
+
+		ret = 0;
+		while (ret == 0 && (len = getline(&line, &size, file)) >= 0)
+		{
+			while (len && (line[len - 1] == '\n' ||
+						line[len - 1] == '\r'))
+				len--;
+			if (len)
+				ret = input_add(input, &capacity, line,
+						(size_t)len);
+		}
+		free(line);
+		fclose(file);
+	}
+	if (ret < 0)
+		return ret;
+
+	if (!input->count)
+	{
+		printf("Error: no symbol in %s\n", path);
+		return -EINVAL;
+	}
+
+	input->needles = calloc(KERNELS_NEEDLES, sizeof(*input->needles));
+	if (!input->needles)
+		return -ENOMEM;
+	for (; input->needle_nb < KERNELS_NEEDLES &&
+			input->needle_nb < input->count; ++input->needle_nb)
+	{
+		size_t i = input->needle_nb * input->count / KERNELS_NEEDLES;
+
+		input->needles[input->needle_nb] = strdup(input->strs[i]);
+		if (!input->needles[input->needle_nb])
+			return -ENOMEM;
+	}
+
+	input_finish(input);
+
+	return 0;
+}
+
+/* @brief Score the whole input once with a kernel.
+ *
+ * @param dists needle_nb rows of count distances.
+ */
+static int kernel_pass(struct kernel const * kernel, struct lev_ctx * levs,
+		struct input const * input, int k, int * dists)
+{
+	for (size_t n = 0; n < input->needle_nb; ++n)
+	{
+		int ret = kernel->run(kernel, &levs[n], input, k,
+				dists + n * input->count);
+
+		if (ret < 0)
+			return ret;
+	}
+
+	return 0;
+}
+
+/* @brief Compare the distances of a kernel to the reference ones.
+ *
+ * The bounded kernels only have to tell the distances above k apart.
+ *
+ * @return The number of mismatches.
+ */
+static size_t kernel_check(struct kernel const * kernel,
+		struct input const * input, int k, int const * dists,
+		int const * reference)
+{
+	size_t mismatches = 0;
+
+	for (size_t n = 0; n < input->needle_nb; ++n)
+	{
+		for (size_t i = 0; i < input->count; ++i)
+		{
+			int expected = reference[n * input->count + i];
+			int got = dists[n * input->count + i];
+
+			if (kernel->bounded && expected > k)
+				expected = LEV_EXCEEDS_BOUND;
+			if (got == expected)
+				continue;
+
+			if (!mismatches)
+				printf("Error: %s gives %d instead of %d for "
+					"'%s' and '%s'\n", kernel->name, got,
+					expected, input->needles[n],
+					input->strs[i]);
+			mismatches++;
+		}
+	}
+
+	return mismatches;
+}
+
+static void usage(void)
+{
+	printf(
+		"Usage: bench_kernels [options] [FILE...]\n"
+		"Time the distance kernels and check them against the DP.\n"
+		"FILE is a shared object or a dump with one symbol per line.\n"
+		"  -p M:N  random needles of length M against strings of length "
+			"N,\n"
+		"          may be repeated (default 8:8, 16:24, 32:32, 64:64 "
+			"and 200:200).\n"
+		"  -k K    bound of the bounded kernels (default 3).\n");
+}
+
+static int parse_pair(char const * str, size_t * m, size_t * n)
+{
+	char * end = NULL;
+
+	*m = strtoul(str, &end, 10);
+	if (*end != ':' || !*m || *m > 4096)
+		return -EINVAL;
+	*n = strtoul(end + 1, &end, 10);
+	if (*end || !*n || *n > 4096)
+		return -EINVAL;
+
+	return 0;
+}
+
+int main(int argc, char * argv[])
+{
+	static size_t const default_pairs[][2] = {
+		{ 8, 8 }, { 16, 24 }, { 32, 32 }, { 64, 64 }, { 200, 200 },
+	};
+	struct input inputs[KERNELS_MAX_SETS] = { 0 };
+	struct counters counters = { 0 };
+	enum lev_isa isa = lev_batch_isa();
+	size_t input_nb = 0;
+	size_t mismatches = 0;
+	int k = 3;
+	int opt;
+	int ret = 0;
+
+	while ((opt = getopt(argc, argv, "p:k:")) != -1)
+	{
+		size_t m;
+		size_t n;
+
+		switch (opt)
+		{
+			case 'p':
+				if (parse_pair(optarg, &m, &n) < 0 ||
+						input_nb == KERNELS_MAX_SETS)
+				{
+					usage();
+					return 1;
+				}
+				ret = input_random(&inputs[input_nb++], m, n);
+				break;
+			case 'k':
+				k = atoi(optarg);
+				if (k < 0)
+				{
+					usage();
+					return 1;
+				}
+				break;
+			default:
+				usage();
+				return 1;
+		}
+		if (ret < 0)
+			goto END;
+	}
+
+	if (!input_nb)
+	{
+		for (size_t i = 0; i < sizeof(default_pairs) /
+				sizeof(*default_pairs); ++i)
+		{
+			ret = input_random(&inputs[input_nb++],
+					default_pairs[i][0], default_pairs[i][1]);
+			if (ret < 0)
+				goto END;
+		}
+	}
+
+	for (int i = optind; i < argc && input_nb < KERNELS_MAX_SETS; ++i)
+	{
+		ret = input_file(&inputs[input_nb++], argv[i]);
+		if (ret < 0)
+		{
+			printf("Error: failed to load %s: %s\n", argv[i],
+				strerror(-ret));
+			goto END;
+		}
+	}
+
+	counters_open(&counters);
+
+	printf("%-22s %-13s %10s %10s %9s %6s %9s\n", "input", "kernel",
+		"ns/cmp", "Mcells/s", "cycles", "IPC", "br-miss");
+
+	for (size_t s = 0; s < input_nb; ++s)
+	{
+		struct input const * input = &inputs[s];
+		size_t size = input->needle_nb * input->count;
+		int * reference = malloc(size * sizeof(*reference));
+		int * dists = malloc(size * sizeof(*dists));
+		struct lev_ctx * levs = calloc(input->needle_nb, sizeof(*levs));
+
+		ret = reference && dists && levs ? 0 : -ENOMEM;
+		for (size_t n = 0; ret == 0 && n < input->needle_nb; ++n)
+			ret = lev_ctx_init(&levs[n], input->needles[n]);
+
+		if (ret == 0)
+			ret = kernel_pass(&kernels[0], levs, input, k, reference);
+
+		for (size_t c = 0; ret == 0 && c < KERNEL_NB; ++c)
+		{
+			struct kernel const * kernel = &kernels[c];
+			double comparisons;
+			double elapsed;
+			double start;
+			size_t passes = 0;
+
+			if (kernel->isa > isa)
+				continue;
+
+			ret = kernel_pass(kernel, levs, input, k, dists);
+			if (ret < 0)
+				break;
+			mismatches += kernel_check(kernel, input, k, dists,
+					reference);
+
+			counters_start(&counters);
+			start = now();
+			do
+			{
+				ret = kernel_pass(kernel, levs, input, k, dists);
+				passes++;
+				elapsed = now() - start;
+			} while (ret == 0 && elapsed < KERNELS_MIN_TIME);
+			counters_stop(&counters);
+
+			comparisons = (double)passes * (double)size;
+			printf("%-22s %-13s %10.1f %10.1f", input->label,
+				kernel->name, elapsed * 1e9 / comparisons,
+				input->cells * (double)passes / elapsed / 1e6);
+			if (counters.enabled)
+				printf(" %9.1f %6.2f %9.3f",
+					(double)counters.values[COUNTER_CYCLES] /
+						comparisons,
+					(double)counters.values[COUNTER_INSTRUCTIONS] /
+						(double)(counters.values[COUNTER_CYCLES] ?
+						counters.values[COUNTER_CYCLES] : 1),
+					(double)counters.values[COUNTER_BRANCH_MISSES] /
+						comparisons);
+			printf("\n");
+		}
+
+		for (size_t n = 0; levs && n < input->needle_nb; ++n)
+			lev_ctx_free(&levs[n]);
+		free(levs);
+		free(reference);
+		free(dists);
+		if (ret < 0)
+			goto END;
+	}
+
+	if (mismatches)
+		printf("Error: %zu distances differ from the reference.\n",
+			mismatches);
+
+END:
+	counters_close(&counters);
+	for (size_t s = 0; s < KERNELS_MAX_SETS; ++s)
+		input_free(&inputs[s]);
+
+	return ret < 0 || mismatches ? 1 : 0;
+}
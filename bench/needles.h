@@ -0,0 +1,35 @@
+/* moses Find symbol in shared libraries.
+ * Copyright (C) 2022  Mathias Schmitt
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef __BENCH_NEEDLES_H__
+#define __BENCH_NEEDLES_H__
+
+/* The needles of the end to end benchmark. The corpus defines each of them
+ * in some of its libraries, so that the cases measure hits, not only
+ * misses. */
+static char const * const bench_needles[] = {
+	"parse_config_file",
+	"g_hash_table_lookup",
+	"_ZN6stream4readEPvm",
+	"png_read_buffer",
+	"sqlite3_open_state",
+	"xmlFreeNode",
+	"curl_socket_write",
+	"zstream_init",
+};
+
+#endif /* __BENCH_NEEDLES_H__ */
@@ -0,0 +1,99 @@
+/* moses Find symbol in shared libraries.
+ * Copyright (C) 2022  Mathias Schmitt
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef __BKTREE_H__
+#define __BKTREE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Largest edit count for which the server prefers the tree. */
+#define BKTREE_MAX_EDITS 2
+
+struct lev_ctx;
+
+/* A Burkhard-Keller tree over distinct names, with Levenshtein's distance
+ * as the metric.
+ *
+ * The children of a node sit at their distance to it, so by the triangle
+ * inequality a query within k edits of a name at distance d from the node
+ * only has to visit the children between d - k and d + k.
+ *
+ * The nodes are laid out in breadth-first order in flat arrays: the
+ * children of node i are the nodes child_start[i] to child_start[i + 1],
+ * sorted by their distance to i.
+ */
+struct bktree
+{
+	uint32_t * node_name;
+	uint32_t * parent_dist;
+	uint32_t * child_start;
+	size_t node_nb;
+};
+
+/* The names found by a query. */
+struct bktree_result
+{
+	uint32_t * names;
+	int * dists;
+	size_t count;
+	size_t capacity;
+
+	/* Number of nodes whose distance was computed. */
+	size_t visited;
+};
+
+/* @brief Build a tree over distinct names.
+ *
+ * @param tree The tree to fill.
+ * @param names The names, which must outlive the tree.
+ * @param count The number of names.
+ * @return 0 on success, -ENOMEM on failure.
+ */
+int bktree_build(struct bktree * tree, char const * const * names,
+		size_t count);
+
+/* @brief Free a tree.
+ *
+ * @param tree The tree.
+ */
+void bktree_free(struct bktree * tree);
+
+/* @brief Find the names within k edits of a needle.
+ *
+ * The matches are appended to the result, its count and visited fields are
+ * reset first.
+ *
+ * @param tree The tree.
+ * @param names The names the tree was built over.
+ * @param lens The lengths of the names.
+ * @param lev The distance context of the needle.
+ * @param k The largest distance of a match.
+ * @param result The result, zeroed before its first use.
+ * @return 0 on success, -ENOMEM on failure.
+ */
+int bktree_query(struct bktree const * tree, char const * const * names,
+		uint32_t const * lens, struct lev_ctx * lev, int k,
+		struct bktree_result * result);
+
+/* @brief Free the memory of a result.
+ *
+ * @param result The result.
+ */
+void bktree_result_free(struct bktree_result * result);
+
+#endif /* __BKTREE_H__ */
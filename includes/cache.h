@@ -0,0 +1,82 @@
+/* moses Find symbol in shared libraries.
+ * Copyright (C) 2022  Mathias Schmitt
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef __CACHE_H__
+#define __CACHE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Distances of the symbol names already scored during the run.
+ *
+ * The same imports (malloc, memcpy, __cxa_finalize, ...) appear in almost
+ * every library, the cache lets each distinct name be scored once against
+ * each needle. Names are interned in the cache, and the table is split in
+ * shards with their own lock so that scanning threads rarely wait for each
+ * other.
+ */
+struct cache;
+
+/* @brief Create an empty cache.
+ *
+ * @return The cache, or NULL if it could not be allocated.
+ */
+struct cache * cache_create(void);
+
+/* @brief Free a cache and the names it holds.
+ *
+ * @param cache The cache.
+ */
+void cache_destroy(struct cache * cache);
+
+/* @brief Hash a name, for cache_lookup and cache_insert.
+ *
+ * The hash does not depend on the needle, it is computed once per name.
+ *
+ * @param name The name.
+ * @param len The length of the name.
+ * @return The hash of the name.
+ */
+uint64_t cache_hash(char const * name, size_t len);
+
+/* @brief Find the distance of a name to a needle.
+ *
+ * @param cache The cache.
+ * @param needle The index of the needle.
+ * @param name The name.
+ * @param len The length of the name.
+ * @param hash The hash of the name.
+ * @param dist Filled with the distance stored for the name.
+ * @return 1 if the name was found, 0 otherwise.
+ */
+int cache_lookup(struct cache * cache, unsigned needle, char const * name,
+		size_t len, uint64_t hash, int * dist);
+
+/* @brief Store the distance of a name to a needle.
+ *
+ * @param cache The cache.
+ * @param needle The index of the needle.
+ * @param name The name, copied into the cache.
+ * @param len The length of the name.
+ * @param hash The hash of the name.
+ * @param dist The distance of the name.
+ * @return 0 on success, -ENOMEM on failure.
+ */
+int cache_insert(struct cache * cache, unsigned needle, char const * name,
+		size_t len, uint64_t hash, int dist);
+
+#endif /* __CACHE_H__ */
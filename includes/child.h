@@ -26,7 +26,7 @@
  * @param pfds The file descriptors of the pipe.
  * @param verbose The verbosity of the program.
  */
-void run_child(char * haystack, int pfds[PFD_NUMBER], int verbose);
+void run_child(char const * haystack, int pfds[PFD_NUMBER], int verbose);
 
 #endif /* __CHILD_H__ */
 
@@ -1,15 +1,57 @@
 #ifndef __COMMON_H_
 #define __COMMON_H_
 
+#include <stddef.h>
+
+#include "filter.h"
+
 #define MIN_DISTANCE 70.0
-#define MAX_HAYSTACKS 100
+#define MAX_JOBS 1024
+#define MAX_TOP 1000000
+
+struct cache;
+struct index;
+struct scan_ctx;
+struct stats;
+struct store;
+struct topk;
+struct watch;
 
 struct args
 {
-	char * needle;
-	char * haystacks[MAX_HAYSTACKS];
+	char ** needles;
+	size_t needle_nb;
+	char const * needles_path;
+	int print_needle;
+	char ** haystacks;
+	size_t haystack_nb;
+	int from_stdin;
+	int null_separated;
+	int system;
+	char const * deps_path;
 	double min_distance;
 	int verbose;
+	int use_nm;
+	unsigned jobs;
+	char const * index_path;
+	int build_index;
+	struct index * index;
+	struct scan_ctx * scan_ctxs;
+	struct cache * cache;
+	size_t top;
+	struct topk ** topks;
+	char const * serve_path;
+	char const * connect_path;
+	struct store * store;
+	int bktree;
+	int symspell;
+	int watch_mode;
+	struct watch * watch;
+	int print_stats;
+	int stats_json;
+	struct stats * stats;
+	int io_uring;
+	struct filter filter;
 };
 
 
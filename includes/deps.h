@@ -0,0 +1,82 @@
+/* moses Find symbol in shared libraries.
+ * Copyright (C) 2022  Mathias Schmitt
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef __DEPS_H__
+#define __DEPS_H__
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/* Directories the dynamic loader searches last, after its cache. */
+#define DEPS_DEFAULT_PATH "/lib:/usr/lib"
+#define DEPS_DEFAULT_PATH_64 "/lib64:/usr/lib64:" DEPS_DEFAULT_PATH
+
+/* An object of the closure: the binary, or a library it needs. */
+struct dep
+{
+	/* The name the object is needed as, the path given for the binary. */
+	char * name;
+
+	/* Where the object was found, NULL if it was not. */
+	char * path;
+
+	/* The object that first needed this one, 0 for the binary itself. */
+	size_t parent;
+
+	/* The search paths of the object, with $ORIGIN, $LIB and $PLATFORM
+	 * replaced, NULL when absent. rpath is dropped when runpath is set. */
+	char * rpath;
+	char * runpath;
+	char * soname;
+
+	dev_t dev;
+	ino_t ino;
+};
+
+/* The transitive DT_NEEDED closure of a binary, in the breadth-first order
+ * the dynamic loader maps it. */
+struct deps
+{
+	struct dep * objects;
+	size_t count;
+	size_t capacity;
+};
+
+/* @brief Resolve every library a binary needs, and the ones they need.
+ *
+ * Each DT_NEEDED entry is looked up the way ld.so does: as a path if it
+ * holds a slash, otherwise in the DT_RPATH of the object and of its loaders
+ * unless the object has a DT_RUNPATH, then in LD_LIBRARY_PATH, the
+ * DT_RUNPATH of the object, LDCACHE_PATH and the default directories. Files
+ * of another class or machine than the binary are skipped. Each library is
+ * read once, however many objects need it.
+ *
+ * @param deps The structure to fill, the binary first. A library that is not
+ * found is kept with a NULL path.
+ * @param binary The path of the binary.
+ * @return 0 on success, -ENOEXEC if the binary is not an ELF file, or another
+ * negative errno value.
+ */
+int deps_resolve(struct deps * deps, char const * binary);
+
+/* @brief Free a closure filled by deps_resolve.
+ *
+ * @param deps The closure.
+ */
+void deps_free(struct deps * deps);
+
+#endif /* __DEPS_H__ */
@@ -0,0 +1,231 @@
+/* moses Find symbol in shared libraries.
+ * Copyright (C) 2022  Mathias Schmitt
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef __ELFSYM_H__
+#define __ELFSYM_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* A dynamic symbol, decoded to host byte order.
+ *
+ * The name points directly into the mapped .dynstr section and stays valid
+ * until the file is closed.
+ */
+struct elf_symbol
+{
+	char const * name;
+	unsigned char info;
+	unsigned char other;
+	uint16_t shndx;
+
+	/* Left NULL by elf_symbol, see elf_version. */
+	char const * version;
+};
+
+/* An entry of the dynamic section, decoded to host byte order. */
+struct elf_dyn
+{
+	int64_t tag;
+	uint64_t value;
+
+	/* The string of .dynstr the value refers to for DT_NEEDED, DT_SONAME,
+	 * DT_RPATH and DT_RUNPATH, NULL otherwise. */
+	char const * string;
+};
+
+/* A shared object mapped in memory, or whose symbol table and strings were
+ * read in a buffer. */
+struct elf_file
+{
+	unsigned char const * map;
+	size_t size;
+	void * buffer;
+	int is_64;
+	int swap;
+
+	/* Bytes of the ELF header and of the section header table. */
+	size_t headers_size;
+
+	unsigned char const * dynsym;
+	size_t dynsym_entsize;
+	size_t dynsym_count;
+
+	char const * dynstr;
+	size_t dynstr_size;
+
+	/* Hash tables of the symbols, NULL when absent. */
+	unsigned char const * gnu_hash;
+	size_t gnu_hash_size;
+	unsigned char const * hash;
+	size_t hash_size;
+
+	/* Version tables of the symbols, NULL when absent. */
+	unsigned char const * versym;
+	size_t versym_size;
+	unsigned char const * verdef;
+	size_t verdef_size;
+	size_t verdef_count;
+	unsigned char const * verneed;
+	size_t verneed_size;
+	size_t verneed_count;
+
+	/* Dynamic section, NULL when absent or when only the symbols were
+	 * read. */
+	unsigned char const * dynamic;
+	size_t dynamic_entsize;
+	size_t dynamic_count;
+};
+
+/* Where the dynamic symbol table of an ELF file lies, from its headers. */
+struct elf_layout
+{
+	int is_64;
+	int swap;
+	uint16_t machine;
+
+	uint64_t shoff;
+	uint64_t shentsize;
+	uint64_t shnum;
+
+	/* Zero sizes when there is no .dynsym section. */
+	uint64_t dynsym_offset;
+	uint64_t dynsym_size;
+	uint64_t dynsym_entsize;
+	uint64_t dynstr_offset;
+	uint64_t dynstr_size;
+
+	/* Zero sizes when the symbols have no such hash table. */
+	uint64_t gnu_hash_offset;
+	uint64_t gnu_hash_size;
+	uint64_t hash_offset;
+	uint64_t hash_size;
+
+	/* Zero sizes when the symbols are not versioned. */
+	uint64_t versym_offset;
+	uint64_t versym_size;
+	uint64_t verdef_offset;
+	uint64_t verdef_size;
+	uint64_t verdef_count;
+	uint64_t verneed_offset;
+	uint64_t verneed_size;
+	uint64_t verneed_count;
+
+	/* Zero sizes when there is no dynamic section. */
+	uint64_t dynamic_offset;
+	uint64_t dynamic_size;
+	uint64_t dynamic_entsize;
+};
+
+/* @brief Decode the ELF header at the start of a file.
+ *
+ * @param layout Filled with the class, byte order and section table.
+ * @param data The first bytes of the file.
+ * @param size The number of bytes in data.
+ * @return 0 on success, -ENOEXEC if the file is not a valid ELF object.
+ */
+int elf_read_header(struct elf_layout * layout, void const * data,
+		size_t size);
+
+/* @brief Locate .dynsym and its strings in the section header table.
+ *
+ * @param layout Decoded by elf_read_header, completed with the sections.
+ * @param table The section header table.
+ * @param table_size The number of bytes in table.
+ * @return 0 on success, even without .dynsym, -ENOEXEC if the table is
+ * malformed.
+ */
+int elf_read_sections(struct elf_layout * layout, void const * table,
+		size_t table_size);
+
+/* @brief Make a file of a symbol table and its strings read in memory.
+ *
+ * @param elf The structure to fill.
+ * @param layout The layout of the file.
+ * @param buffer The symbol table followed by the strings, freed by
+ * elf_close.
+ */
+void elf_attach(struct elf_file * elf, struct elf_layout const * layout,
+		void * buffer);
+
+/* @brief Map an ELF file and locate its dynamic symbol table.
+ *
+ * Both 32 and 64-bit objects are supported, in either byte order. A file
+ * without a .dynsym section is not an error, it simply has no symbols.
+ *
+ * @param elf The structure to fill.
+ * @param path The path of the file to map.
+ * @return 0 on success, -ENOEXEC if the file is not a valid ELF object,
+ * or another negative errno value if it could not be mapped.
+ */
+int elf_open(struct elf_file * elf, char const * path);
+
+/* @brief Read a symbol from the dynamic symbol table.
+ *
+ * @param elf The mapped file.
+ * @param index The index of the symbol, less than elf->dynsym_count.
+ * @param sym The structure to fill.
+ * @return 0 on success, -EINVAL if the symbol is malformed.
+ */
+int elf_symbol(struct elf_file const * elf, size_t index,
+		struct elf_symbol * sym);
+
+/* @brief Find the symbols of a name through the hash tables of the file.
+ *
+ * .gnu.hash is preferred, its bloom filter rules most libraries out at
+ * once. The symbols it leaves out of the table, the undefined ones, are
+ * compared one by one. The SysV hash table is used otherwise.
+ *
+ * @param elf The mapped file.
+ * @param name The name of the symbols.
+ * @param indexes Filled with the index of every symbol found.
+ * @param capacity The number of indexes that fit in indexes, symbols found
+ * past it are dropped.
+ * @param count Set to the number of symbols found.
+ * @return 0 on success, -ENOENT if the file has no usable hash table.
+ */
+int elf_lookup(struct elf_file const * elf, char const * name,
+		size_t * indexes, size_t capacity, size_t * count);
+
+/* @brief Give the version of a symbol, from .gnu.version and the version
+ * definitions or requirements it refers to.
+ *
+ * @param elf The mapped file.
+ * @param index The index of the symbol, less than elf->dynsym_count.
+ * @return The name of the version, such as GLIBC_2.34, or NULL if the
+ * symbol is not versioned.
+ */
+char const * elf_version(struct elf_file const * elf, size_t index);
+
+/* @brief Read an entry of the dynamic section.
+ *
+ * @param elf The mapped file.
+ * @param index The index of the entry, less than elf->dynamic_count.
+ * @param dyn The structure to fill.
+ * @return 0 on success, -ENOENT if the entry is DT_NULL and ends the section.
+ */
+int elf_dynamic(struct elf_file const * elf, size_t index,
+		struct elf_dyn * dyn);
+
+/* @brief Unmap a file mapped by elf_open, or free the tables given to
+ * elf_attach.
+ *
+ * @param elf The mapped file.
+ */
+void elf_close(struct elf_file * elf);
+
+#endif /* __ELFSYM_H__ */
@@ -0,0 +1,86 @@
+/* moses Find symbol in shared libraries.
+ * Copyright (C) 2022  Mathias Schmitt
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef __FILTER_H__
+#define __FILTER_H__
+
+struct elf_symbol;
+
+/* The symbols worth scoring. Each mask holds 1 << value for the accepted
+ * ELF types, bindings or visibilities, 0 accepting them all.
+ */
+struct filter
+{
+	/* Set when any of the filters below is, so that callers can skip
+	 * the checks altogether. */
+	int active;
+	int defined_only;
+	unsigned types;
+	unsigned bindings;
+	unsigned visibilities;
+	char const * version;
+};
+
+/* @brief Add the symbol types of a list to a filter.
+ *
+ * @param filter The filter.
+ * @param list Comma separated names among notype, object, func, section,
+ * file, common, tls and ifunc.
+ * @return 0 on success, -EINVAL if a name is unknown.
+ */
+int filter_types(struct filter * filter, char const * list);
+
+/* @brief Add the symbol bindings of a list to a filter.
+ *
+ * @param filter The filter.
+ * @param list Comma separated names among local, global, weak and unique.
+ * @return 0 on success, -EINVAL if a name is unknown.
+ */
+int filter_bindings(struct filter * filter, char const * list);
+
+/* @brief Add the symbol visibilities of a list to a filter.
+ *
+ * @param filter The filter.
+ * @param list Comma separated names among default, internal, hidden and
+ * protected.
+ * @return 0 on success, -EINVAL if a name is unknown.
+ */
+int filter_visibilities(struct filter * filter, char const * list);
+
+/* @brief Check a symbol of the dynamic symbol table against a filter.
+ *
+ * @param filter The filter.
+ * @param sym The symbol, its version filled when the filter has one.
+ * @return 1 if the symbol is to be scored, 0 otherwise.
+ */
+int filter_symbol(struct filter const * filter, struct elf_symbol const * sym);
+
+/* @brief Check a symbol listed by nm against a filter.
+ *
+ * nm only gives a letter for the section of the symbol. Undefined symbols
+ * are U, v and w, weak ones V, v, W and w, lowercase letters are local
+ * except for the unique u and the indirect i. T and t are functions, the
+ * data sections objects, and the type of the others is unknown. nm does not
+ * tell the visibility.
+ *
+ * @param filter The filter.
+ * @param type The letter nm gives to the symbol.
+ * @param version The version of the symbol, NULL if it has none.
+ * @return 1 if the symbol is to be scored, 0 otherwise.
+ */
+int filter_nm(struct filter const * filter, char type, char const * version);
+
+#endif /* __FILTER_H__ */
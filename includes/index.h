@@ -0,0 +1,111 @@
+/* moses Find symbol in shared libraries.
+ * Copyright (C) 2022  Mathias Schmitt
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef __INDEX_H__
+#define __INDEX_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+#include "elfsym.h"
+
+/* The file is not an ELF object, there is nothing to search in it. */
+#define INDEX_NOT_ELF 0x1
+
+/* The symbol has no version. */
+#define INDEX_NO_VERSION UINT32_MAX
+
+/* A symbol as stored in the index. */
+struct index_sym
+{
+	uint32_t name;
+	unsigned char info;
+	unsigned char other;
+	uint16_t shndx;
+	uint32_t version;
+};
+
+/* The symbols of one library, as found in the index. The name of a symbol is
+ * at strings + sym->name, its version at strings + sym->version unless it is
+ * INDEX_NO_VERSION.
+ */
+struct index_view
+{
+	struct index_sym const * syms;
+	char const * strings;
+	size_t count;
+	uint32_t flags;
+};
+
+struct index;
+
+/* @brief Open a symbol index.
+ *
+ * The file is mapped in memory. A missing, truncated or incompatible file is
+ * not an error: the index simply starts empty and is rewritten on save.
+ *
+ * @param path The path of the index file.
+ * @return The index, or NULL if it could not be allocated.
+ */
+struct index * index_open(char const * path);
+
+/* @brief Look up the symbols of a library.
+ *
+ * Libraries are identified by device and inode, and an entry is only valid
+ * if the size and modification time of the file did not change since it
+ * was stored.
+ *
+ * @param index The index.
+ * @param statbuff The status of the library, as returned by stat.
+ * @param view Filled with the symbols of the library on success.
+ * @return 1 if an up to date entry was found, 0 otherwise.
+ */
+int index_lookup(struct index * index, struct stat const * statbuff,
+		struct index_view * view);
+
+/* @brief Record the symbols of a library.
+ *
+ * The names are copied, the symbols can be released right after the call.
+ *
+ * @param index The index.
+ * @param statbuff The status of the library, as returned by stat.
+ * @param flags INDEX_NOT_ELF if the file is not an ELF object, 0 otherwise.
+ * @param syms The symbols of the library.
+ * @param count The number of symbols.
+ * @return 0 on success, -ENOMEM on failure.
+ */
+int index_add(struct index * index, struct stat const * statbuff,
+		uint32_t flags, struct elf_symbol const * syms, size_t count);
+
+/* @brief Write the index back to its file, if it changed.
+ *
+ * The file is replaced atomically.
+ *
+ * @param index The index.
+ * @param prune Drop the libraries that were not looked up during this run.
+ * @return 0 on success, less than 0 otherwise.
+ */
+int index_save(struct index * index, int prune);
+
+/* @brief Unmap the index and free it.
+ *
+ * @param index The index.
+ */
+void index_close(struct index * index);
+
+#endif /* __INDEX_H__ */
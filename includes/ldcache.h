@@ -0,0 +1,76 @@
+/* moses Find symbol in shared libraries.
+ * Copyright (C) 2022  Mathias Schmitt
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#ifndef __LDCACHE_H__
+#define __LDCACHE_H__
+
+#include <stddef.h>
+
+/* The cache ldconfig writes for the dynamic loader. */
+#define LDCACHE_PATH "/etc/ld.so.cache"
+
+/* The libraries listed in a loader cache, mapped in memory.
+ *
+ * Both formats of glibc are read: the old ld.so-1.7.0 one and the current
+ * glibc-ld.so.cache1.1 one, alone or appended to an old table as written by
+ * ldconfig before glibc 2.32.
+ */
+struct ldcache
+{
+	unsigned char const * map;
+	size_t size;
+
+	/* Table of entries, each of entry_size bytes, and the base their
+	 * string offsets are relative to. */
+	unsigned char const * entries;
+	size_t entry_size;
+	size_t count;
+	size_t strings;
+};
+
+/* @brief Map a loader cache and locate its table of libraries.
+ *
+ * @param cache The structure to fill.
+ * @param path The path of the cache, usually LDCACHE_PATH.
+ * @return 0 on success, -EINVAL if the file is not a loader cache of this
+ * machine, or another negative errno value if it could not be mapped.
+ */
+int ldcache_open(struct ldcache * cache, char const * path);
+
+/* @brief Give the name of a library of the cache, its soname.
+ *
+ * @param cache The cache.
+ * @param index The index of the library, less than cache->count.
+ * @return The name the library is needed as, such as libc.so.6, NULL if the
+ * entry is malformed.
+ */
+char const * ldcache_name(struct ldcache const * cache, size_t index);
+
+/* @brief Give the path of a library of the cache.
+ *
+ * @param cache The cache.
+ * @param index The index of the library, less than cache->count.
+ * @return The full path of the library, NULL if the entry is malformed.
+ */
+char const * ldcache_path(struct ldcache const * cache, size_t index);
+
+/* @brief Unmap a cache mapped by ldcache_open.
+ *
+ * @param cache The cache.
+ */
+void ldcache_close(struct ldcache * cache);
+
+#endif /* __LDCACHE_H__ */
@@ -18,7 +18,29 @@
 #ifndef __LEVENSTEIN_H__
 #define __LEVENSTEIN_H__
 
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Number of pattern characters handled by a single bit-vector word. */
+#define LEV_WORD_BITS 64
+
+/* Returned by the bounded distance when the strings are too far apart. */
+#define LEV_EXCEEDS_BOUND INT_MAX
+
 /* @brief Levenshtein algorithm
+ *
+ * Calculate the distance between two string with a bit-parallel algorithm.
+ * The shorter string is encoded in a single 64-bit word when it fits, in
+ * several blocks of 64 bits otherwise.
+ *
+ * @param s1 The first string.
+ * @param s2 The second string.
+ * @return The Levenshtein's distance, or less than 0 if it fails.
+ */
+int lev_string_dist(char const * s1, char const * s2);
+
+/* @brief Levenshtein algorithm, reference implementation.
  *
  * Calculate the distance between two string.
  * Code written using the pseudo-code from the wikipedia page:
@@ -28,7 +50,192 @@
  * @param s2 The second string.
  * @return The Levenshtein's distance, or less than 0 if it fails.
  */
-int lev_string_dist(char const * s1, char const * s2);
+int lev_string_dist_dp(char const * s1, char const * s2);
+
+/* @brief Levenshtein algorithm with an upper bound.
+ *
+ * Same as lev_string_dist, but gives up as soon as the distance is known to
+ * be larger than max: strings whose lengths differ by more than max are
+ * rejected upfront, and the computation stops once every path through the
+ * matrix exceeds the bound.
+ *
+ * @param s1 The first string.
+ * @param s2 The second string.
+ * @param max The largest distance of interest.
+ * @return The Levenshtein's distance if it is at most max, LEV_EXCEEDS_BOUND
+ * if it is larger, or less than 0 if it fails.
+ */
+int lev_string_dist_bounded(char const * s1, char const * s2, int max);
+
+/* @brief Convert a minimum percentage into a maximum number of edits.
+ *
+ * @param min_percent The minimum percentage, as given to lev_dist_percent.
+ * @param len1 The length of the first string.
+ * @param len2 The length of the second string.
+ * @return The largest distance whose percentage is at least min_percent, or
+ * -1 if no distance reaches it.
+ */
+int lev_max_edits(double min_percent, size_t len1, size_t len2);
+
+/* Largest number of strings a vector kernel scores at once. */
+#define LEV_BATCH_MAX 32
+
+/* Instruction sets the batch kernels are written for. */
+enum lev_isa
+{
+	LEV_ISA_SCALAR,
+	LEV_ISA_SSE41,
+	LEV_ISA_AVX2,
+	LEV_ISA_AVX512
+};
+
+/* @brief Find the widest batch kernel supported by the running CPU.
+ *
+ * @return The instruction set of the kernel.
+ */
+enum lev_isa lev_batch_isa(void);
+
+/* @brief Give the number of strings a batch kernel scores at once.
+ *
+ * @param isa The instruction set of the kernel.
+ * @return The number of lanes, 1 for the scalar kernel.
+ */
+size_t lev_isa_width(enum lev_isa isa);
+
+/* @brief Levenshtein algorithm, one needle against many strings.
+ *
+ * The strings are scored by groups of lev_isa_width(isa), one per vector
+ * lane. The kernel must be supported by the running CPU.
+ *
+ * @param isa The instruction set of the kernel to use.
+ * @param needle The string every other one is compared to.
+ * @param strs The strings to compare to the needle.
+ * @param count The number of strings.
+ * @param dists Filled with the distance of every string to the needle.
+ * @return 0 on success, less than 0 if it fails.
+ */
+int lev_batch_dist_isa(enum lev_isa isa, char const * needle,
+		char const * const * strs, size_t count, int * dists);
+
+/* @brief Levenshtein algorithm, one needle against many strings, with the
+ * widest kernel the running CPU supports.
+ *
+ * @param needle The string every other one is compared to.
+ * @param strs The strings to compare to the needle.
+ * @param count The number of strings.
+ * @param dists Filled with the distance of every string to the needle.
+ * @return 0 on success, less than 0 if it fails.
+ */
+int lev_batch_dist(char const * needle, char const * const * strs,
+		size_t count, int * dists);
+
+/* Scratch memory to compare one needle to many strings.
+ *
+ * The needle is encoded once, and the buffers the kernels need are kept from
+ * one comparison to the next, so that scoring does not allocate once the
+ * context has grown to the longest string it has seen.
+ */
+struct lev_ctx
+{
+	char const * needle;
+	size_t needle_len;
+	enum lev_isa isa;
+
+	/* Bit-parallel kernels: match vectors of the needle and the vertical
+	 * deltas of every block. */
+	size_t blocks;
+	uint64_t * peq;
+	uint64_t * vp;
+
+	/* Batch kernels: the needle widened to 16 bits, one DP column of
+	 * vectors and the transposed batch. */
+	uint16_t * pattern;
+	void * columns;
+	uint16_t * chars;
+	size_t chars_capacity;
+
+	/* Banded kernel: two rows of 16-bit cells. */
+	uint16_t * rows;
+	size_t rows_capacity;
+};
+
+/* @brief Prepare a context to compare a needle to other strings.
+ *
+ * @param ctx The context to initialize.
+ * @param needle The needle, which must outlive the context.
+ * @return 0 on success, -ENOMEM on failure.
+ */
+int lev_ctx_init(struct lev_ctx * ctx, char const * needle);
+
+/* @brief Free the memory held by a context.
+ *
+ * @param ctx The context.
+ */
+void lev_ctx_free(struct lev_ctx * ctx);
+
+/* @brief Levenshtein's distance between the needle and a string.
+ *
+ * @param ctx The context of the needle.
+ * @param str The string.
+ * @param len The length of the string.
+ * @return The Levenshtein's distance.
+ */
+int lev_ctx_dist(struct lev_ctx * ctx, char const * str, size_t len);
+
+/* @brief Levenshtein's distance between the needle and a string, with an
+ * upper bound.
+ *
+ * @param ctx The context of the needle.
+ * @param str The string.
+ * @param len The length of the string.
+ * @param max The largest distance of interest.
+ * @return The Levenshtein's distance if it is at most max, LEV_EXCEEDS_BOUND
+ * if it is larger, or less than 0 if it fails.
+ */
+int lev_ctx_dist_bounded(struct lev_ctx * ctx, char const * str, size_t len,
+		int max);
+
+/* @brief Levenshtein's distance between the needle and many strings, with
+ * the batch kernel of the context.
+ *
+ * @param ctx The context of the needle.
+ * @param strs The strings.
+ * @param lens The lengths of the strings.
+ * @param count The number of strings.
+ * @param dists Filled with the distance of every string to the needle.
+ * @return 0 on success, less than 0 if it fails.
+ */
+int lev_ctx_batch(struct lev_ctx * ctx, char const * const * strs,
+		size_t const * lens, size_t count, int * dists);
+
+/* @brief Levenshtein's distance between the needle and many strings, with
+ * the batch kernel of the context and an upper bound for each string.
+ *
+ * A lane stops as soon as its distance is known to exceed its bound, and a
+ * group of strings as soon as all of its lanes have.
+ *
+ * @param ctx The context of the needle.
+ * @param strs The strings.
+ * @param lens The lengths of the strings.
+ * @param count The number of strings.
+ * @param maxes The largest distance of interest of every string.
+ * @param dists Filled with the distance of every string to the needle if it
+ * is at most its bound, LEV_EXCEEDS_BOUND otherwise.
+ * @return 0 on success, less than 0 if it fails.
+ */
+int lev_ctx_batch_bounded(struct lev_ctx * ctx, char const * const * strs,
+		size_t const * lens, size_t count, int const * maxes,
+		int * dists);
+
+/* @brief Give the Levenshtein's distance as a percentage, from the lengths of
+ * the strings.
+ *
+ * @param lev_dist The Levenshtein's distance.
+ * @param len1 The length of the first string.
+ * @param len2 The length of the second string.
+ * @return A percentage representing the Levenshtein's distance.
+ */
+double lev_len_percent(int lev_dist, size_t len1, size_t len2);
 
 /* @brief Give the Levenshtein's distance as a percentage.
  *
@@ -0,0 +1,82 @@
+/* moses Find symbol in shared libraries.
+ * Copyright (C) 2022  Mathias Schmitt
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef __MATCH_H__
+#define __MATCH_H__
+
+#include <stddef.h>
+#include <stdio.h>
+
+/* Number of symbols scored together against each needle, a multiple of the
+ * width of every vector kernel. */
+#define MATCH_BATCH_SIZE 256
+
+struct args;
+struct lev_ctx;
+
+/* @brief Print a symbol if its distance to a needle is high enough, or
+ * hand it to the best matches of the needle with --top.
+ *
+ * @param args The arguments of the program.
+ * @param needle The index of the needle.
+ * @param lev The distance context of the needle.
+ * @param out The stream the match is printed to.
+ * @param file The name of the file the symbol was found in.
+ * @param symbol The name of the symbol.
+ * @param len The length of the name.
+ * @param dist The distance of the symbol to the needle, or
+ * LEV_EXCEEDS_BOUND.
+ * @return 1 if the symbol matches, 0 otherwise.
+ */
+int match_print(struct args const * args, size_t needle,
+		struct lev_ctx * lev, FILE * out, char const * file,
+		char const * symbol, size_t len, int dist);
+
+/* @brief Score a symbol against the needles and print it for each one it
+ * matches.
+ *
+ * @param args The arguments of the program.
+ * @param levs The distance contexts of the needles.
+ * @param out The stream the match is printed to.
+ * @param file The name of the file the symbol was found in.
+ * @param symbol The name of the symbol.
+ * @return The number of needles the symbol matches.
+ */
+size_t match_symbol(struct args const * args, struct lev_ctx * levs,
+		FILE * out, char const * file, char const * symbol);
+
+/* @brief Score the symbols of a library against the needles and print the
+ * matching ones.
+ *
+ * The symbols are taken in chunks, each chunk is scored against every needle
+ * while it is hot in cache. For each needle, the symbols whose length alone
+ * rules them out are dropped, the others are scored by the widest vector
+ * kernel available.
+ *
+ * @param args The arguments of the program.
+ * @param levs The distance contexts of the needles.
+ * @param out The stream the matches are printed to.
+ * @param file The name of the file the symbols were found in.
+ * @param symbols The names of the symbols.
+ * @param count The number of symbols.
+ * @return The number of matches, a symbol counting once per needle.
+ */
+size_t match_symbols(struct args const * args, struct lev_ctx * levs,
+		FILE * out, char const * file, char const * const * symbols,
+		size_t count);
+
+#endif /* __MATCH_H__ */
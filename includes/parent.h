@@ -18,24 +18,32 @@
 #ifndef __PARENT_H__
 #define __PARENT_H__
 
+#include <stdio.h>
+#include <sys/types.h>
+
 #include "pipe.h"
 
 struct args;
+struct scan_ctx;
 
 /* @brief Run the parent process passing the arguments to the program.
  *
  * @param args The arguments of the program.
+ * @param ctx The scratch memory of the thread.
  * @param pfds The file descriptors of the pipe.
  * @param pid The pid of the parent process.
  * @param file The name of the file the symbol is searched in.
+ * @param out The stream the matches are printed to.
  *
  * @return 0 if the parent successfully read from pipe to the child process.
  */
 int run_parent(
 		struct args * args,
+		struct scan_ctx * ctx,
 		int pfds[PFD_NUMBER],
 		pid_t pid,
-		char const * file);
+		char const * file,
+		FILE * out);
 
 #endif /* __PARENT_H__ */
 
@@ -0,0 +1,62 @@
+/* moses Find symbol in shared libraries.
+ * Copyright (C) 2022  Mathias Schmitt
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef __POOL_H__
+#define __POOL_H__
+
+/* @brief Function run by the workers on every submitted item.
+ *
+ * @param data The data given to pool_create.
+ * @param worker The index of the worker running the function, below the
+ * number of workers of the pool.
+ * @param item The submitted item. It is freed by the pool afterwards.
+ */
+typedef void (*pool_fn)(void * data, unsigned worker, char * item);
+
+struct pool;
+
+/* @brief Start a pool of worker threads.
+ *
+ * Every worker owns a deque of items. Submitted items are spread over the
+ * deques, and a worker whose deque runs dry steals from the others.
+ *
+ * @param workers The number of threads to start.
+ * @param fn The function run on every item.
+ * @param data Passed as is to fn.
+ * @return The pool, or NULL if it could not be created.
+ */
+struct pool * pool_create(unsigned workers, pool_fn fn, void * data);
+
+/* @brief Queue an item for processing.
+ *
+ * Once enough items wait in the deques, the call blocks until the workers
+ * take one, so that a fast producer does not make them grow without bound.
+ * It must not be called from the workers.
+ *
+ * @param pool The pool.
+ * @param item A heap allocated item, owned by the pool from now on.
+ * @return 0 on success, -ENOMEM if it could not be queued.
+ */
+int pool_submit(struct pool * pool, char * item);
+
+/* @brief Wait for all the queued items to be processed and free the pool.
+ *
+ * @param pool The pool.
+ */
+void pool_destroy(struct pool * pool);
+
+#endif /* __POOL_H__ */
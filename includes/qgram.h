@@ -0,0 +1,121 @@
+/* moses Find symbol in shared libraries.
+ * Copyright (C) 2022  Mathias Schmitt
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef __QGRAM_H__
+#define __QGRAM_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* Length of the substrings indexed. */
+#define QGRAM_Q 3
+
+struct args;
+struct lev_ctx;
+struct store;
+
+/* Where a name appears: a symbol of a library of the store. */
+struct qgram_occurrence
+{
+	uint32_t lib;
+	uint32_t symbol;
+};
+
+/* An inverted index from the q-grams of the names of a store to the names
+ * containing them.
+ *
+ * A name within k edits of the needle shares at least
+ * max(m, n) - q + 1 - k * q of its q-grams with it, so counting the shared
+ * q-grams through the posting lists rules out most names without computing
+ * any distance. The distinct names are numbered by length, so that the
+ * length filter is a range of every posting list.
+ */
+struct qgram_index
+{
+	/* The distinct names, by length. */
+	char const ** names;
+	uint32_t * lens;
+	size_t name_nb;
+
+	/* The first name of each length, up to max_len + 1. */
+	uint32_t * len_start;
+	size_t max_len;
+
+	/* The occurrences of name i, from occ_start[i] to occ_start[i + 1]. */
+	struct qgram_occurrence * occurrences;
+	uint32_t * occ_start;
+
+	/* The posting list of grams[i], from post_start[i] to
+	 * post_start[i + 1]. A name appears once per occurrence of the q-gram,
+	 * in increasing order. */
+	uint32_t * grams;
+	size_t gram_nb;
+	uint32_t * post_start;
+	uint32_t * postings;
+};
+
+/* @brief Index the names of a store.
+ *
+ * @param index The index to fill.
+ * @param store The store, which must outlive the index.
+ * @return 0 on success, -ENOMEM on failure, -EOVERFLOW if the store holds
+ * too many symbols.
+ */
+int qgram_build(struct qgram_index * index, struct store const * store);
+
+/* @brief Free an index.
+ *
+ * @param index The index.
+ */
+void qgram_free(struct qgram_index * index);
+
+/* @brief Print the symbols of the store matching a needle.
+ *
+ * The names sharing too few q-grams with the needle are skipped, the others
+ * are verified with the bounded distance. The matches are printed in the
+ * same order as a scan of the store would.
+ *
+ * @param index The index.
+ * @param store The store indexed.
+ * @param args The query, with a single needle.
+ * @param lev The distance context of the needle.
+ * @param out The stream the matches are printed to.
+ * @return 1 if the query was answered, 0 if the threshold is too low for
+ * the index to help and the store should be scanned, -ENOMEM on failure.
+ */
+int qgram_query(struct qgram_index const * index, struct store const * store,
+		struct args const * args, struct lev_ctx * lev, FILE * out);
+
+/* @brief Print every occurrence of the given names in the store, in the
+ * order a scan of the store would.
+ *
+ * @param index The index.
+ * @param store The store indexed.
+ * @param args The query, with a single needle.
+ * @param lev The distance context of the needle.
+ * @param out The stream the matches are printed to.
+ * @param names The numbers of the names found.
+ * @param dists Their distances to the needle.
+ * @param count The number of names.
+ * @return 0 on success, -ENOMEM on failure.
+ */
+int qgram_print(struct qgram_index const * index, struct store const * store,
+		struct args const * args, struct lev_ctx * lev, FILE * out,
+		uint32_t const * names, int const * dists, size_t count);
+
+#endif /* __QGRAM_H__ */
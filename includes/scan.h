@@ -0,0 +1,114 @@
+/* moses Find symbol in shared libraries.
+ * Copyright (C) 2022  Mathias Schmitt
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef __SCAN_H__
+#define __SCAN_H__
+
+#include <stdio.h>
+
+#include "elfsym.h"
+#include "levenshtein.h"
+
+struct args;
+struct stats;
+struct uring;
+
+/* Memory a scanning thread reuses from one file to the next, so that the
+ * search of a library does not allocate once the buffers are large enough.
+ */
+struct scan_ctx
+{
+	/* One distance context per needle. */
+	struct lev_ctx * levs;
+	size_t lev_nb;
+
+	/* Symbols of the library being searched. */
+	char const ** names;
+	struct elf_symbol * syms;
+	size_t * indexes;
+	size_t capacity;
+
+	/* Line buffer of the nm output. */
+	char * line;
+	size_t line_size;
+
+	/* Matches of the file being searched, in parallel scans. */
+	FILE * out;
+	char * out_buffer;
+	size_t out_size;
+
+	/* Statistics of the thread with --stats, NULL otherwise. */
+	struct stats * stats;
+
+	/* Ring loading the files with --io-uring, NULL otherwise or when
+	 * io_uring is not available. */
+	struct uring * ring;
+};
+
+/* @brief Prepare the scratch memory of a scanning thread.
+ *
+ * @param ctx The context to initialize.
+ * @param args The arguments of the program.
+ * @param buffered Gather the matches of a file in memory before printing
+ * them, for parallel scans.
+ * @return 0 on success, -ENOMEM on failure.
+ */
+int scan_ctx_init(struct scan_ctx * ctx, struct args const * args,
+		int buffered);
+
+/* @brief Free the scratch memory of a scanning thread.
+ *
+ * @param ctx The context.
+ */
+void scan_ctx_free(struct scan_ctx * ctx);
+
+/* @brief Search the needles in a regular file, printing matches to out.
+ *
+ * @param args The arguments of the program.
+ * @param ctx The scratch memory of the thread.
+ * @param file The path of the file to search.
+ * @param out The stream the matches are printed to.
+ * @return 0 on success, less than 0 otherwise.
+ */
+int search_file(struct args * args, struct scan_ctx * ctx, char const * file,
+		FILE * out);
+
+/* @brief Worker side of a parallel scan, to be given to pool_create.
+ *
+ * The matches of a file are gathered in memory and written to stdout with a
+ * single call, so that the output of concurrent workers never interleaves.
+ *
+ * @param data The arguments of the program.
+ * @param worker The index of the worker, which selects its scan context.
+ * @param file The path of the file to search.
+ */
+void search_task(void * data, unsigned worker, char * file);
+
+/* @brief Search a batch of ELF files loaded together with io_uring.
+ *
+ * The files are loaded URING_BATCH at a time, then searched one after the
+ * other as search_task would. The matches go to stdout directly when the
+ * context does not gather them.
+ *
+ * @param data The arguments of the program.
+ * @param worker The index of the worker, which selects its scan context.
+ * @param batch The paths of the files, each followed by a NUL character,
+ * ended by an empty path.
+ */
+void search_batch_task(void * data, unsigned worker, char * batch);
+
+#endif /* __SCAN_H__ */
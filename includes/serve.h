@@ -0,0 +1,72 @@
+/* moses Find symbol in shared libraries.
+ * Copyright (C) 2022  Mathias Schmitt
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef __SERVE_H__
+#define __SERVE_H__
+
+#include <stdint.h>
+
+/* Longest needle a server accepts. */
+#define SERVE_MAX_NEEDLE 4096
+
+/* Print the needle in front of each match. */
+#define SERVE_PRINT_NEEDLE 0x1
+
+struct args;
+
+/* A query, followed on the socket by the size bytes of the needle.
+ *
+ * Both ends run on the same machine, the integers are in host byte order.
+ */
+struct serve_request
+{
+	uint32_t size;
+	uint32_t flags;
+	uint32_t top;
+	uint32_t verbose;
+	double min_distance;
+};
+
+/* The answer to a query, followed by the size bytes of the matches, printed
+ * as moses would print them.
+ */
+struct serve_response
+{
+	int32_t status;
+	uint32_t size;
+};
+
+/* @brief Answer the queries of the clients until SIGINT or SIGTERM.
+ *
+ * The symbols must already be loaded in args->store. Each client is served
+ * by its own thread, and may send several queries on its connection.
+ *
+ * @param args The arguments of the program.
+ * @param path The path of the Unix socket to listen on.
+ * @return 0 on success, less than 0 otherwise.
+ */
+int serve_run(struct args * args, char const * path);
+
+/* @brief Send the needles to a server and print its answers.
+ *
+ * @param args The arguments of the program.
+ * @param path The path of the Unix socket of the server.
+ * @return 0 on success, less than 0 otherwise.
+ */
+int serve_connect(struct args * args, char const * path);
+
+#endif /* __SERVE_H__ */
@@ -0,0 +1,128 @@
+/* moses Find symbol in shared libraries.
+ * Copyright (C) 2022  Mathias Schmitt
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef __STATS_H__
+#define __STATS_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* Number of slowest libraries reported. */
+#define STATS_SLOWEST 10
+
+/* Where the time of a scan goes. The phases of the workers add up, so with
+ * several jobs their sum exceeds the wall time. */
+enum stats_phase
+{
+	/* stat and readdir while walking the haystacks. */
+	STATS_WALK,
+	/* Mapping ELF files and locating their symbol table. */
+	STATS_OPEN,
+	/* Checking the magic numbers before running nm. */
+	STATS_MAGIC,
+	/* Starting nm and waiting for it to exit. */
+	STATS_NM,
+	/* Reading and parsing the output of nm. */
+	STATS_READ,
+	/* Looking files up in the index and recording them. */
+	STATS_INDEX,
+	/* Scoring the symbols against the needles. */
+	STATS_MATCH,
+	STATS_PHASE_NB
+};
+
+struct stats_lib
+{
+	char * file;
+	uint64_t ns;
+};
+
+/* Counters of a scan. Each worker fills its own, they are merged at the
+ * end, so that counting does not need any lock. */
+struct stats
+{
+	uint64_t phase_ns[STATS_PHASE_NB];
+
+	size_t files;
+	size_t skipped;
+	size_t elf;
+	size_t not_elf;
+	size_t index_hits;
+	size_t symbols;
+	size_t matches;
+
+	/* Bytes of the ELF headers and tables read, or of the output of nm with
+	 * --nm. */
+	size_t bytes;
+
+	/* The slowest libraries, slowest first. */
+	struct stats_lib slowest[STATS_SLOWEST];
+	size_t slowest_nb;
+};
+
+/* @brief Read the monotonic clock, when statistics are gathered.
+ *
+ * @param stats The statistics, NULL if they are not gathered.
+ * @return The time in nanoseconds, 0 if stats is NULL.
+ */
+uint64_t stats_now(struct stats const * stats);
+
+/* @brief Add the time since start to a phase.
+ *
+ * @param stats The statistics, NULL if they are not gathered.
+ * @param phase The phase.
+ * @param start The start of the phase, as given by stats_now.
+ * @return The current time, to start the next phase.
+ */
+uint64_t stats_phase(struct stats * stats, enum stats_phase phase,
+		uint64_t start);
+
+/* @brief Record the time spent on a library.
+ *
+ * Only the STATS_SLOWEST slowest libraries are kept.
+ *
+ * @param stats The statistics, NULL if they are not gathered.
+ * @param file The path of the library.
+ * @param start The time the search of the library started.
+ */
+void stats_library(struct stats * stats, char const * file, uint64_t start);
+
+/* @brief Add the statistics of a worker to the total.
+ *
+ * @param total The total.
+ * @param stats The statistics of the worker, left empty.
+ */
+void stats_merge(struct stats * total, struct stats * stats);
+
+/* @brief Print the statistics.
+ *
+ * @param stats The statistics.
+ * @param out The stream to print to.
+ * @param json Print a single JSON object instead of a table.
+ * @param wall_ns The wall time of the scan.
+ */
+void stats_print(struct stats const * stats, FILE * out, int json,
+		uint64_t wall_ns);
+
+/* @brief Free the memory held by statistics.
+ *
+ * @param stats The statistics.
+ */
+void stats_free(struct stats * stats);
+
+#endif /* __STATS_H__ */
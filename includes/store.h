@@ -0,0 +1,77 @@
+/* moses Find symbol in shared libraries.
+ * Copyright (C) 2022  Mathias Schmitt
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef __STORE_H__
+#define __STORE_H__
+
+#include <pthread.h>
+#include <stddef.h>
+
+/* The symbols of a library, held in memory. */
+struct store_lib
+{
+	char * file;
+	char const ** names;
+	size_t count;
+
+	/* The names, one after the other. */
+	char * strings;
+};
+
+/* The symbols of every library of the haystacks, loaded once and then
+ * queried by the server without touching the files again.
+ */
+struct store
+{
+	struct store_lib * libs;
+	size_t lib_nb;
+	size_t capacity;
+	size_t symbol_nb;
+	pthread_mutex_t lock;
+};
+
+/* @brief Create an empty store.
+ *
+ * @return The store, or NULL if it could not be allocated.
+ */
+struct store * store_create(void);
+
+/* @brief Free a store and the symbols it holds.
+ *
+ * @param store The store.
+ */
+void store_destroy(struct store * store);
+
+/* @brief Load the dynamic symbols of a file in the store.
+ *
+ * Can be called from several threads at once. Files that are not ELF
+ * objects are ignored.
+ *
+ * @param store The store.
+ * @param file The path of the file.
+ * @return 0 on success, -ENOMEM on failure.
+ */
+int store_file(struct store * store, char const * file);
+
+/* @brief Sort the libraries by path, so that the answers do not depend on
+ * the order the files were loaded in.
+ *
+ * @param store The store.
+ */
+void store_sort(struct store * store);
+
+#endif /* __STORE_H__ */
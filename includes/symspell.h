@@ -0,0 +1,115 @@
+/* moses Find symbol in shared libraries.
+ * Copyright (C) 2022  Mathias Schmitt
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef __SYMSPELL_H__
+#define __SYMSPELL_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Largest edit count the index can be built for. */
+#define SYMSPELL_MAX_EDITS 3
+
+/* Longest name indexed. The number of deletions grows with the square of the
+ * length for 2 edits, long mangled names would dominate the memory. */
+#define SYMSPELL_MAX_LEN 32
+
+struct lev_ctx;
+
+/* A symmetric deletion index over distinct names.
+ *
+ * Two strings are within k edits only if deleting at most k characters from
+ * each gives the same string. Every deletion variant of every name is hashed
+ * once, then a query hashes its own variants and only verifies the names
+ * found under them.
+ *
+ * The variants are grouped in buckets by the high bits of their hash: the
+ * entries of bucket b are bucket_start[b] to bucket_start[b + 1], sorted by
+ * hash.
+ */
+struct symspell
+{
+	int max_edits;
+	unsigned bits;
+	uint32_t * bucket_start;
+	uint32_t * keys;
+	uint32_t * names;
+	size_t entry_nb;
+};
+
+/* The names found by a query. */
+struct symspell_result
+{
+	uint32_t * names;
+	int * dists;
+	size_t count;
+	size_t capacity;
+
+	/* Number of names whose distance was computed. */
+	size_t verified;
+};
+
+/* @brief Index the deletions of the names up to max_edits characters.
+ *
+ * The names longer than SYMSPELL_MAX_LEN are left out.
+ *
+ * @param index The index to fill.
+ * @param names The names, distinct.
+ * @param lens The lengths of the names.
+ * @param count The number of names.
+ * @param max_edits The largest edit count of a query, up to
+ * SYMSPELL_MAX_EDITS.
+ * @return 0 on success, -ENOMEM on failure, -EOVERFLOW if there are too
+ * many deletions.
+ */
+int symspell_build(struct symspell * index, char const * const * names,
+		uint32_t const * lens, size_t count, int max_edits);
+
+/* @brief Free an index.
+ *
+ * @param index The index.
+ */
+void symspell_free(struct symspell * index);
+
+/* @brief Give the memory used by an index.
+ *
+ * @param index The index.
+ * @return The size of the index in bytes.
+ */
+size_t symspell_size(struct symspell const * index);
+
+/* @brief Find the indexed names within k edits of a needle.
+ *
+ * @param index The index.
+ * @param names The names the index was built over.
+ * @param lens The lengths of the names.
+ * @param lev The distance context of the needle.
+ * @param k The largest distance of a match, up to index->max_edits.
+ * @param result The result, zeroed before its first use.
+ * @return 0 on success, -ENOMEM on failure.
+ */
+int symspell_query(struct symspell const * index, char const * const * names,
+		uint32_t const * lens, struct lev_ctx * lev, int k,
+		struct symspell_result * result);
+
+/* @brief Free the memory of a result.
+ *
+ * @param result The result.
+ */
+void symspell_result_free(struct symspell_result * result);
+
+#endif /* __SYMSPELL_H__ */
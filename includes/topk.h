@@ -0,0 +1,77 @@
+/* moses Find symbol in shared libraries.
+ * Copyright (C) 2022  Mathias Schmitt
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef __TOPK_H__
+#define __TOPK_H__
+
+#include <stddef.h>
+#include <stdio.h>
+
+/* The K best matches seen so far, across all the haystacks.
+ *
+ * Matches are ranked by similarity, then by symbol name and file name so that
+ * the result does not depend on the order the files are scanned in. Once K
+ * matches are known, the similarity of the worst one is the threshold any
+ * new candidate has to reach.
+ */
+struct topk;
+
+/* @brief Create an empty set of best matches.
+ *
+ * @param k The number of matches to keep.
+ * @return The set, or NULL if it could not be allocated.
+ */
+struct topk * topk_create(size_t k);
+
+/* @brief Free a set of best matches.
+ *
+ * @param topk The set.
+ */
+void topk_destroy(struct topk * topk);
+
+/* @brief Give the similarity a candidate needs to enter the set.
+ *
+ * It only grows as better matches are found. A candidate exactly at the
+ * threshold may still enter the set, depending on its names.
+ *
+ * @param topk The set.
+ * @return The threshold, 0 while the set is not full.
+ */
+double topk_threshold(struct topk * topk);
+
+/* @brief Propose a match.
+ *
+ * @param topk The set.
+ * @param percent The similarity of the symbol to the needle.
+ * @param file The file the symbol was found in.
+ * @param symbol The name of the symbol.
+ * @return 0 on success, -ENOMEM on failure.
+ */
+int topk_offer(struct topk * topk, double percent, char const * file,
+		char const * symbol);
+
+/* @brief Print the matches, best first.
+ *
+ * @param topk The set.
+ * @param out The stream to print to.
+ * @param needle The needle to print in front of each match, or NULL.
+ * @param verbose Use the verbose output format.
+ */
+void topk_print(struct topk * topk, FILE * out, char const * needle,
+		int verbose);
+
+#endif /* __TOPK_H__ */
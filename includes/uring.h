@@ -0,0 +1,61 @@
+/* moses Find symbol in shared libraries.
+ * Copyright (C) 2022  Mathias Schmitt
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef __URING_H__
+#define __URING_H__
+
+#include <stddef.h>
+
+#include "elfsym.h"
+
+/* Largest number of files loaded together. */
+#define URING_BATCH 32
+
+/* An io_uring instance, set up with raw system calls. */
+struct uring;
+
+/* @brief Set up a ring for loading URING_BATCH files at once.
+ *
+ * @return The ring, or NULL if io_uring is not available, errno telling
+ * why.
+ */
+struct uring * uring_create(void);
+
+/* @brief Tear a ring down.
+ *
+ * @param ring The ring.
+ */
+void uring_destroy(struct uring * ring);
+
+/* @brief Read the dynamic symbol tables of several files.
+ *
+ * The files are opened, their ELF and section headers read and their
+ * symbol tables and strings read in memory, all files in flight at once.
+ * The same descriptor serves every read of a file and is closed before
+ * returning. Without a ring, each file is mapped with elf_open in turn.
+ *
+ * @param ring The ring, NULL to load the files synchronously.
+ * @param paths The paths of the files.
+ * @param count The number of files, at most URING_BATCH.
+ * @param elfs Filled with the files loaded, to be closed with elf_close.
+ * @param results Filled with 0 for every file loaded, -ENOEXEC for the
+ * files which are not ELF objects, or another negative errno value.
+ */
+void uring_load(struct uring * ring, char const * const * paths,
+		size_t count, struct elf_file * elfs, int * results);
+
+#endif /* __URING_H__ */
@@ -0,0 +1,69 @@
+/* moses Find symbol in shared libraries.
+ * Copyright (C) 2022  Mathias Schmitt
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef __WALK_H__
+#define __WALK_H__
+
+struct args;
+
+/* A walk of the haystacks, yielding every regular file to search.
+ *
+ * Directories are read with getdents64 relative to their descriptor, and
+ * their entries are only stat'ed when the type given by the kernel is not
+ * enough: symbolic links and file systems that do not report it. The
+ * directories being read are kept on an explicit stack.
+ *
+ * Every file and directory is identified by its device and inode, so that a
+ * library reached through several paths, such as /lib and /usr/lib on a
+ * merged /usr or a chain of symbolic links, is only searched once. This
+ * holds across all the haystacks given to the same walk.
+ */
+struct walk;
+
+/* @brief Create a walk.
+ *
+ * @param args The arguments of the program, for --watch and --stats.
+ * @return The walk, or NULL on failure.
+ */
+struct walk * walk_create(struct args * args);
+
+/* @brief Free a walk and close its directories.
+ *
+ * @param walk The walk.
+ */
+void walk_destroy(struct walk * walk);
+
+/* @brief Start walking a haystack, a regular file or a directory.
+ *
+ * @param walk The walk, whose previous haystack is fully walked.
+ * @param path The path of the haystack.
+ * @return 0 on success, less than 0 if the haystack cannot be walked.
+ */
+int walk_start(struct walk * walk, char const * path);
+
+/* @brief Give the next regular file of the haystack.
+ *
+ * Hidden files and directories are skipped, as well as files already given.
+ *
+ * @param walk The walk.
+ * @param file Set to the path of the file, valid until the next call.
+ * @return 1 if a file was found, 0 once the haystack is fully walked,
+ * -ENOMEM on failure.
+ */
+int walk_next(struct walk * walk, char const ** file);
+
+#endif /* __WALK_H__ */
@@ -0,0 +1,83 @@
+/* moses Find symbol in shared libraries.
+ * Copyright (C) 2022  Mathias Schmitt
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef __WATCH_H__
+#define __WATCH_H__
+
+#include <stddef.h>
+
+struct args;
+
+/* The matches of every library of the haystacks, kept up to date with
+ * inotify.
+ *
+ * After the first scan, only the libraries created, replaced or deleted in
+ * the watched directories are searched again, and the matches they gained
+ * or lost are printed as "+" and "-" lines.
+ */
+struct watch;
+
+/* @brief Create an inotify instance without any watched directory.
+ *
+ * @return The watch, or NULL on failure.
+ */
+struct watch * watch_create(void);
+
+/* @brief Stop watching and free the recorded matches.
+ *
+ * @param watch The watch.
+ */
+void watch_destroy(struct watch * watch);
+
+/* @brief Watch the libraries of a directory, but not its subdirectories.
+ *
+ * @param watch The watch.
+ * @param path The path of the directory.
+ * @return 0 on success, less than 0 otherwise.
+ */
+int watch_directory(struct watch * watch, char const * path);
+
+/* @brief Watch a single library.
+ *
+ * @param watch The watch.
+ * @param path The path of the library.
+ * @return 0 on success, less than 0 otherwise.
+ */
+int watch_file(struct watch * watch, char const * path);
+
+/* @brief Record the matches printed for a library during the first scan.
+ *
+ * Can be called from several threads at once.
+ *
+ * @param watch The watch.
+ * @param file The path of the library.
+ * @param matches The matches, one per line.
+ * @param size The size of matches.
+ * @return 0 on success, -ENOMEM on failure.
+ */
+int watch_record(struct watch * watch, char const * file,
+		char const * matches, size_t size);
+
+/* @brief Search the libraries again as they change, until interrupted.
+ *
+ * @param args The arguments of the program, args->watch holds the first
+ * scan.
+ * @return Less than 0 on failure.
+ */
+int watch_run(struct args * args);
+
+#endif /* __WATCH_H__ */
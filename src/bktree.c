@@ -0,0 +1,275 @@
+/* moses Find symbol in shared libraries.
+ * Copyright (C) 2022  Mathias Schmitt
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bktree.h"
+#include "levenshtein.h"
+
+#define BKTREE_NONE UINT32_MAX
+
+/* The tree while names are inserted, siblings are chained. */
+struct builder
+{
+	uint32_t * first_child;
+	uint32_t * next_sibling;
+	uint32_t * dist;
+};
+
+/* @brief Insert the name of node x below the root. */
+static void builder_insert(struct builder * builder,
+		char const * const * names, uint32_t x)
+{
+	uint32_t node = 0;
+
+	while (1)
+	{
+		int d = lev_string_dist(names[x], names[node]);
+		uint32_t * link;
+
+		/* Distinct names are never at distance 0. */
+		if (d <= 0)
+			return;
+
+		link = &builder->first_child[node];
+		while (*link != BKTREE_NONE && builder->dist[*link] != (uint32_t)d)
+			link = &builder->next_sibling[*link];
+
+		if (*link == BKTREE_NONE)
+		{
+			builder->dist[x] = (uint32_t)d;
+			*link = x;
+			return;
+		}
+
+		node = *link;
+	}
+}
+
+/* @brief Lay the tree out in breadth-first order, children sorted by
+ * distance.
+ */
+static int builder_flatten(struct builder * builder, struct bktree * tree,
+		size_t count)
+{
+	uint32_t * order = malloc(count * sizeof(*order));
+	size_t head = 0;
+	size_t tail = 1;
+
+	if (!order)
+		return -ENOMEM;
+
+	order[0] = 0;
+	tree->parent_dist[0] = 0;
+
+	while (head < tail)
+	{
+		uint32_t node = order[head];
+		size_t first = tail;
+
+		tree->node_name[head] = node;
+		tree->child_start[head] = (uint32_t)first;
+		head++;
+
+		for (uint32_t c = builder->first_child[node]; c != BKTREE_NONE;
+				c = builder->next_sibling[c])
+		{
+			size_t i = tail++;
+
+			/* Insertion sort, a node has few children. */
+			while (i > first && builder->dist[order[i - 1]] >
+					builder->dist[c])
+			{
+				order[i] = order[i - 1];
+				i--;
+			}
+			order[i] = c;
+		}
+
+		for (size_t i = first; i < tail; ++i)
+			tree->parent_dist[i] = builder->dist[order[i]];
+	}
+	tree->child_start[head] = (uint32_t)tail;
+	tree->node_nb = head;
+
+	free(order);
+
+	return 0;
+}
+
+int bktree_build(struct bktree * tree, char const * const * names,
+		size_t count)
+{
+	struct builder builder;
+	uint32_t state = 1;
+	uint32_t * order;
+	int ret = -ENOMEM;
+
+	memset(tree, 0, sizeof(*tree));
+	if (!count)
+		return 0;
+	if (count >= BKTREE_NONE)
+		return -EOVERFLOW;
+
+	builder.first_child = malloc(count * sizeof(*builder.first_child));
+	builder.next_sibling = malloc(count * sizeof(*builder.next_sibling));
+	builder.dist = malloc(count * sizeof(*builder.dist));
+	order = malloc(count * sizeof(*order));
+	tree->node_name = malloc(count * sizeof(*tree->node_name));
+	tree->parent_dist = malloc(count * sizeof(*tree->parent_dist));
+	tree->child_start = malloc((count + 1) * sizeof(*tree->child_start));
+	if (!builder.first_child || !builder.next_sibling || !builder.dist ||
+			!order || !tree->node_name || !tree->parent_dist ||
+			!tree->child_start)
+		goto END;
+
+	memset(builder.first_child, 0xff, count * sizeof(*builder.first_child));
+	memset(builder.next_sibling, 0xff,
+			count * sizeof(*builder.next_sibling));
+
+	/* Names often come sorted, which would make the tree degenerate.
+	 * Insert them in a fixed pseudo-random order instead. */
+	for (uint32_t i = 0; i < count; ++i)
+		order[i] = i;
+	for (size_t i = count - 1; i > 1; --i)
+	{
+		uint32_t j;
+		uint32_t tmp;
+
+		state = state * 1664525u + 1013904223u;
+		j = 1 + (uint32_t)(((uint64_t)state * i) >> 32);
+		tmp = order[i];
+		order[i] = order[j];
+		order[j] = tmp;
+	}
+
+	for (size_t i = 1; i < count; ++i)
+		builder_insert(&builder, names, order[i]);
+
+	ret = builder_flatten(&builder, tree, count);
+
+END:
+	free(builder.first_child);
+	free(builder.next_sibling);
+	free(builder.dist);
+	free(order);
+	if (ret < 0)
+		bktree_free(tree);
+
+	return ret;
+}
+
+void bktree_free(struct bktree * tree)
+{
+	free(tree->node_name);
+	free(tree->parent_dist);
+	free(tree->child_start);
+	memset(tree, 0, sizeof(*tree));
+}
+
+static int result_add(struct bktree_result * result, uint32_t name, int dist)
+{
+	if (result->count == result->capacity)
+	{
+		size_t capacity = result->capacity ? result->capacity * 2 : 64;
+		uint32_t * names = realloc(result->names,
+				capacity * sizeof(*names));
+		int * dists;
+
+		if (!names)
+			return -ENOMEM;
+		result->names = names;
+
+		dists = realloc(result->dists, capacity * sizeof(*dists));
+		if (!dists)
+			return -ENOMEM;
+		result->dists = dists;
+		result->capacity = capacity;
+	}
+
+	result->names[result->count] = name;
+	result->dists[result->count++] = dist;
+
+	return 0;
+}
+
+int bktree_query(struct bktree const * tree, char const * const * names,
+		uint32_t const * lens, struct lev_ctx * lev, int k,
+		struct bktree_result * result)
+{
+	uint32_t * stack;
+	size_t depth = 0;
+	int ret = 0;
+
+	result->count = 0;
+	result->visited = 0;
+	if (!tree->node_nb || k < 0)
+		return 0;
+
+	/* A node is pushed at most once. */
+	stack = malloc(tree->node_nb * sizeof(*stack));
+	if (!stack)
+		return -ENOMEM;
+	stack[depth++] = 0;
+
+	while (depth && ret >= 0)
+	{
+		uint32_t node = stack[--depth];
+		uint32_t name = tree->node_name[node];
+		uint32_t lo = tree->child_start[node];
+		uint32_t hi = tree->child_start[node + 1];
+		int d = lev_ctx_dist(lev, names[name], lens[name]);
+
+		if (d < 0)
+		{
+			ret = d;
+			break;
+		}
+		result->visited++;
+
+		if (d <= k)
+			ret = result_add(result, name, d);
+
+		/* Skip the children closer than d - k. */
+		while (lo < hi)
+		{
+			uint32_t mid = lo + (hi - lo) / 2;
+
+			if ((long)tree->parent_dist[mid] < (long)d - k)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+
+		for (uint32_t c = lo; c < tree->child_start[node + 1] &&
+				tree->parent_dist[c] <= (uint32_t)(d + k); ++c)
+			stack[depth++] = c;
+	}
+
+	free(stack);
+
+	return ret;
+}
+
+void bktree_result_free(struct bktree_result * result)
+{
+	free(result->names);
+	free(result->dists);
+	memset(result, 0, sizeof(*result));
+}
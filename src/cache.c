@@ -0,0 +1,265 @@
+/* moses Find symbol in shared libraries.
+ * Copyright (C) 2022  Mathias Schmitt
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cache.h"
+
+#define CACHE_SHARDS 64
+#define CACHE_INITIAL_SLOTS 1024
+#define CACHE_CHUNK_SIZE (64 * 1024)
+
+struct cache_slot
+{
+	uint64_t hash;
+	char const * name;
+	uint32_t len;
+	uint32_t needle;
+	int dist;
+};
+
+/* Interned names are packed in large chunks instead of being allocated one
+ * by one. */
+struct cache_chunk
+{
+	struct cache_chunk * next;
+	size_t used;
+	size_t size;
+	char data[];
+};
+
+struct cache_shard
+{
+	pthread_mutex_t lock;
+	struct cache_slot * slots;
+	size_t slot_nb;
+	size_t used;
+	struct cache_chunk * chunks;
+};
+
+struct cache
+{
+	struct cache_shard shards[CACHE_SHARDS];
+};
+
+struct cache * cache_create(void)
+{
+	struct cache * cache = calloc(1, sizeof(*cache));
+
+	if (!cache)
+		return NULL;
+
+	for (size_t i = 0; i < CACHE_SHARDS; ++i)
+		pthread_mutex_init(&cache->shards[i].lock, NULL);
+
+	return cache;
+}
+
+void cache_destroy(struct cache * cache)
+{
+	for (size_t i = 0; i < CACHE_SHARDS; ++i)
+	{
+		struct cache_shard * shard = &cache->shards[i];
+
+		while (shard->chunks)
+		{
+			struct cache_chunk * next = shard->chunks->next;
+
+			free(shard->chunks);
+			shard->chunks = next;
+		}
+
+		pthread_mutex_destroy(&shard->lock);
+		free(shard->slots);
+	}
+
+	free(cache);
+}
+
+uint64_t cache_hash(char const * name, size_t len)
+{
+	uint64_t hash = 14695981039346656037u;
+
+	for (size_t i = 0; i < len; ++i)
+	{
+		hash ^= (unsigned char)name[i];
+		hash *= 1099511628211u;
+	}
+
+	return hash;
+}
+
+/* @brief Mix the needle in the hash of a name, so that the distances of a
+ * name to the different needles spread over the table. */
+static uint64_t cache_key(uint64_t hash, unsigned needle)
+{
+	return hash ^ (needle * 0x9e3779b97f4a7c15u);
+}
+
+/* The low bits of the key pick the shard, the high ones the slot. */
+static struct cache_shard * cache_shard(struct cache * cache, uint64_t key)
+{
+	return &cache->shards[key % CACHE_SHARDS];
+}
+
+static struct cache_slot * shard_find(struct cache_shard * shard,
+		char const * name, size_t len, uint64_t key, unsigned needle)
+{
+	size_t mask = shard->slot_nb - 1;
+	size_t i = (size_t)(key >> 32) & mask;
+
+	while (shard->slots[i].name)
+	{
+		struct cache_slot * slot = &shard->slots[i];
+
+		if (slot->hash == key && slot->needle == needle &&
+				slot->len == len && !memcmp(slot->name, name, len))
+			return slot;
+		i = (i + 1) & mask;
+	}
+
+	return &shard->slots[i];
+}
+
+static int shard_grow(struct cache_shard * shard)
+{
+	size_t slot_nb = shard->slot_nb ? shard->slot_nb * 2 :
+		CACHE_INITIAL_SLOTS;
+	struct cache_slot * old = shard->slots;
+	size_t old_nb = shard->slot_nb;
+
+	shard->slots = calloc(slot_nb, sizeof(*shard->slots));
+	if (!shard->slots)
+	{
+		shard->slots = old;
+		return -ENOMEM;
+	}
+	shard->slot_nb = slot_nb;
+
+	for (size_t i = 0; i < old_nb; ++i)
+	{
+		if (old[i].name)
+			*shard_find(shard, old[i].name, old[i].len,
+					old[i].hash, old[i].needle) = old[i];
+	}
+
+	free(old);
+
+	return 0;
+}
+
+static char const * shard_intern(struct cache_shard * shard,
+		char const * name, size_t len)
+{
+	struct cache_chunk * chunk = shard->chunks;
+	char * copy;
+
+	if (!chunk || chunk->size - chunk->used < len + 1)
+	{
+		size_t size = len + 1 > CACHE_CHUNK_SIZE ? len + 1 :
+			CACHE_CHUNK_SIZE;
+
+		chunk = malloc(sizeof(*chunk) + size);
+		if (!chunk)
+			return NULL;
+
+		chunk->next = shard->chunks;
+		chunk->used = 0;
+		chunk->size = size;
+		shard->chunks = chunk;
+	}
+
+	copy = chunk->data + chunk->used;
+	memcpy(copy, name, len);
+	copy[len] = '\0';
+	chunk->used += len + 1;
+
+	return copy;
+}
+
+int cache_lookup(struct cache * cache, unsigned needle, char const * name,
+		size_t len, uint64_t hash, int * dist)
+{
+	uint64_t key = cache_key(hash, needle);
+	struct cache_shard * shard = cache_shard(cache, key);
+	int found = 0;
+
+	pthread_mutex_lock(&shard->lock);
+
+	if (shard->slot_nb)
+	{
+		struct cache_slot * slot = shard_find(shard, name, len, key,
+				needle);
+
+		if (slot->name)
+		{
+			*dist = slot->dist;
+			found = 1;
+		}
+	}
+
+	pthread_mutex_unlock(&shard->lock);
+
+	return found;
+}
+
+int cache_insert(struct cache * cache, unsigned needle, char const * name,
+		size_t len, uint64_t hash, int dist)
+{
+	uint64_t key = cache_key(hash, needle);
+	struct cache_shard * shard = cache_shard(cache, key);
+	struct cache_slot * slot;
+	int ret = 0;
+
+	if (len > UINT32_MAX)
+		return 0;
+
+	pthread_mutex_lock(&shard->lock);
+
+	if ((shard->used + 1) * 2 > shard->slot_nb)
+	{
+		ret = shard_grow(shard);
+		if (ret < 0)
+			goto END;
+	}
+
+	/* Another thread may have scored the same name meanwhile. */
+	slot = shard_find(shard, name, len, key, needle);
+	if (slot->name)
+		goto END;
+
+	slot->name = shard_intern(shard, name, len);
+	if (!slot->name)
+	{
+		ret = -ENOMEM;
+		goto END;
+	}
+
+	slot->hash = key;
+	slot->needle = needle;
+	slot->len = (uint32_t)len;
+	slot->dist = dist;
+	shard->used++;
+
+END:
+	pthread_mutex_unlock(&shard->lock);
+
+	return ret;
+}
@@ -8,7 +8,7 @@
 #include <unistd.h>
 #include <sys/types.h>
 
-void run_child(char * haystack, int pfds[PFD_NUMBER], int verbose)
+void run_child(char const * haystack, int pfds[PFD_NUMBER], int verbose)
 {
 	int ret = 0;
 
@@ -30,7 +30,7 @@ void run_child(char * haystack, int pfds[PFD_NUMBER], int verbose)
 	char * const arguments[] = {
 		"nm",
 		"--dynamic",
-		haystack,
+		(char *)haystack,
 		0
 	};
 	ret = execve("/usr/bin/nm", arguments, 0);
@@ -0,0 +1,461 @@
+/* moses Find symbol in shared libraries.
+ * Copyright (C) 2022  Mathias Schmitt
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <ctype.h>
+#include <elf.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/auxv.h>
+#include <sys/stat.h>
+
+#include "deps.h"
+#include "elfsym.h"
+#include "ldcache.h"
+
+/* What a closure is resolved with, beside the objects found so far. */
+struct resolver
+{
+	struct deps * deps;
+
+	/* The class and machine of the binary, every library must match. */
+	struct elf_layout root;
+
+	/* Zeroed when there is no usable cache. */
+	struct ldcache cache;
+
+	/* LD_LIBRARY_PATH with its tokens replaced, NULL when unset. */
+	char * library_path;
+};
+
+/* @brief Decode the ELF header of a file.
+ *
+ * @return 0 on success, -ENOEXEC if it is not an ELF file, or another
+ * negative errno value if it cannot be read.
+ */
+static int read_header(char const * path, struct elf_layout * layout)
+{
+	unsigned char header[sizeof(Elf64_Ehdr)];
+	ssize_t size;
+	int fd;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+
+	size = pread(fd, header, sizeof(header), 0);
+	close(fd);
+	if (size < 0)
+		return -errno;
+
+	return elf_read_header(layout, header, (size_t)size);
+}
+
+/* @brief Tell whether a file is an ELF object the binary could load. */
+static int compatible(struct resolver const * resolver, char const * path)
+{
+	struct elf_layout layout;
+
+	return !read_header(path, &layout) &&
+		layout.is_64 == resolver->root.is_64 &&
+		layout.swap == resolver->root.swap &&
+		layout.machine == resolver->root.machine;
+}
+
+/* @brief Give the length of a token of a search path, such as ORIGIN or
+ * {ORIGIN}, at the start of string, 0 if it is not there. */
+static size_t token(char const * string, char const * name)
+{
+	size_t len = strlen(name);
+
+	if (*string == '{')
+		return !strncmp(string + 1, name, len) &&
+			string[len + 1] == '}' ? len + 2 : 0;
+
+	return !strncmp(string, name, len) &&
+		!isalnum((unsigned char)string[len]) &&
+		string[len] != '_' ? len : 0;
+}
+
+/* @brief Replace the tokens of a search path, as the dynamic loader does.
+ *
+ * @param paths The search path, directories separated by colons.
+ * @param origin The directory of the object the path belongs to.
+ * @param is_64 Whether the binary is a 64-bit object, for $LIB.
+ * @return The search path, to free, or NULL on failure.
+ */
+static char * expand(char const * paths, char const * origin, int is_64)
+{
+	char const * platform = (char const *)getauxval(AT_PLATFORM);
+	char * expanded = NULL;
+	size_t size = 0;
+	FILE * stream;
+
+	stream = open_memstream(&expanded, &size);
+	if (!stream)
+		return NULL;
+
+	while (*paths)
+	{
+		size_t len;
+
+		if (*paths != '$')
+		{
+			fputc(*paths++, stream);
+			continue;
+		}
+
+		if ((len = token(paths + 1, "ORIGIN")))
+			fputs(origin, stream);
+		else if ((len = token(paths + 1, "LIB")))
+			fputs(is_64 ? "lib64" : "lib", stream);
+		else if ((len = token(paths + 1, "PLATFORM")))
+			fputs(platform ? platform : "", stream);
+		else
+			fputc('$', stream);
+
+		paths += len + 1;
+	}
+
+	if (fclose(stream))
+	{
+		free(expanded);
+		return NULL;
+	}
+
+	return expanded;
+}
+
+/* @brief Look for a library in the directories of a search path.
+ *
+ * An empty directory stands for the current one.
+ *
+ * @param path Set to the path of the library, to free, if it is found.
+ * @return 1 if it is found, 0 if it is not, -ENOMEM on failure.
+ */
+static int search_dirs(struct resolver const * resolver, char const * dirs,
+		char const * name, char ** path)
+{
+	while (dirs)
+	{
+		char const * end = strchr(dirs, ':');
+		int len = (int)(end ? (size_t)(end - dirs) : strlen(dirs));
+
+		if (asprintf(path, "%.*s/%s", len ? len : 1,
+					len ? dirs : ".", name) < 0)
+			return -ENOMEM;
+
+		if (compatible(resolver, *path))
+			return 1;
+
+		free(*path);
+		*path = NULL;
+		dirs = end ? end + 1 : NULL;
+	}
+
+	return 0;
+}
+
+/* @brief Look for a library in the cache of the dynamic loader. */
+static int search_cache(struct resolver const * resolver, char const * name,
+		char ** path)
+{
+	for (size_t i = 0; i < resolver->cache.count; ++i)
+	{
+		char const * key = ldcache_name(&resolver->cache, i);
+		char const * value = ldcache_path(&resolver->cache, i);
+
+		if (!key || !value || strcmp(key, name) ||
+				!compatible(resolver, value))
+			continue;
+
+		*path = strdup(value);
+		return *path ? 1 : -ENOMEM;
+	}
+
+	return 0;
+}
+
+/* @brief Find the library an object needs, in the order of ld.so.
+ *
+ * @param parent The index of the object needing the library.
+ * @param path Set to the path of the library, to free, if it is found.
+ * @return 1 if it is found, 0 if it is not, -ENOMEM on failure.
+ */
+static int search(struct resolver const * resolver, size_t parent,
+		char const * name, char ** path)
+{
+	struct dep const * objects = resolver->deps->objects;
+	int ret = 0;
+
+	if (strchr(name, '/'))
+	{
+		if (!compatible(resolver, name))
+			return 0;
+		*path = strdup(name);
+		return *path ? 1 : -ENOMEM;
+	}
+
+	/* DT_RPATH is inherited from the loaders, up to the binary. */
+	for (size_t i = parent; !objects[parent].runpath && !ret; i =
+			objects[i].parent)
+	{
+		if (objects[i].rpath)
+			ret = search_dirs(resolver, objects[i].rpath, name,
+					path);
+		if (!i)
+			break;
+	}
+
+	if (!ret && resolver->library_path)
+		ret = search_dirs(resolver, resolver->library_path, name, path);
+
+	if (!ret && objects[parent].runpath)
+		ret = search_dirs(resolver, objects[parent].runpath, name,
+				path);
+
+	if (!ret)
+		ret = search_cache(resolver, name, path);
+
+	if (!ret)
+		ret = search_dirs(resolver, resolver->root.is_64 ?
+				DEPS_DEFAULT_PATH_64 : DEPS_DEFAULT_PATH,
+				name, path);
+
+	return ret;
+}
+
+/* @brief Append an object to the closure, taking its name and path. */
+static int add_object(struct deps * deps, char * name, char * path,
+		size_t parent)
+{
+	struct dep * object;
+	struct stat statbuff;
+
+	if (deps->count == deps->capacity)
+	{
+		size_t capacity = deps->capacity ? deps->capacity * 2 : 16;
+		struct dep * objects = realloc(deps->objects,
+				capacity * sizeof(*objects));
+
+		if (!objects)
+		{
+			free(name);
+			free(path);
+			return -ENOMEM;
+		}
+		deps->objects = objects;
+		deps->capacity = capacity;
+	}
+
+	object = &deps->objects[deps->count++];
+	memset(object, 0, sizeof(*object));
+	object->name = name;
+	object->path = path;
+	object->parent = parent;
+
+	if (path && !stat(path, &statbuff))
+	{
+		object->dev = statbuff.st_dev;
+		object->ino = statbuff.st_ino;
+	}
+
+	return 0;
+}
+
+/* @brief Resolve a library needed by an object, unless the closure already
+ * holds it, under this name or as the same file. */
+static int need(struct resolver * resolver, size_t parent, char const * name)
+{
+	struct deps * deps = resolver->deps;
+	struct stat statbuff;
+	char * path = NULL;
+	char * copy;
+	int ret;
+
+	for (size_t i = 0; i < deps->count; ++i)
+	{
+		if (!strcmp(deps->objects[i].name, name) ||
+				(deps->objects[i].soname &&
+				 !strcmp(deps->objects[i].soname, name)))
+			return 0;
+	}
+
+	ret = search(resolver, parent, name, &path);
+	if (ret < 0)
+		return ret;
+
+	if (path && !stat(path, &statbuff))
+	{
+		for (size_t i = 0; i < deps->count; ++i)
+		{
+			if (deps->objects[i].path &&
+					deps->objects[i].dev == statbuff.st_dev &&
+					deps->objects[i].ino == statbuff.st_ino)
+			{
+				free(path);
+				return 0;
+			}
+		}
+	}
+
+	copy = strdup(name);
+	if (!copy)
+	{
+		free(path);
+		return -ENOMEM;
+	}
+
+	return add_object(deps, copy, path, parent);
+}
+
+/* @brief Read the dynamic section of an object of the closure, and resolve
+ * the libraries it needs. */
+static int load(struct resolver * resolver, size_t index)
+{
+	struct dep * object = &resolver->deps->objects[index];
+	char const * rpath = NULL;
+	char const * runpath = NULL;
+	struct elf_file elf;
+	struct elf_dyn dyn;
+	char * dir;
+	int ret;
+
+	ret = elf_open(&elf, object->path);
+	if (ret < 0)
+		return index ? 0 : ret;
+
+	for (size_t i = 0; i < elf.dynamic_count && !elf_dynamic(&elf, i, &dyn);
+			++i)
+	{
+		if (dyn.tag == DT_RPATH && dyn.string)
+			rpath = dyn.string;
+		else if (dyn.tag == DT_RUNPATH && dyn.string)
+			runpath = dyn.string;
+		else if (dyn.tag == DT_SONAME && dyn.string && !object->soname)
+			object->soname = strdup(dyn.string);
+	}
+
+	dir = strdup(object->path);
+	if (!dir)
+	{
+		elf_close(&elf);
+		return -ENOMEM;
+	}
+
+	/* DT_RPATH is ignored when DT_RUNPATH is there. */
+	if (runpath)
+		object->runpath = expand(runpath, dirname(dir),
+				resolver->root.is_64);
+	else if (rpath)
+		object->rpath = expand(rpath, dirname(dir),
+				resolver->root.is_64);
+	free(dir);
+
+	if ((runpath && !object->runpath) || (rpath && !runpath &&
+				!object->rpath))
+		ret = -ENOMEM;
+
+	/* need may move the objects, object is not used past this point. */
+	for (size_t i = 0; ret >= 0 && i < elf.dynamic_count &&
+			!elf_dynamic(&elf, i, &dyn); ++i)
+	{
+		if (dyn.tag == DT_NEEDED && dyn.string)
+			ret = need(resolver, index, dyn.string);
+	}
+
+	elf_close(&elf);
+
+	return ret;
+}
+
+int deps_resolve(struct deps * deps, char const * binary)
+{
+	struct resolver resolver = { .deps = deps };
+	char const * library_path = getenv("LD_LIBRARY_PATH");
+	char * name;
+	char * path;
+	int ret;
+
+	memset(deps, 0, sizeof(*deps));
+
+	/* $ORIGIN of the binary is where it really is, as for ld.so. */
+	path = realpath(binary, NULL);
+	if (!path)
+		return -errno;
+
+	ret = read_header(path, &resolver.root);
+	name = strdup(binary);
+	if (ret < 0 || !name)
+	{
+		free(name);
+		free(path);
+		return ret < 0 ? ret : -ENOMEM;
+	}
+
+	ret = add_object(deps, name, path, 0);
+
+	if (ret >= 0 && library_path && *library_path)
+	{
+		char * dir = strdup(path);
+
+		resolver.library_path = dir ? expand(library_path,
+				dirname(dir), resolver.root.is_64) : NULL;
+		free(dir);
+		if (!resolver.library_path)
+			ret = -ENOMEM;
+	}
+
+	/* Without a cache, it is left empty and the other directories are
+	 * still searched. */
+	ldcache_open(&resolver.cache, LDCACHE_PATH);
+
+	/* The closure grows as it is read, breadth first. */
+	for (size_t i = 0; ret >= 0 && i < deps->count; ++i)
+	{
+		if (deps->objects[i].path)
+			ret = load(&resolver, i);
+	}
+
+	ldcache_close(&resolver.cache);
+	free(resolver.library_path);
+
+	if (ret < 0)
+		deps_free(deps);
+
+	return ret;
+}
+
+void deps_free(struct deps * deps)
+{
+	for (size_t i = 0; i < deps->count; ++i)
+	{
+		free(deps->objects[i].name);
+		free(deps->objects[i].path);
+		free(deps->objects[i].rpath);
+		free(deps->objects[i].runpath);
+		free(deps->objects[i].soname);
+	}
+	free(deps->objects);
+
+	memset(deps, 0, sizeof(*deps));
+}
@@ -0,0 +1,813 @@
+/* moses Find symbol in shared libraries.
+ * Copyright (C) 2022  Mathias Schmitt
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <elf.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "elfsym.h"
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define HOST_ELFDATA ELFDATA2LSB
+#else
+#define HOST_ELFDATA ELFDATA2MSB
+#endif
+
+/* Section header fields moses cares about, in host byte order. */
+struct section
+{
+	uint32_t type;
+	uint32_t link;
+	uint64_t offset;
+	uint64_t size;
+	uint64_t entsize;
+};
+
+static uint16_t rd16(uint16_t v, int swap)
+{
+	return swap ? __builtin_bswap16(v) : v;
+}
+
+static uint32_t rd32(uint32_t v, int swap)
+{
+	return swap ? __builtin_bswap32(v) : v;
+}
+
+static uint64_t rd64(uint64_t v, int swap)
+{
+	return swap ? __builtin_bswap64(v) : v;
+}
+
+/* @brief Decode a section header of the table.
+ *
+ * @return 0 on success, -ENOEXEC if it lies outside the table.
+ */
+static int read_section(struct elf_layout const * layout,
+		unsigned char const * table, size_t table_size, size_t index,
+		struct section * sec)
+{
+	uint64_t offset = layout->shentsize * index;
+
+	if (layout->is_64)
+	{
+		Elf64_Shdr shdr;
+
+		if (layout->shentsize < sizeof(shdr) || offset > table_size ||
+				sizeof(shdr) > table_size - offset)
+			return -ENOEXEC;
+
+		memcpy(&shdr, table + offset, sizeof(shdr));
+		sec->type = rd32(shdr.sh_type, layout->swap);
+		sec->link = rd32(shdr.sh_link, layout->swap);
+		sec->offset = rd64(shdr.sh_offset, layout->swap);
+		sec->size = rd64(shdr.sh_size, layout->swap);
+		sec->entsize = rd64(shdr.sh_entsize, layout->swap);
+	}
+	else
+	{
+		Elf32_Shdr shdr;
+
+		if (layout->shentsize < sizeof(shdr) || offset > table_size ||
+				sizeof(shdr) > table_size - offset)
+			return -ENOEXEC;
+
+		memcpy(&shdr, table + offset, sizeof(shdr));
+		sec->type = rd32(shdr.sh_type, layout->swap);
+		sec->link = rd32(shdr.sh_link, layout->swap);
+		sec->offset = rd32(shdr.sh_offset, layout->swap);
+		sec->size = rd32(shdr.sh_size, layout->swap);
+		sec->entsize = rd32(shdr.sh_entsize, layout->swap);
+	}
+
+	return 0;
+}
+
+int elf_read_header(struct elf_layout * layout, void const * data,
+		size_t size)
+{
+	unsigned char const * ident = data;
+
+	memset(layout, 0, sizeof(*layout));
+
+	if (size < EI_NIDENT || memcmp(ident, ELFMAG, SELFMAG) ||
+			(ident[EI_CLASS] != ELFCLASS32 &&
+			 ident[EI_CLASS] != ELFCLASS64) ||
+			(ident[EI_DATA] != ELFDATA2LSB &&
+			 ident[EI_DATA] != ELFDATA2MSB))
+		return -ENOEXEC;
+
+	layout->is_64 = ident[EI_CLASS] == ELFCLASS64;
+	layout->swap = ident[EI_DATA] != HOST_ELFDATA;
+
+	if (layout->is_64)
+	{
+		Elf64_Ehdr ehdr;
+
+		if (size < sizeof(ehdr))
+			return -ENOEXEC;
+		memcpy(&ehdr, data, sizeof(ehdr));
+		layout->machine = rd16(ehdr.e_machine, layout->swap);
+		layout->shoff = rd64(ehdr.e_shoff, layout->swap);
+		layout->shentsize = rd16(ehdr.e_shentsize, layout->swap);
+		layout->shnum = rd16(ehdr.e_shnum, layout->swap);
+	}
+	else
+	{
+		Elf32_Ehdr ehdr;
+
+		if (size < sizeof(ehdr))
+			return -ENOEXEC;
+		memcpy(&ehdr, data, sizeof(ehdr));
+		layout->machine = rd16(ehdr.e_machine, layout->swap);
+		layout->shoff = rd32(ehdr.e_shoff, layout->swap);
+		layout->shentsize = rd16(ehdr.e_shentsize, layout->swap);
+		layout->shnum = rd16(ehdr.e_shnum, layout->swap);
+	}
+
+	return 0;
+}
+
+/* @brief Locate the hash and version tables of the symbols, and the dynamic
+ * section, if any. They are optional, a malformed one is ignored.
+ *
+ * The hash tables and .gnu.version are linked to .dynsym, the version
+ * definitions and requirements and the dynamic section to its string table.
+ */
+static void elf_read_tables(struct elf_layout * layout,
+		unsigned char const * table, size_t table_size, size_t dynsym,
+		size_t dynstr)
+{
+	struct section sec;
+	uint32_t info;
+
+	for (size_t i = 0; i < layout->shnum; ++i)
+	{
+		if (read_section(layout, table, table_size, i, &sec) < 0)
+			return;
+
+		if (sec.link == dynstr && (sec.type == SHT_GNU_verdef ||
+					sec.type == SHT_GNU_verneed))
+		{
+			/* The number of entries is only in sh_info. */
+			memcpy(&info, table + layout->shentsize * i +
+					(layout->is_64 ?
+					 offsetof(Elf64_Shdr, sh_info) :
+					 offsetof(Elf32_Shdr, sh_info)),
+					sizeof(info));
+			info = rd32(info, layout->swap);
+
+			if (sec.type == SHT_GNU_verdef)
+			{
+				layout->verdef_offset = sec.offset;
+				layout->verdef_size = sec.size;
+				layout->verdef_count = info;
+			}
+			else
+			{
+				layout->verneed_offset = sec.offset;
+				layout->verneed_size = sec.size;
+				layout->verneed_count = info;
+			}
+			continue;
+		}
+
+		if (sec.link == dynstr && sec.type == SHT_DYNAMIC)
+		{
+			layout->dynamic_offset = sec.offset;
+			layout->dynamic_size = sec.size;
+			layout->dynamic_entsize = sec.entsize;
+			continue;
+		}
+
+		if (sec.link != dynsym)
+			continue;
+
+		if (sec.type == SHT_GNU_versym)
+		{
+			layout->versym_offset = sec.offset;
+			layout->versym_size = sec.size;
+		}
+		else if (sec.type == SHT_GNU_HASH)
+		{
+			layout->gnu_hash_offset = sec.offset;
+			layout->gnu_hash_size = sec.size;
+		}
+		else if (sec.type == SHT_HASH)
+		{
+			layout->hash_offset = sec.offset;
+			layout->hash_size = sec.size;
+		}
+	}
+}
+
+int elf_read_sections(struct elf_layout * layout, void const * table,
+		size_t table_size)
+{
+	struct section sec;
+	int ret;
+
+	/* With many sections, the real count lives in the first header. */
+	if (layout->shnum == 0)
+	{
+		ret = read_section(layout, table, table_size, 0, &sec);
+		if (ret < 0)
+			return ret;
+		layout->shnum = sec.size;
+	}
+
+	if (layout->shentsize && layout->shnum > table_size / layout->shentsize)
+		return -ENOEXEC;
+
+	for (size_t i = 0; i < layout->shnum; ++i)
+	{
+		struct section strtab;
+
+		ret = read_section(layout, table, table_size, i, &sec);
+		if (ret < 0)
+			return ret;
+
+		if (sec.type != SHT_DYNSYM)
+			continue;
+
+		ret = read_section(layout, table, table_size, sec.link, &strtab);
+		if (ret < 0)
+			return ret;
+
+		if (strtab.type != SHT_STRTAB)
+			return -ENOEXEC;
+
+		layout->dynsym_offset = sec.offset;
+		layout->dynsym_size = sec.size;
+		layout->dynsym_entsize = sec.entsize;
+		layout->dynstr_offset = strtab.offset;
+		layout->dynstr_size = strtab.size;
+
+		elf_read_tables(layout, table, table_size, i, sec.link);
+
+		return 0;
+	}
+
+	return 0;
+}
+
+/* @brief Give the number of bytes of the ELF header and the section header
+ * table of a file. */
+static size_t elf_headers_size(struct elf_layout const * layout)
+{
+	size_t size = layout->is_64 ? sizeof(Elf64_Ehdr) : sizeof(Elf32_Ehdr);
+
+	if (layout->shoff)
+		size += (size_t)(layout->shnum * layout->shentsize);
+
+	return size;
+}
+
+/* @brief Point a file at its symbols and strings, once they are in memory. */
+static void elf_set_tables(struct elf_file * elf,
+		struct elf_layout const * layout, unsigned char const * dynsym,
+		char const * dynstr)
+{
+	size_t entsize = layout->is_64 ? sizeof(Elf64_Sym) : sizeof(Elf32_Sym);
+
+	if (layout->dynsym_entsize > entsize)
+		entsize = (size_t)layout->dynsym_entsize;
+
+	elf->is_64 = layout->is_64;
+	elf->swap = layout->swap;
+	elf->dynsym = dynsym;
+	elf->dynsym_entsize = entsize;
+	elf->dynsym_count = (size_t)(layout->dynsym_size / entsize);
+	elf->dynstr = dynstr;
+	elf->dynstr_size = (size_t)layout->dynstr_size;
+
+	/* Names are handed out without copy, make sure the last one is
+	 * terminated inside the section. */
+	while (elf->dynstr_size && elf->dynstr[elf->dynstr_size - 1] != '\0')
+		elf->dynstr_size--;
+}
+
+void elf_attach(struct elf_file * elf, struct elf_layout const * layout,
+		void * buffer)
+{
+	unsigned char * tables = buffer;
+
+	memset(elf, 0, sizeof(*elf));
+	elf->buffer = buffer;
+	elf->size = (size_t)(layout->dynsym_size + layout->dynstr_size);
+	elf->headers_size = elf_headers_size(layout);
+
+	if (layout->dynsym_size)
+		elf_set_tables(elf, layout, tables,
+				(char const *)tables + layout->dynsym_size);
+}
+
+/* @brief Check that [offset, offset + size) lies inside the mapping. */
+static int in_bounds(struct elf_file const * elf, uint64_t offset,
+		uint64_t size)
+{
+	return offset <= elf->size && size <= elf->size - offset;
+}
+
+/* @brief Point at an optional table of the mapping, left NULL when it is
+ * absent or lies outside the file. */
+static void elf_map_table(struct elf_file const * elf, uint64_t offset,
+		uint64_t size, unsigned char const ** table, size_t * table_size)
+{
+	if (!size || !in_bounds(elf, offset, size))
+		return;
+
+	*table = elf->map + offset;
+	*table_size = (size_t)size;
+}
+
+/* @brief Find .dynsym and its string table from the section headers. */
+static int find_dynsym(struct elf_file * elf)
+{
+	struct elf_layout layout;
+	int ret;
+
+	ret = elf_read_header(&layout, elf->map, elf->size);
+	if (ret < 0)
+		return ret;
+
+	if (!layout.shoff)
+		return 0;
+	if (layout.shoff > elf->size)
+		return -ENOEXEC;
+
+	ret = elf_read_sections(&layout, elf->map + layout.shoff,
+			elf->size - (size_t)layout.shoff);
+	if (ret < 0)
+		return ret;
+
+	elf->headers_size = elf_headers_size(&layout);
+	if (!layout.dynsym_size)
+		return 0;
+
+	if (!in_bounds(elf, layout.dynsym_offset, layout.dynsym_size) ||
+			!in_bounds(elf, layout.dynstr_offset, layout.dynstr_size))
+		return -ENOEXEC;
+
+	elf_set_tables(elf, &layout, elf->map + layout.dynsym_offset,
+			(char const *)elf->map + layout.dynstr_offset);
+
+	elf_map_table(elf, layout.gnu_hash_offset, layout.gnu_hash_size,
+			&elf->gnu_hash, &elf->gnu_hash_size);
+	elf_map_table(elf, layout.hash_offset, layout.hash_size,
+			&elf->hash, &elf->hash_size);
+	elf_map_table(elf, layout.versym_offset, layout.versym_size,
+			&elf->versym, &elf->versym_size);
+	elf_map_table(elf, layout.verdef_offset, layout.verdef_size,
+			&elf->verdef, &elf->verdef_size);
+	elf_map_table(elf, layout.verneed_offset, layout.verneed_size,
+			&elf->verneed, &elf->verneed_size);
+	elf->verdef_count = (size_t)layout.verdef_count;
+	elf->verneed_count = (size_t)layout.verneed_count;
+
+	elf_map_table(elf, layout.dynamic_offset, layout.dynamic_size,
+			&elf->dynamic, &elf->dynamic_count);
+	elf->dynamic_entsize = layout.is_64 ? sizeof(Elf64_Dyn) :
+		sizeof(Elf32_Dyn);
+	if (layout.dynamic_entsize > elf->dynamic_entsize)
+		elf->dynamic_entsize = (size_t)layout.dynamic_entsize;
+	elf->dynamic_count /= elf->dynamic_entsize;
+
+	return 0;
+}
+
+int elf_open(struct elf_file * elf, char const * path)
+{
+	struct stat statbuff;
+	void * map;
+	int ret;
+	int fd;
+
+	memset(elf, 0, sizeof(*elf));
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+
+	ret = fstat(fd, &statbuff);
+	if (ret < 0)
+	{
+		ret = -errno;
+		close(fd);
+		return ret;
+	}
+
+	if (statbuff.st_size < EI_NIDENT)
+	{
+		close(fd);
+		return -ENOEXEC;
+	}
+
+	map = mmap(NULL, (size_t)statbuff.st_size, PROT_READ, MAP_PRIVATE,
+			fd, 0);
+	ret = -errno;
+	close(fd);
+	if (map == MAP_FAILED)
+		return ret;
+
+	elf->map = map;
+	elf->size = (size_t)statbuff.st_size;
+
+	ret = find_dynsym(elf);
+	if (ret < 0)
+	{
+		elf_close(elf);
+		return ret;
+	}
+
+	return 0;
+}
+
+int elf_symbol(struct elf_file const * elf, size_t index,
+		struct elf_symbol * sym)
+{
+	unsigned char const * entry = elf->dynsym + index * elf->dynsym_entsize;
+	uint32_t name;
+
+	if (elf->is_64)
+	{
+		Elf64_Sym s;
+
+		memcpy(&s, entry, sizeof(s));
+		name = rd32(s.st_name, elf->swap);
+		sym->info = s.st_info;
+		sym->other = s.st_other;
+		sym->shndx = rd16(s.st_shndx, elf->swap);
+	}
+	else
+	{
+		Elf32_Sym s;
+
+		memcpy(&s, entry, sizeof(s));
+		name = rd32(s.st_name, elf->swap);
+		sym->info = s.st_info;
+		sym->other = s.st_other;
+		sym->shndx = rd16(s.st_shndx, elf->swap);
+	}
+
+	if (name >= elf->dynstr_size)
+		return -EINVAL;
+
+	sym->name = elf->dynstr + name;
+	sym->version = NULL;
+
+	return 0;
+}
+
+/* @brief Read the 32-bit word of a hash table at the given index. */
+static uint32_t hash_word(struct elf_file const * elf,
+		unsigned char const * table, size_t index)
+{
+	uint32_t word;
+
+	memcpy(&word, table + index * sizeof(word), sizeof(word));
+
+	return rd32(word, elf->swap);
+}
+
+/* @brief Add the symbol at index to the symbols found if it has this
+ * name. */
+static void lookup_symbol(struct elf_file const * elf, char const * name,
+		size_t index, size_t * indexes, size_t capacity,
+		size_t * count)
+{
+	struct elf_symbol sym;
+
+	if (index && index < elf->dynsym_count && *count < capacity &&
+			elf_symbol(elf, index, &sym) == 0 && sym.name[0] &&
+			!strcmp(sym.name, name))
+		indexes[(*count)++] = index;
+}
+
+/* @brief Look a name up in .gnu.hash.
+ *
+ * The table starts with four words: the number of buckets, the index of
+ * the first hashed symbol, the number of bloom filter words and the shift
+ * of the second bloom bit. The bloom filter, of native words, the buckets
+ * and the hash of every hashed symbol follow.
+ */
+static int lookup_gnu(struct elf_file const * elf, char const * name,
+		size_t * indexes, size_t capacity, size_t * count)
+{
+	size_t word_size = elf->is_64 ? 8 : 4;
+	size_t bits = word_size * 8;
+	uint32_t nbuckets;
+	uint32_t symoffset;
+	uint32_t bloom_size;
+	uint32_t bloom_shift;
+	unsigned char const * bloom;
+	unsigned char const * buckets;
+	size_t chain_size;
+	uint64_t word;
+	uint64_t mask;
+	uint32_t hash = 5381;
+	uint32_t index;
+
+	if (elf->gnu_hash_size < 4 * sizeof(uint32_t))
+		return -ENOENT;
+
+	nbuckets = hash_word(elf, elf->gnu_hash, 0);
+	symoffset = hash_word(elf, elf->gnu_hash, 1);
+	bloom_size = hash_word(elf, elf->gnu_hash, 2);
+	bloom_shift = hash_word(elf, elf->gnu_hash, 3);
+
+	/* Symbol 0 is never hashed, and the shift applies to a 32-bit hash. */
+	if (!nbuckets || !bloom_size || (bloom_size & (bloom_size - 1)) ||
+			bloom_shift >= 32 || !symoffset ||
+			symoffset > elf->dynsym_count ||
+			(elf->gnu_hash_size - 4 * sizeof(uint32_t)) / word_size <
+			bloom_size ||
+			(elf->gnu_hash_size - 4 * sizeof(uint32_t) -
+			 bloom_size * word_size) / sizeof(uint32_t) < nbuckets)
+		return -ENOENT;
+
+	bloom = elf->gnu_hash + 4 * sizeof(uint32_t);
+	buckets = bloom + bloom_size * word_size;
+	chain_size = (elf->gnu_hash_size - 4 * sizeof(uint32_t) -
+			bloom_size * word_size) / sizeof(uint32_t) - nbuckets;
+
+	/* The undefined symbols come first and are left out of the table.
+	 * Some linkers also end the chains early when nothing is defined. */
+	for (size_t i = 1; i < elf->dynsym_count; ++i)
+	{
+		if (i == symoffset)
+			i += chain_size;
+		if (i < elf->dynsym_count)
+			lookup_symbol(elf, name, i, indexes, capacity, count);
+	}
+
+	for (unsigned char const * c = (unsigned char const *)name; *c; ++c)
+		hash = hash * 33 + *c;
+
+	if (elf->is_64)
+	{
+		memcpy(&word, bloom + (hash / bits % bloom_size) * 8, 8);
+		word = rd64(word, elf->swap);
+	}
+	else
+	{
+		word = hash_word(elf, bloom, hash / bits % bloom_size);
+	}
+
+	mask = ((uint64_t)1 << (hash % bits)) |
+		((uint64_t)1 << ((hash >> bloom_shift) % bits));
+	if ((word & mask) != mask)
+		return 0;
+
+	index = hash_word(elf, buckets, hash % nbuckets);
+	if (index < symoffset)
+		return 0;
+
+	/* A chain ends with the hash whose lowest bit is set. */
+	for (; index - symoffset < chain_size; ++index)
+	{
+		uint32_t chain = hash_word(elf, buckets,
+				nbuckets + index - symoffset);
+
+		if ((chain | 1) == (hash | 1))
+			lookup_symbol(elf, name, index, indexes, capacity,
+					count);
+		if (chain & 1)
+			break;
+	}
+
+	return 0;
+}
+
+/* @brief Look a name up in the SysV hash table.
+ *
+ * The table holds the number of buckets and of chain links, the buckets,
+ * then the link of every symbol to the next one in the same bucket.
+ */
+static int lookup_sysv(struct elf_file const * elf, char const * name,
+		size_t * indexes, size_t capacity, size_t * count)
+{
+	uint32_t nbuckets;
+	uint32_t nchain;
+	uint32_t hash = 0;
+	uint32_t index;
+
+	if (elf->hash_size < 2 * sizeof(uint32_t))
+		return -ENOENT;
+
+	nbuckets = hash_word(elf, elf->hash, 0);
+	nchain = hash_word(elf, elf->hash, 1);
+	if (!nbuckets || elf->hash_size / sizeof(uint32_t) - 2 < nbuckets ||
+			elf->hash_size / sizeof(uint32_t) - 2 - nbuckets < nchain)
+		return -ENOENT;
+
+	for (unsigned char const * c = (unsigned char const *)name; *c; ++c)
+	{
+		hash = (hash << 4) + *c;
+		hash ^= (hash >> 24) & 0xf0;
+	}
+	hash &= 0x0fffffff;
+
+	index = hash_word(elf, elf->hash, 2 + hash % nbuckets);
+
+	/* A malformed table could loop, no chain is longer than the table. */
+	for (uint32_t steps = 0; index && index < nchain && steps < nchain;
+			++steps)
+	{
+		lookup_symbol(elf, name, index, indexes, capacity,
+					count);
+		index = hash_word(elf, elf->hash, 2 + nbuckets + index);
+	}
+
+	return 0;
+}
+
+int elf_lookup(struct elf_file const * elf, char const * name,
+		size_t * indexes, size_t capacity, size_t * count)
+{
+	*count = 0;
+
+	if (elf->gnu_hash && !lookup_gnu(elf, name, indexes, capacity, count))
+		return 0;
+
+	*count = 0;
+	if (elf->hash)
+		return lookup_sysv(elf, name, indexes, capacity, count);
+
+	return -ENOENT;
+}
+
+/* @brief Give a string of .dynstr, NULL if it lies outside the table. */
+static char const * elf_string(struct elf_file const * elf, uint32_t offset)
+{
+	return offset < elf->dynstr_size ? elf->dynstr + offset : NULL;
+}
+
+/* @brief Find the name of a version among the definitions of the file. */
+static char const * version_defined(struct elf_file const * elf,
+		uint16_t version)
+{
+	size_t offset = 0;
+
+	for (size_t i = 0; i < elf->verdef_count; ++i)
+	{
+		Elf64_Verdef def;
+		Elf64_Verdaux aux;
+		uint32_t next;
+
+		if (offset > elf->verdef_size ||
+				elf->verdef_size - offset < sizeof(def))
+			return NULL;
+		memcpy(&def, elf->verdef + offset, sizeof(def));
+
+		if (rd16(def.vd_ndx, elf->swap) == version)
+		{
+			size_t aux_offset = offset + rd32(def.vd_aux, elf->swap);
+
+			if (aux_offset > elf->verdef_size ||
+					elf->verdef_size - aux_offset < sizeof(aux))
+				return NULL;
+			memcpy(&aux, elf->verdef + aux_offset, sizeof(aux));
+
+			return elf_string(elf, rd32(aux.vda_name, elf->swap));
+		}
+
+		next = rd32(def.vd_next, elf->swap);
+		if (!next)
+			return NULL;
+		offset += next;
+	}
+
+	return NULL;
+}
+
+/* @brief Find the name of a version among the requirements of the file. */
+static char const * version_needed(struct elf_file const * elf,
+		uint16_t version)
+{
+	size_t offset = 0;
+
+	for (size_t i = 0; i < elf->verneed_count; ++i)
+	{
+		Elf64_Verneed need;
+		size_t aux_offset;
+		uint32_t next;
+
+		if (offset > elf->verneed_size ||
+				elf->verneed_size - offset < sizeof(need))
+			return NULL;
+		memcpy(&need, elf->verneed + offset, sizeof(need));
+
+		aux_offset = offset + rd32(need.vn_aux, elf->swap);
+		for (uint16_t j = 0; j < rd16(need.vn_cnt, elf->swap); ++j)
+		{
+			Elf64_Vernaux aux;
+
+			if (aux_offset > elf->verneed_size ||
+					elf->verneed_size - aux_offset < sizeof(aux))
+				return NULL;
+			memcpy(&aux, elf->verneed + aux_offset, sizeof(aux));
+
+			if (rd16(aux.vna_other, elf->swap) == version)
+				return elf_string(elf, rd32(aux.vna_name,
+							elf->swap));
+
+			next = rd32(aux.vna_next, elf->swap);
+			if (!next)
+				break;
+			aux_offset += next;
+		}
+
+		next = rd32(need.vn_next, elf->swap);
+		if (!next)
+			return NULL;
+		offset += next;
+	}
+
+	return NULL;
+}
+
+char const * elf_version(struct elf_file const * elf, size_t index)
+{
+	uint16_t version;
+	char const * name;
+
+	if (!elf->versym || index >= elf->versym_size / sizeof(version))
+		return NULL;
+
+	memcpy(&version, elf->versym + index * sizeof(version),
+			sizeof(version));
+
+	/* The high bit hides the version from the static linker. Versions 0
+	 * and 1 are the local and global scopes, not real versions. */
+	version = rd16(version, elf->swap) & 0x7fff;
+	if (version <= VER_NDX_GLOBAL)
+		return NULL;
+
+	name = version_defined(elf, version);
+	if (!name)
+		name = version_needed(elf, version);
+
+	return name;
+}
+
+int elf_dynamic(struct elf_file const * elf, size_t index,
+		struct elf_dyn * dyn)
+{
+	unsigned char const * entry = elf->dynamic + index * elf->dynamic_entsize;
+
+	if (elf->is_64)
+	{
+		Elf64_Dyn d;
+
+		memcpy(&d, entry, sizeof(d));
+		dyn->tag = (int64_t)rd64((uint64_t)d.d_tag, elf->swap);
+		dyn->value = rd64(d.d_un.d_val, elf->swap);
+	}
+	else
+	{
+		Elf32_Dyn d;
+
+		memcpy(&d, entry, sizeof(d));
+		dyn->tag = (int32_t)rd32((uint32_t)d.d_tag, elf->swap);
+		dyn->value = rd32(d.d_un.d_val, elf->swap);
+	}
+
+	if (dyn->tag == DT_NULL)
+		return -ENOENT;
+
+	dyn->string = NULL;
+	if ((dyn->tag == DT_NEEDED || dyn->tag == DT_SONAME ||
+				dyn->tag == DT_RPATH || dyn->tag == DT_RUNPATH) &&
+			dyn->value <= UINT32_MAX)
+		dyn->string = elf_string(elf, (uint32_t)dyn->value);
+
+	return 0;
+}
+
+void elf_close(struct elf_file * elf)
+{
+	if (elf->map)
+		munmap((void *)elf->map, elf->size);
+	free(elf->buffer);
+
+	memset(elf, 0, sizeof(*elf));
+}
@@ -0,0 +1,160 @@
+/* moses Find symbol in shared libraries.
+ * Copyright (C) 2022  Mathias Schmitt
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <elf.h>
+#include <errno.h>
+#include <string.h>
+
+#include "elfsym.h"
+#include "filter.h"
+
+struct filter_name
+{
+	char const * name;
+	unsigned value;
+};
+
+static struct filter_name const types[] = {
+	{ "notype", STT_NOTYPE },
+	{ "object", STT_OBJECT },
+	{ "func", STT_FUNC },
+	{ "section", STT_SECTION },
+	{ "file", STT_FILE },
+	{ "common", STT_COMMON },
+	{ "tls", STT_TLS },
+	{ "ifunc", STT_GNU_IFUNC },
+	{ NULL, 0 }
+};
+
+static struct filter_name const bindings[] = {
+	{ "local", STB_LOCAL },
+	{ "global", STB_GLOBAL },
+	{ "weak", STB_WEAK },
+	{ "unique", STB_GNU_UNIQUE },
+	{ NULL, 0 }
+};
+
+static struct filter_name const visibilities[] = {
+	{ "default", STV_DEFAULT },
+	{ "internal", STV_INTERNAL },
+	{ "hidden", STV_HIDDEN },
+	{ "protected", STV_PROTECTED },
+	{ NULL, 0 }
+};
+
+/* @brief Add the values of the names of a comma separated list to a mask.
+ *
+ * @return 0 on success, -EINVAL if a name is unknown.
+ */
+static int filter_parse(unsigned * mask, char const * list,
+		struct filter_name const * names)
+{
+	while (*list)
+	{
+		size_t len = strcspn(list, ",");
+		size_t i;
+
+		for (i = 0; names[i].name; ++i)
+		{
+			if (strlen(names[i].name) == len &&
+					!strncmp(names[i].name, list, len))
+				break;
+		}
+
+		if (!names[i].name)
+			return -EINVAL;
+
+		*mask |= 1u << names[i].value;
+		list += len;
+		if (*list)
+			list++;
+	}
+
+	return 0;
+}
+
+int filter_types(struct filter * filter, char const * list)
+{
+	filter->active = 1;
+	return filter_parse(&filter->types, list, types);
+}
+
+int filter_bindings(struct filter * filter, char const * list)
+{
+	filter->active = 1;
+	return filter_parse(&filter->bindings, list, bindings);
+}
+
+int filter_visibilities(struct filter * filter, char const * list)
+{
+	filter->active = 1;
+	return filter_parse(&filter->visibilities, list, visibilities);
+}
+
+/* @brief Check the attributes of a symbol, whichever way they were found. */
+static int filter_check(struct filter const * filter, int defined,
+		unsigned type, unsigned binding, char const * version)
+{
+	if (filter->defined_only && !defined)
+		return 0;
+	if (filter->types && !(filter->types & (1u << type)))
+		return 0;
+	if (filter->bindings && !(filter->bindings & (1u << binding)))
+		return 0;
+	if (filter->version && (!version || strcmp(version, filter->version)))
+		return 0;
+
+	return 1;
+}
+
+int filter_symbol(struct filter const * filter, struct elf_symbol const * sym)
+{
+	if (filter->visibilities &&
+			!(filter->visibilities & (1u << ELF64_ST_VISIBILITY(sym->other))))
+		return 0;
+
+	return filter_check(filter, sym->shndx != SHN_UNDEF,
+			ELF64_ST_TYPE(sym->info), ELF64_ST_BIND(sym->info),
+			sym->version);
+}
+
+int filter_nm(struct filter const * filter, char type, char const * version)
+{
+	unsigned elf_type = STT_NOTYPE;
+	unsigned binding = STB_GLOBAL;
+
+	/* The line did not list a symbol. */
+	if (!type)
+		return 0;
+
+	if (strchr("tT", type))
+		elf_type = STT_FUNC;
+	else if (type == 'i')
+		elf_type = STT_GNU_IFUNC;
+	else if (strchr("bBdDgGrRsSvVu", type))
+		elf_type = STT_OBJECT;
+
+	if (strchr("vVwW", type))
+		binding = STB_WEAK;
+	else if (type == 'u')
+		binding = STB_GNU_UNIQUE;
+	else if (type >= 'a' && type <= 'z' && type != 'i')
+		binding = STB_LOCAL;
+
+	return filter_check(filter, !strchr("Uvw", type), elf_type, binding,
+			version);
+}
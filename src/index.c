@@ -0,0 +1,672 @@
+/* moses Find symbol in shared libraries.
+ * Copyright (C) 2022  Mathias Schmitt
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "index.h"
+
+#define INDEX_MAGIC "MOSESIDX"
+#define INDEX_VERSION 2
+
+/* Layout of the file: a header, the library table sorted by device and
+ * inode, the symbol table and finally a pool of NUL terminated names, each
+ * stored once. Everything is in host byte order, an index written by a
+ * machine of the other endianness fails the version check and is rebuilt.
+ */
+struct index_header
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t lib_count;
+	uint64_t sym_count;
+	uint64_t libs_offset;
+	uint64_t syms_offset;
+	uint64_t strings_offset;
+	uint64_t strings_size;
+};
+
+struct index_lib
+{
+	uint64_t dev;
+	uint64_t ino;
+	uint64_t size;
+	int64_t mtime_sec;
+	int64_t mtime_nsec;
+	uint64_t first_sym;
+	uint32_t sym_count;
+	uint32_t flags;
+};
+
+/* A library extracted during this run. */
+struct index_entry
+{
+	struct index_lib lib;
+	struct index_sym * syms;
+	char * strings;
+};
+
+enum lib_state
+{
+	LIB_UNSEEN = 0,
+	LIB_SEEN,
+	LIB_STALE
+};
+
+struct index
+{
+	char * path;
+
+	void * map;
+	size_t map_size;
+	struct index_header const * header;
+	struct index_lib const * libs;
+	struct index_sym const * syms;
+	char const * strings;
+
+	pthread_mutex_t lock;
+	unsigned char * states;
+	struct index_entry * entries;
+	size_t entry_nb;
+	size_t entry_capacity;
+};
+
+/* Names interned while writing the index. */
+struct pool_writer
+{
+	char * data;
+	size_t size;
+	size_t capacity;
+	uint32_t * slots;
+	size_t slot_nb;
+	size_t used;
+};
+
+static void lib_key(struct index_lib * lib, struct stat const * statbuff)
+{
+	lib->dev = (uint64_t)statbuff->st_dev;
+	lib->ino = (uint64_t)statbuff->st_ino;
+	lib->size = (uint64_t)statbuff->st_size;
+	lib->mtime_sec = (int64_t)statbuff->st_mtim.tv_sec;
+	lib->mtime_nsec = (int64_t)statbuff->st_mtim.tv_nsec;
+}
+
+static int lib_compare(void const * a, void const * b)
+{
+	struct index_lib const * l1 = a;
+	struct index_lib const * l2 = b;
+
+	if (l1->dev != l2->dev)
+		return l1->dev < l2->dev ? -1 : 1;
+	if (l1->ino != l2->ino)
+		return l1->ino < l2->ino ? -1 : 1;
+	return 0;
+}
+
+/* @brief Check that the tables announced by the header fit in the file. */
+static int header_valid(struct index_header const * header, uint64_t size)
+{
+	if (size < sizeof(*header) ||
+			memcmp(header->magic, INDEX_MAGIC, sizeof(header->magic)) ||
+			header->version != INDEX_VERSION)
+		return 0;
+
+	return header->libs_offset <= size && header->syms_offset <= size &&
+		header->strings_offset <= size &&
+		header->lib_count <= (size - header->libs_offset) /
+			sizeof(struct index_lib) &&
+		header->sym_count <= (size - header->syms_offset) /
+			sizeof(struct index_sym) &&
+		header->strings_size <= size - header->strings_offset &&
+		header->libs_offset % sizeof(uint64_t) == 0 &&
+		header->syms_offset % sizeof(uint32_t) == 0;
+}
+
+/* @brief Check that every library and symbol points inside the tables. */
+static int content_valid(struct index const * index)
+{
+	struct index_header const * header = index->header;
+
+	if (header->strings_size &&
+			index->strings[header->strings_size - 1] != '\0')
+		return 0;
+
+	for (uint32_t i = 0; i < header->lib_count; ++i)
+	{
+		struct index_lib const * lib = &index->libs[i];
+
+		if (lib->first_sym > header->sym_count ||
+				lib->sym_count > header->sym_count - lib->first_sym)
+			return 0;
+	}
+
+	for (uint64_t i = 0; i < header->sym_count; ++i)
+	{
+		if (index->syms[i].name >= header->strings_size ||
+				(index->syms[i].version != INDEX_NO_VERSION &&
+				 index->syms[i].version >= header->strings_size))
+			return 0;
+	}
+
+	return 1;
+}
+
+/* @brief Map an existing index file, leaving the index empty if there is none
+ * or if it cannot be used.
+ */
+static void index_map(struct index * index)
+{
+	struct stat statbuff;
+	char const * map;
+	int fd;
+
+	fd = open(index->path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return;
+
+	if (fstat(fd, &statbuff) < 0 ||
+			(size_t)statbuff.st_size < sizeof(struct index_header))
+	{
+		close(fd);
+		return;
+	}
+
+	map = mmap(NULL, (size_t)statbuff.st_size, PROT_READ, MAP_PRIVATE, fd,
+			0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return;
+
+	index->map = (void *)map;
+	index->map_size = (size_t)statbuff.st_size;
+	index->header = (struct index_header const *)map;
+
+	if (header_valid(index->header, index->map_size))
+	{
+		index->libs = (void const *)(map + index->header->libs_offset);
+		index->syms = (void const *)(map + index->header->syms_offset);
+		index->strings = map + index->header->strings_offset;
+
+		if (content_valid(index))
+			return;
+	}
+
+	printf("Index '%s' is invalid, it will be rebuilt.\n", index->path);
+	munmap(index->map, index->map_size);
+	index->map = NULL;
+	index->map_size = 0;
+	index->header = NULL;
+}
+
+struct index * index_open(char const * path)
+{
+	struct index * index = calloc(1, sizeof(*index));
+
+	if (!index)
+		return NULL;
+
+	pthread_mutex_init(&index->lock, NULL);
+
+	index->path = strdup(path);
+	if (!index->path)
+	{
+		index_close(index);
+		return NULL;
+	}
+
+	index_map(index);
+
+	if (index->header && index->header->lib_count)
+	{
+		index->states = calloc(index->header->lib_count,
+				sizeof(*index->states));
+		if (!index->states)
+		{
+			index_close(index);
+			return NULL;
+		}
+	}
+
+	return index;
+}
+
+int index_lookup(struct index * index, struct stat const * statbuff,
+		struct index_view * view)
+{
+	struct index_lib key;
+	struct index_lib const * lib;
+	int hit;
+
+	if (!index->header)
+		return 0;
+
+	lib_key(&key, statbuff);
+	lib = bsearch(&key, index->libs, index->header->lib_count,
+			sizeof(*lib), lib_compare);
+	if (!lib)
+		return 0;
+
+	hit = lib->size == key.size && lib->mtime_sec == key.mtime_sec &&
+		lib->mtime_nsec == key.mtime_nsec;
+
+	pthread_mutex_lock(&index->lock);
+	index->states[lib - index->libs] = hit ? LIB_SEEN : LIB_STALE;
+	pthread_mutex_unlock(&index->lock);
+
+	if (!hit)
+		return 0;
+
+	view->syms = index->syms + lib->first_sym;
+	view->strings = index->strings;
+	view->count = lib->sym_count;
+	view->flags = lib->flags;
+
+	return 1;
+}
+
+int index_add(struct index * index, struct stat const * statbuff,
+		uint32_t flags, struct elf_symbol const * syms, size_t count)
+{
+	struct index_entry entry;
+	size_t size = 0;
+
+	memset(&entry, 0, sizeof(entry));
+	lib_key(&entry.lib, statbuff);
+	entry.lib.flags = flags;
+	entry.lib.sym_count = (uint32_t)count;
+
+	for (size_t i = 0; i < count; ++i)
+	{
+		size += strlen(syms[i].name) + 1;
+		if (syms[i].version)
+			size += strlen(syms[i].version) + 1;
+	}
+
+	entry.syms = malloc(count * sizeof(*entry.syms) + 1);
+	entry.strings = malloc(size + 1);
+	if (!entry.syms || !entry.strings)
+	{
+		free(entry.syms);
+		free(entry.strings);
+		return -ENOMEM;
+	}
+
+	size = 0;
+	for (size_t i = 0; i < count; ++i)
+	{
+		size_t len = strlen(syms[i].name) + 1;
+
+		entry.syms[i].name = (uint32_t)size;
+		entry.syms[i].info = syms[i].info;
+		entry.syms[i].other = syms[i].other;
+		entry.syms[i].shndx = syms[i].shndx;
+		entry.syms[i].version = INDEX_NO_VERSION;
+		memcpy(entry.strings + size, syms[i].name, len);
+		size += len;
+
+		if (syms[i].version)
+		{
+			len = strlen(syms[i].version) + 1;
+			entry.syms[i].version = (uint32_t)size;
+			memcpy(entry.strings + size, syms[i].version, len);
+			size += len;
+		}
+	}
+
+	pthread_mutex_lock(&index->lock);
+
+	if (index->entry_nb == index->entry_capacity)
+	{
+		size_t capacity = index->entry_capacity ?
+			index->entry_capacity * 2 : 64;
+		struct index_entry * entries = realloc(index->entries,
+				capacity * sizeof(*entries));
+
+		if (!entries)
+		{
+			pthread_mutex_unlock(&index->lock);
+			free(entry.syms);
+			free(entry.strings);
+			return -ENOMEM;
+		}
+
+		index->entries = entries;
+		index->entry_capacity = capacity;
+	}
+	index->entries[index->entry_nb++] = entry;
+
+	pthread_mutex_unlock(&index->lock);
+
+	return 0;
+}
+
+static uint32_t hash_string(char const * str)
+{
+	uint32_t hash = 2166136261u;
+
+	while (*str)
+	{
+		hash ^= (unsigned char)*str++;
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+static int writer_grow_slots(struct pool_writer * writer)
+{
+	size_t slot_nb = writer->slot_nb ? writer->slot_nb * 2 : 1024;
+	uint32_t * slots = malloc(slot_nb * sizeof(*slots));
+
+	if (!slots)
+		return -ENOMEM;
+
+	memset(slots, 0xff, slot_nb * sizeof(*slots));
+
+	for (size_t i = 0; i < writer->slot_nb; ++i)
+	{
+		uint32_t offset = writer->slots[i];
+		size_t slot;
+
+		if (offset == UINT32_MAX)
+			continue;
+
+		slot = hash_string(writer->data + offset) & (slot_nb - 1);
+		while (slots[slot] != UINT32_MAX)
+			slot = (slot + 1) & (slot_nb - 1);
+		slots[slot] = offset;
+	}
+
+	free(writer->slots);
+	writer->slots = slots;
+	writer->slot_nb = slot_nb;
+
+	return 0;
+}
+
+/* @brief Add a name to the string pool, unless it is already there.
+ *
+ * @return The offset of the name in the pool, or -ENOMEM / -EFBIG.
+ */
+static int64_t writer_intern(struct pool_writer * writer, char const * name)
+{
+	size_t len = strlen(name) + 1;
+	size_t slot;
+
+	if ((writer->used + 1) * 2 > writer->slot_nb &&
+			writer_grow_slots(writer) < 0)
+		return -ENOMEM;
+
+	slot = hash_string(name) & (writer->slot_nb - 1);
+	while (writer->slots[slot] != UINT32_MAX)
+	{
+		if (!strcmp(writer->data + writer->slots[slot], name))
+			return writer->slots[slot];
+		slot = (slot + 1) & (writer->slot_nb - 1);
+	}
+
+	if (writer->size + len > UINT32_MAX)
+		return -EFBIG;
+
+	if (writer->size + len > writer->capacity)
+	{
+		size_t capacity = writer->capacity ? writer->capacity * 2 : 65536;
+		char * data;
+
+		while (capacity < writer->size + len)
+			capacity *= 2;
+
+		data = realloc(writer->data, capacity);
+		if (!data)
+			return -ENOMEM;
+		writer->data = data;
+		writer->capacity = capacity;
+	}
+
+	memcpy(writer->data + writer->size, name, len);
+	writer->slots[slot] = (uint32_t)writer->size;
+	writer->used++;
+	writer->size += len;
+
+	return writer->slots[slot];
+}
+
+/* @brief Gather the libraries to write: the entries extracted during this run
+ * and the still valid ones from the mapped file.
+ */
+static struct index_entry * collect_entries(struct index * index, int prune,
+		size_t * count)
+{
+	size_t lib_count = index->header ? index->header->lib_count : 0;
+	struct index_entry * entries;
+	size_t nb = 0;
+
+	entries = malloc((lib_count + index->entry_nb + 1) * sizeof(*entries));
+	if (!entries)
+		return NULL;
+
+	for (size_t i = 0; i < lib_count; ++i)
+	{
+		struct index_lib const * lib = &index->libs[i];
+
+		if (index->states[i] == LIB_STALE ||
+				(prune && index->states[i] != LIB_SEEN))
+			continue;
+
+		entries[nb].lib = *lib;
+		entries[nb].syms = (struct index_sym *)index->syms +
+			lib->first_sym;
+		entries[nb].strings = (char *)index->strings;
+		nb++;
+	}
+
+	memcpy(entries + nb, index->entries,
+			index->entry_nb * sizeof(*entries));
+	nb += index->entry_nb;
+
+	qsort(entries, nb, sizeof(*entries), lib_compare);
+
+	/* The same file may have been reached through several hard links. */
+	if (nb)
+	{
+		size_t unique = 1;
+
+		for (size_t i = 1; i < nb; ++i)
+		{
+			if (lib_compare(&entries[unique - 1], &entries[i]))
+				entries[unique++] = entries[i];
+		}
+		nb = unique;
+	}
+
+	*count = nb;
+
+	return entries;
+}
+
+static int write_index(FILE * file,
+		struct index_entry * entries, size_t count)
+{
+	struct index_header header;
+	struct pool_writer writer;
+	uint64_t sym_count = 0;
+	int ret = 0;
+
+	memset(&writer, 0, sizeof(writer));
+	memset(&header, 0, sizeof(header));
+
+	for (size_t i = 0; i < count; ++i)
+		sym_count += entries[i].lib.sym_count;
+
+	memcpy(header.magic, INDEX_MAGIC, sizeof(header.magic));
+	header.version = INDEX_VERSION;
+	header.lib_count = (uint32_t)count;
+	header.sym_count = sym_count;
+	header.libs_offset = sizeof(header);
+	header.syms_offset = header.libs_offset +
+		count * sizeof(struct index_lib);
+	header.strings_offset = header.syms_offset +
+		sym_count * sizeof(struct index_sym);
+
+	/* The library table comes first but is only complete once the symbols
+	 * are numbered, write it after them. */
+	if (fseek(file, (long)header.syms_offset, SEEK_SET) < 0)
+		return -errno;
+
+	sym_count = 0;
+	for (size_t i = 0; i < count && !ret; ++i)
+	{
+		struct index_entry * entry = &entries[i];
+
+		for (uint32_t j = 0; j < entry->lib.sym_count; ++j)
+		{
+			struct index_sym sym = entry->syms[j];
+			int64_t offset = writer_intern(&writer,
+					entry->strings + sym.name);
+
+			if (offset < 0)
+			{
+				ret = (int)offset;
+				break;
+			}
+
+			sym.name = (uint32_t)offset;
+
+			if (sym.version != INDEX_NO_VERSION)
+			{
+				offset = writer_intern(&writer,
+						entry->strings + sym.version);
+				if (offset < 0)
+				{
+					ret = (int)offset;
+					break;
+				}
+				sym.version = (uint32_t)offset;
+			}
+			if (fwrite(&sym, sizeof(sym), 1, file) != 1)
+			{
+				ret = -EIO;
+				break;
+			}
+		}
+
+		entry->lib.first_sym = sym_count;
+		sym_count += entry->lib.sym_count;
+	}
+
+	if (!ret && writer.size &&
+			fwrite(writer.data, 1, writer.size, file) != writer.size)
+		ret = -EIO;
+
+	header.strings_size = writer.size;
+	free(writer.data);
+	free(writer.slots);
+
+	if (ret < 0)
+		return ret;
+
+	if (fseek(file, 0, SEEK_SET) < 0 ||
+			fwrite(&header, sizeof(header), 1, file) != 1)
+		return -EIO;
+
+	for (size_t i = 0; i < count; ++i)
+	{
+		if (fwrite(&entries[i].lib, sizeof(entries[i].lib), 1, file)
+				!= 1)
+			return -EIO;
+	}
+
+	return 0;
+}
+
+int index_save(struct index * index, int prune)
+{
+	struct index_entry * entries;
+	size_t count = 0;
+	size_t size = strlen(index->path) + 32;
+	char * tmp_path;
+	FILE * file;
+	int ret;
+
+	if (!index->entry_nb && !prune)
+		return 0;
+
+	entries = collect_entries(index, prune, &count);
+	tmp_path = malloc(size);
+	if (!entries || !tmp_path)
+	{
+		free(entries);
+		free(tmp_path);
+		return -ENOMEM;
+	}
+
+	snprintf(tmp_path, size, "%s.%d.tmp", index->path, getpid());
+
+	file = fopen(tmp_path, "w");
+	if (!file)
+	{
+		ret = -errno;
+		printf("Error: failed to create index %s: %s\n", tmp_path,
+			strerror(errno));
+		free(entries);
+		free(tmp_path);
+		return ret;
+	}
+
+	ret = write_index(file, entries, count);
+	if (fclose(file) && !ret)
+		ret = -errno;
+
+	if (!ret && rename(tmp_path, index->path) < 0)
+		ret = -errno;
+
+	if (ret < 0)
+	{
+		printf("Error: failed to write index %s: %s\n", index->path,
+			strerror(-ret));
+		unlink(tmp_path);
+	}
+
+	free(entries);
+	free(tmp_path);
+
+	return ret;
+}
+
+void index_close(struct index * index)
+{
+	for (size_t i = 0; i < index->entry_nb; ++i)
+	{
+		free(index->entries[i].syms);
+		free(index->entries[i].strings);
+	}
+
+	if (index->map)
+		munmap(index->map, index->map_size);
+
+	pthread_mutex_destroy(&index->lock);
+	free(index->entries);
+	free(index->states);
+	free(index->path);
+	free(index);
+}
@@ -0,0 +1,225 @@
+/* moses Find symbol in shared libraries.
+ * Copyright (C) 2022  Mathias Schmitt
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "ldcache.h"
+
+#define OLD_MAGIC "ld.so-1.7.0"
+#define NEW_MAGIC "glibc-ld.so.cache1.1"
+
+/* Byte order the new format records in its flags. */
+#define NEW_ENDIAN_MASK 0x3
+#define NEW_ENDIAN_LITTLE 0x2
+#define NEW_ENDIAN_BIG 0x3
+
+struct old_header
+{
+	char magic[sizeof(OLD_MAGIC) - 1];
+	uint32_t count;
+};
+
+struct old_entry
+{
+	int32_t flags;
+	uint32_t key;
+	uint32_t value;
+};
+
+struct new_header
+{
+	char magic[sizeof(NEW_MAGIC) - 1];
+	uint32_t count;
+	uint32_t strings_size;
+	uint8_t flags;
+	uint8_t padding[3];
+	uint32_t extension_offset;
+	uint32_t unused[3];
+};
+
+struct new_entry
+{
+	int32_t flags;
+	uint32_t key;
+	uint32_t value;
+	uint32_t os_version;
+	uint64_t hwcap;
+};
+
+/* @brief Locate the table of the new format starting at offset.
+ *
+ * @return 0 on success, -EINVAL if there is no valid table there.
+ */
+static int ldcache_new(struct ldcache * cache, size_t offset)
+{
+	struct new_header header;
+	int endian;
+
+	if (offset > cache->size || cache->size - offset < sizeof(header))
+		return -EINVAL;
+
+	memcpy(&header, cache->map + offset, sizeof(header));
+	if (memcmp(header.magic, NEW_MAGIC, sizeof(header.magic)))
+		return -EINVAL;
+
+	/* Caches written before the byte order was recorded are native. */
+	endian = header.flags & NEW_ENDIAN_MASK;
+	if (endian && endian != (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__ ?
+				NEW_ENDIAN_LITTLE : NEW_ENDIAN_BIG))
+		return -EINVAL;
+
+	if (header.count > (cache->size - offset - sizeof(header)) /
+			sizeof(struct new_entry))
+		return -EINVAL;
+
+	cache->entries = cache->map + offset + sizeof(header);
+	cache->entry_size = sizeof(struct new_entry);
+	cache->count = header.count;
+	cache->strings = offset;
+
+	return 0;
+}
+
+/* @brief Locate the table of the old format, and of the new one following
+ * it if ldconfig wrote both.
+ *
+ * @return 0 on success, -EINVAL if there is no valid table.
+ */
+static int ldcache_old(struct ldcache * cache)
+{
+	struct old_header header;
+	size_t end;
+
+	memcpy(&header, cache->map, sizeof(header));
+	if (header.count > (cache->size - sizeof(header)) /
+			sizeof(struct old_entry))
+		return -EINVAL;
+
+	/* The strings of the old format follow its entries. */
+	end = sizeof(header) + header.count * sizeof(struct old_entry);
+
+	/* The new table is aligned like its header, its entries hold 64-bit
+	 * values. */
+	if (!ldcache_new(cache, (end + 7) & ~(size_t)7))
+		return 0;
+
+	cache->entries = cache->map + sizeof(header);
+	cache->entry_size = sizeof(struct old_entry);
+	cache->count = header.count;
+	cache->strings = end;
+
+	return 0;
+}
+
+int ldcache_open(struct ldcache * cache, char const * path)
+{
+	struct stat statbuff;
+	void * map;
+	int ret = 0;
+	int fd;
+
+	memset(cache, 0, sizeof(*cache));
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+
+	if (fstat(fd, &statbuff) < 0)
+	{
+		ret = -errno;
+		close(fd);
+		return ret;
+	}
+
+	if (statbuff.st_size < (off_t)sizeof(struct old_header))
+	{
+		close(fd);
+		return -EINVAL;
+	}
+
+	map = mmap(NULL, (size_t)statbuff.st_size, PROT_READ, MAP_PRIVATE, fd,
+			0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return -errno;
+
+	cache->map = map;
+	cache->size = (size_t)statbuff.st_size;
+
+	if (!memcmp(cache->map, OLD_MAGIC, sizeof(OLD_MAGIC) - 1))
+		ret = ldcache_old(cache);
+	else
+		ret = ldcache_new(cache, 0);
+
+	if (ret < 0)
+		ldcache_close(cache);
+
+	return ret;
+}
+
+/* @brief Give a string of the cache, NULL if it lies outside the file or is
+ * not terminated. */
+static char const * ldcache_string(struct ldcache const * cache,
+		uint32_t offset)
+{
+	char const * string;
+
+	if (offset >= cache->size - cache->strings)
+		return NULL;
+
+	string = (char const *)cache->map + cache->strings + offset;
+	if (!memchr(string, '\0', cache->size - cache->strings - offset))
+		return NULL;
+
+	return string;
+}
+
+char const * ldcache_name(struct ldcache const * cache, size_t index)
+{
+	unsigned char const * entry = cache->entries + index * cache->entry_size;
+	uint32_t key;
+
+	/* The key is at the same place in both formats. */
+	memcpy(&key, entry + offsetof(struct old_entry, key), sizeof(key));
+
+	return ldcache_string(cache, key);
+}
+
+char const * ldcache_path(struct ldcache const * cache, size_t index)
+{
+	unsigned char const * entry = cache->entries + index * cache->entry_size;
+	uint32_t value;
+
+	/* The value is at the same place in both formats. */
+	memcpy(&value, entry + offsetof(struct old_entry, value), sizeof(value));
+
+	return ldcache_string(cache, value);
+}
+
+void ldcache_close(struct ldcache * cache)
+{
+	if (cache->map)
+		munmap((void *)cache->map, cache->size);
+
+	memset(cache, 0, sizeof(*cache));
+}
@@ -19,6 +19,10 @@
 #include <string.h>
 #include <limits.h>
 #include <errno.h>
+#include <stdint.h>
+#include <immintrin.h>
+
+#include "levenshtein.h"
 
 /* @brief Calculate the minimum cost between the three possible operations.
  *
@@ -41,13 +45,26 @@ static int lev_minimum(int substitution, int deletion, int insertion)
 	return insertion;
 }
 
-int lev_string_dist(char const * s1, char const * s2)
+int lev_string_dist_dp(char const * s1, char const * s2)
 {
-	size_t max_size = strlen(s1) > strlen(s2) ? strlen(s1) : strlen(s2);
-	size_t min_size = strlen(s1) < strlen(s2) ? strlen(s1) : strlen(s2);
+	size_t len1 = strlen(s1);
+	size_t len2 = strlen(s2);
+	size_t max_size;
+	size_t min_size;
 	int * line1;
 	int * line2;
 
+	/* Rows follow the shorter string, columns the longer one. */
+	if (len1 > len2)
+	{
+		char const * tmp = s1;
+
+		s1 = s2;
+		s2 = tmp;
+	}
+	max_size = len1 > len2 ? len1 : len2;
+	min_size = len1 < len2 ? len1 : len2;
+
 	line1 = (int *)malloc((max_size + 1) * sizeof(int));
 	if (!line1)
 		return -ENOMEM;
@@ -99,11 +116,841 @@ int lev_string_dist(char const * s1, char const * s2)
 	return ret_val;
 }
 
-double lev_dist_percent(int lev_dist, char const * s1, char const * s2)
+/* @brief Fill the match vectors of a pattern of at most 64 characters.
+ *
+ * Only the entries of the characters of the pattern and of the text are
+ * reset, which is much cheaper than clearing the whole table for a single
+ * comparison.
+ */
+static void lev_peq_word(uint64_t * peq, unsigned char const * p, size_t m,
+		unsigned char const * t, size_t n)
+{
+	for (size_t i = 0; i < m; ++i)
+		peq[p[i]] = 0;
+	for (size_t i = 0; i < n; ++i)
+		peq[t[i]] = 0;
+	for (size_t i = 0; i < m; ++i)
+		peq[p[i]] |= (uint64_t)1 << i;
+}
+
+/* @brief Bit-parallel distance for a pattern of at most 64 characters.
+ *
+ * Myers' algorithm, in the formulation given by Hyyrö: the vertical deltas of
+ * a whole DP column are kept as two bit vectors (Pv for +1, Mv for -1) and
+ * every text character updates the column with a handful of word operations.
+ * Only the score of the last row is tracked. It moves by at most one per
+ * column, so once it is further above max than there are columns left, the
+ * bound can no longer be met.
+ *
+ * @param peq The match vectors of the pattern, indexed by character.
+ * @param m The length of the pattern, between 1 and 64.
+ * @param t The text.
+ * @param n The length of the text.
+ * @param max The largest distance of interest.
+ * @return The distance, or LEV_EXCEEDS_BOUND if it is larger than max.
+ */
+static int lev_myers_word(uint64_t const * peq, size_t m,
+		unsigned char const * t, size_t n, int max)
+{
+	uint64_t last = (uint64_t)1 << (m - 1);
+	uint64_t pv = ~(uint64_t)0;
+	uint64_t mv = 0;
+	int score = (int)m;
+
+	for (size_t j = 0; j < n; ++j)
+	{
+		uint64_t eq = peq[t[j]];
+		uint64_t xv = eq | mv;
+		uint64_t xh = (((eq & pv) + pv) ^ pv) | eq;
+		uint64_t ph = mv | ~(xh | pv);
+		uint64_t mh = pv & xh;
+
+		if (ph & last)
+			score++;
+		else if (mh & last)
+			score--;
+
+		if ((size_t)score > (size_t)max + (n - j - 1))
+			return LEV_EXCEEDS_BOUND;
+
+		/* The first row of the matrix grows by one at every column. */
+		ph = (ph << 1) | 1;
+		mh <<= 1;
+		pv = mh | ~(xv | ph);
+		mv = ph & xv;
+	}
+
+	return score <= max ? score : LEV_EXCEEDS_BOUND;
+}
+
+/* @brief Bit-parallel distance for patterns longer than a machine word.
+ *
+ * The column is cut in blocks of 64 rows, and each block passes its
+ * horizontal delta on to the next one (Hyyrö's blocked variant).
+ *
+ * @param peq The match vectors of the pattern, blocks entries per character.
+ * @param blocks The number of 64-bit blocks of the pattern.
+ * @param m The length of the pattern.
+ * @param t The text.
+ * @param n The length of the text.
+ * @param vp Scratch space for 2 * blocks words.
+ * @return The distance.
+ */
+static int lev_myers_blocks(uint64_t const * peq, size_t blocks, size_t m,
+		unsigned char const * t, size_t n, uint64_t * vp)
+{
+	uint64_t last = (uint64_t)1 << ((m - 1) % LEV_WORD_BITS);
+	uint64_t * pv = vp;
+	uint64_t * mv = vp + blocks;
+	int score = (int)m;
+
+	for (size_t b = 0; b < blocks; ++b)
+	{
+		pv[b] = ~(uint64_t)0;
+		mv[b] = 0;
+	}
+
+	for (size_t j = 0; j < n; ++j)
+	{
+		uint64_t const * eqs = peq + t[j] * blocks;
+		int hin = 1;
+
+		for (size_t b = 0; b < blocks; ++b)
+		{
+			uint64_t eq = eqs[b];
+			uint64_t xv = eq | mv[b];
+			uint64_t top = b == blocks - 1 ? last :
+				(uint64_t)1 << (LEV_WORD_BITS - 1);
+			uint64_t xh;
+			uint64_t ph;
+			uint64_t mh;
+			int hout;
+
+			if (hin < 0)
+				eq |= 1;
+
+			xh = (((eq & pv[b]) + pv[b]) ^ pv[b]) | eq;
+			ph = mv[b] | ~(xh | pv[b]);
+			mh = pv[b] & xh;
+
+			hout = (ph & top) ? 1 : (mh & top) ? -1 : 0;
+
+			ph <<= 1;
+			mh <<= 1;
+			if (hin < 0)
+				mh |= 1;
+			else if (hin > 0)
+				ph |= 1;
+
+			pv[b] = mh | ~(xv | ph);
+			mv[b] = ph & xv;
+			hin = hout;
+		}
+
+		score += hin;
+	}
+
+	return score;
+}
+
+/* @brief Banded DP distance with a cut-off (Ukkonen).
+ *
+ * Only the cells at most max away from the diagonal can lead to a distance
+ * within the bound, so each row is restricted to that band. A row is
+ * abandoned as soon as none of its cells, plus the edits still needed to
+ * reach the last diagonal, stays within the bound. Cells are clamped to
+ * max + 1, which lets them fit in 16 bits.
+ *
+ * @param s1 The first string, of length m.
+ * @param s2 The second string, of length n, with |m - n| <= max.
+ * @param max The largest distance of interest, below UINT16_MAX - 1.
+ * @param rows Scratch space for 2 * (n + 1) cells.
+ * @return The distance, or LEV_EXCEEDS_BOUND if it is larger than max.
+ */
+static int lev_banded(unsigned char const * s1, size_t m,
+		unsigned char const * s2, size_t n, int max, uint16_t * rows)
+{
+	size_t k = (size_t)max;
+	uint16_t inf = (uint16_t)(max + 1);
+	uint16_t * prev = rows;
+	uint16_t * cur = rows + n + 1;
+
+	for (size_t j = 0; j <= n; ++j)
+		prev[j] = j <= k ? (uint16_t)j : inf;
+
+	for (size_t i = 1; i <= m; ++i)
+	{
+		size_t lo = i > k ? i - k : 1;
+		size_t hi = i + k < n ? i + k : n;
+		uint16_t * tmp;
+		size_t best = inf;
+
+		cur[lo - 1] = lo == 1 && i <= k ? (uint16_t)i : inf;
+		if (hi < n)
+			cur[hi + 1] = inf;
+
+		/* The path may still run down the first column. */
+		if (lo == 1 && i <= k)
+			best = i + (n > m - i ? n - (m - i) : m - i - n);
+
+		for (size_t j = lo; j <= hi; ++j)
+		{
+			uint16_t cost = (uint16_t)(prev[j - 1] +
+					(s1[i - 1] != s2[j - 1]));
+			size_t left = n - j;
+			size_t down = m - i;
+			size_t gap = left > down ? left - down : down - left;
+
+			if (prev[j] < cost)
+				cost = (uint16_t)(prev[j] + 1);
+			if (cur[j - 1] < cost)
+				cost = (uint16_t)(cur[j - 1] + 1);
+			if (cost > inf)
+				cost = inf;
+
+			cur[j] = cost;
+			if (cost + gap < best)
+				best = cost + gap;
+		}
+
+		if (best > k)
+			return LEV_EXCEEDS_BOUND;
+
+		tmp = prev;
+		prev = cur;
+		cur = tmp;
+	}
+
+	return prev[n] <= max ? prev[n] : LEV_EXCEEDS_BOUND;
+}
+
+int lev_string_dist(char const * s1, char const * s2)
+{
+	size_t len1 = strlen(s1);
+	size_t len2 = strlen(s2);
+	unsigned char const * p;
+	unsigned char const * t;
+	uint64_t * peq;
+	size_t blocks;
+	int ret;
+
+	/* The distance is symmetric, use the shorter string as the pattern
+	 * so that it fits in a single word as often as possible. */
+	if (len1 > len2)
+	{
+		char const * tmp = s1;
+		size_t tmp_len = len1;
+
+		s1 = s2;
+		len1 = len2;
+		s2 = tmp;
+		len2 = tmp_len;
+	}
+	p = (unsigned char const *)s1;
+	t = (unsigned char const *)s2;
+
+	if (len1 == 0)
+		return (int)len2;
+
+	if (len1 <= LEV_WORD_BITS)
+	{
+		uint64_t word_peq[UCHAR_MAX + 1];
+
+		lev_peq_word(word_peq, p, len1, t, len2);
+		return lev_myers_word(word_peq, len1, t, len2, INT_MAX);
+	}
+
+	blocks = (len1 + LEV_WORD_BITS - 1) / LEV_WORD_BITS;
+	peq = calloc((UCHAR_MAX + 1 + 2) * blocks, sizeof(*peq));
+	if (!peq)
+		return -ENOMEM;
+
+	for (size_t i = 0; i < len1; ++i)
+		peq[p[i] * blocks + i / LEV_WORD_BITS] |=
+			(uint64_t)1 << (i % LEV_WORD_BITS);
+
+	ret = lev_myers_blocks(peq, blocks, len1, t, len2,
+			peq + (UCHAR_MAX + 1) * blocks);
+	free(peq);
+
+	return ret;
+}
+
+int lev_string_dist_bounded(char const * s1, char const * s2, int max)
+{
+	size_t len1 = strlen(s1);
+	size_t len2 = strlen(s2);
+	uint16_t * rows;
+	int ret;
+
+	if (max < 0)
+		return LEV_EXCEEDS_BOUND;
+
+	if (len1 > len2)
+	{
+		char const * tmp = s1;
+		size_t tmp_len = len1;
+
+		s1 = s2;
+		len1 = len2;
+		s2 = tmp;
+		len2 = tmp_len;
+	}
+
+	/* Every extra character of the longer string costs an insertion. */
+	if (len2 - len1 > (size_t)max)
+		return LEV_EXCEEDS_BOUND;
+
+	if (len1 == 0)
+		return (int)len2;
+
+	if (len1 <= LEV_WORD_BITS)
+	{
+		uint64_t peq[UCHAR_MAX + 1];
+
+		lev_peq_word(peq, (unsigned char const *)s1, len1,
+				(unsigned char const *)s2, len2);
+		return lev_myers_word(peq, len1, (unsigned char const *)s2,
+				len2, max);
+	}
+
+	if (max >= UINT16_MAX - 1)
+	{
+		ret = lev_string_dist(s1, s2);
+		return ret <= max ? ret : LEV_EXCEEDS_BOUND;
+	}
+
+	rows = malloc(2 * (len2 + 1) * sizeof(*rows));
+	if (!rows)
+		return -ENOMEM;
+
+	ret = lev_banded((unsigned char const *)s1, len1,
+			(unsigned char const *)s2, len2, max, rows);
+	free(rows);
+
+	return ret;
+}
+
+int lev_max_edits(double min_percent, size_t len1, size_t len2)
+{
+	size_t max_len = len1 > len2 ? len1 : len2;
+	double edits;
+	int max;
+
+	if (!max_len)
+		return 0;
+
+	/* Start from the closed form and settle on the exact integer with the
+	 * formula of lev_dist_percent, so both always agree. */
+	edits = (1 - min_percent / 100) * (double)max_len;
+	if (edits < 0)
+		return -1;
+	if (edits > (double)max_len)
+		return (int)max_len;
+
+	max = (int)edits;
+	while (max >= 0 && (1 - (double)max / (double)max_len) * 100 <
+			min_percent)
+		max--;
+	while (max < (int)max_len &&
+			(1 - (double)(max + 1) / (double)max_len) * 100 >=
+			min_percent)
+		max++;
+
+	return max;
+}
+
+/* The batch kernels below score one needle against a vector of strings at
+ * once, one string per 16-bit lane. They walk the strings position by
+ * position and keep a whole DP column of the needle in vectors. The result
+ * of a lane is picked from the last row when the column index reaches the
+ * length of its string. Saturating additions keep the cells from wrapping.
+ *
+ * Every lane has a bound. The cells of a path never decrease, so once the
+ * smallest cell of a column exceeds it the lane is retired with UINT16_MAX,
+ * and the batch stops as soon as no lane is left. A bound of UINT16_MAX
+ * never retires a lane.
+ */
+
+__attribute__((target("sse4.1")))
+static void lev_batch_sse41(uint16_t const * needle, size_t m,
+		uint16_t const * chars, uint16_t const * lens,
+		uint16_t const * bounds, size_t max_len, void * buffer,
+		uint16_t * out)
+{
+	__m128i * col = buffer;
+	__m128i zero = _mm_setzero_si128();
+	__m128i one = _mm_set1_epi16(1);
+	__m128i len = _mm_loadu_si128((__m128i const *)lens);
+	__m128i bound = _mm_loadu_si128((__m128i const *)bounds);
+	__m128i res = _mm_set1_epi16((short)m);
+	__m128i live = _mm_andnot_si128(_mm_cmpeq_epi16(len, zero),
+			_mm_set1_epi16(-1));
+
+	for (size_t i = 0; i <= m; ++i)
+		col[i] = _mm_set1_epi16((short)i);
+
+	for (size_t j = 0; j < max_len; ++j)
+	{
+		__m128i c = _mm_loadu_si128((__m128i const *)(chars + j * 8));
+		__m128i diag = col[0];
+		__m128i low;
+		__m128i done;
+		__m128i over;
+
+		col[0] = _mm_set1_epi16((short)(j + 1));
+		low = col[0];
+		for (size_t i = 1; i <= m; ++i)
+		{
+			__m128i up = col[i];
+			__m128i eq = _mm_cmpeq_epi16(c,
+					_mm_set1_epi16((short)needle[i - 1]));
+			__m128i v = _mm_adds_epu16(diag, _mm_andnot_si128(eq, one));
+
+			v = _mm_min_epu16(v, _mm_adds_epu16(up, one));
+			v = _mm_min_epu16(v, _mm_adds_epu16(col[i - 1], one));
+			low = _mm_min_epu16(low, v);
+			diag = up;
+			col[i] = v;
+		}
+
+		done = _mm_cmpeq_epi16(len, _mm_set1_epi16((short)(j + 1)));
+		res = _mm_blendv_epi8(res, col[m], done);
+
+		over = _mm_cmpeq_epi16(_mm_subs_epu16(low, bound), zero);
+		over = _mm_andnot_si128(_mm_or_si128(over, done), live);
+		res = _mm_or_si128(res, over);
+		live = _mm_andnot_si128(_mm_or_si128(done, over), live);
+		if (!_mm_movemask_epi8(live))
+			break;
+	}
+
+	_mm_storeu_si128((__m128i *)out, res);
+}
+
+__attribute__((target("avx2")))
+static void lev_batch_avx2(uint16_t const * needle, size_t m,
+		uint16_t const * chars, uint16_t const * lens,
+		uint16_t const * bounds, size_t max_len, void * buffer,
+		uint16_t * out)
+{
+	__m256i * col = buffer;
+	__m256i zero = _mm256_setzero_si256();
+	__m256i one = _mm256_set1_epi16(1);
+	__m256i len = _mm256_loadu_si256((__m256i const *)lens);
+	__m256i bound = _mm256_loadu_si256((__m256i const *)bounds);
+	__m256i res = _mm256_set1_epi16((short)m);
+	__m256i live = _mm256_andnot_si256(_mm256_cmpeq_epi16(len, zero),
+			_mm256_set1_epi16(-1));
+
+	for (size_t i = 0; i <= m; ++i)
+		col[i] = _mm256_set1_epi16((short)i);
+
+	for (size_t j = 0; j < max_len; ++j)
+	{
+		__m256i c = _mm256_loadu_si256(
+				(__m256i const *)(chars + j * 16));
+		__m256i diag = col[0];
+		__m256i low;
+		__m256i done;
+		__m256i over;
+
+		col[0] = _mm256_set1_epi16((short)(j + 1));
+		low = col[0];
+		for (size_t i = 1; i <= m; ++i)
+		{
+			__m256i up = col[i];
+			__m256i eq = _mm256_cmpeq_epi16(c,
+					_mm256_set1_epi16((short)needle[i - 1]));
+			__m256i v = _mm256_adds_epu16(diag,
+					_mm256_andnot_si256(eq, one));
+
+			v = _mm256_min_epu16(v, _mm256_adds_epu16(up, one));
+			v = _mm256_min_epu16(v, _mm256_adds_epu16(col[i - 1], one));
+			low = _mm256_min_epu16(low, v);
+			diag = up;
+			col[i] = v;
+		}
+
+		done = _mm256_cmpeq_epi16(len,
+				_mm256_set1_epi16((short)(j + 1)));
+		res = _mm256_blendv_epi8(res, col[m], done);
+
+		over = _mm256_cmpeq_epi16(_mm256_subs_epu16(low, bound), zero);
+		over = _mm256_andnot_si256(_mm256_or_si256(over, done), live);
+		res = _mm256_or_si256(res, over);
+		live = _mm256_andnot_si256(_mm256_or_si256(done, over), live);
+		if (!_mm256_movemask_epi8(live))
+			break;
+	}
+
+	_mm256_storeu_si256((__m256i *)out, res);
+}
+
+__attribute__((target("avx512bw")))
+static void lev_batch_avx512(uint16_t const * needle, size_t m,
+		uint16_t const * chars, uint16_t const * lens,
+		uint16_t const * bounds, size_t max_len, void * buffer,
+		uint16_t * out)
+{
+	__m512i * col = buffer;
+	__m512i one = _mm512_set1_epi16(1);
+	__m512i len = _mm512_loadu_si512(lens);
+	__m512i bound = _mm512_loadu_si512(bounds);
+	__m512i res = _mm512_set1_epi16((short)m);
+	__mmask32 live = _mm512_cmpneq_epi16_mask(len,
+			_mm512_setzero_si512());
+
+	for (size_t i = 0; i <= m; ++i)
+		col[i] = _mm512_set1_epi16((short)i);
+
+	for (size_t j = 0; j < max_len; ++j)
+	{
+		__m512i c = _mm512_loadu_si512(chars + j * 32);
+		__m512i diag = col[0];
+		__m512i low;
+		__mmask32 done;
+		__mmask32 over;
+
+		col[0] = _mm512_set1_epi16((short)(j + 1));
+		low = col[0];
+		for (size_t i = 1; i <= m; ++i)
+		{
+			__m512i up = col[i];
+			__mmask32 eq = _mm512_cmpeq_epi16_mask(c,
+					_mm512_set1_epi16((short)needle[i - 1]));
+			__m512i v = _mm512_mask_adds_epu16(diag, ~eq, diag, one);
+
+			v = _mm512_min_epu16(v, _mm512_adds_epu16(up, one));
+			v = _mm512_min_epu16(v, _mm512_adds_epu16(col[i - 1], one));
+			low = _mm512_min_epu16(low, v);
+			diag = up;
+			col[i] = v;
+		}
+
+		done = _mm512_cmpeq_epi16_mask(len,
+				_mm512_set1_epi16((short)(j + 1)));
+		res = _mm512_mask_mov_epi16(res, done, col[m]);
+
+		over = _mm512_mask_cmpgt_epu16_mask(live & ~done, low, bound);
+		res = _mm512_mask_mov_epi16(res, over, _mm512_set1_epi16(-1));
+		live &= ~(done | over);
+		if (!live)
+			break;
+	}
+
+	_mm512_storeu_si512(out, res);
+}
+
+enum lev_isa lev_batch_isa(void)
+{
+	if (__builtin_cpu_supports("avx512bw"))
+		return LEV_ISA_AVX512;
+	if (__builtin_cpu_supports("avx2"))
+		return LEV_ISA_AVX2;
+	if (__builtin_cpu_supports("sse4.1"))
+		return LEV_ISA_SSE41;
+	return LEV_ISA_SCALAR;
+}
+
+size_t lev_isa_width(enum lev_isa isa)
+{
+	switch (isa)
+	{
+		case LEV_ISA_AVX512:
+			return 32;
+		case LEV_ISA_AVX2:
+			return 16;
+		case LEV_ISA_SSE41:
+			return 8;
+		default:
+			return 1;
+	}
+}
+
+/* @brief Make sure a scratch buffer holds at least size bytes.
+ *
+ * Buffers only grow, so that a context reaches its steady state after a few
+ * strings and stops allocating.
+ */
+static int lev_reserve(void ** buffer, size_t * capacity, size_t size)
+{
+	void * tmp;
+
+	if (size <= *capacity)
+		return 0;
+
+	if (size < *capacity * 2)
+		size = *capacity * 2;
+
+	tmp = realloc(*buffer, size);
+	if (!tmp)
+		return -ENOMEM;
+
+	*buffer = tmp;
+	*capacity = size;
+
+	return 0;
+}
+
+int lev_ctx_init(struct lev_ctx * ctx, char const * needle)
+{
+	unsigned char const * p = (unsigned char const *)needle;
+	size_t m = strlen(needle);
+
+	memset(ctx, 0, sizeof(*ctx));
+	ctx->needle = needle;
+	ctx->needle_len = m;
+	ctx->blocks = m ? (m + LEV_WORD_BITS - 1) / LEV_WORD_BITS : 1;
+	ctx->isa = lev_batch_isa();
+
+	ctx->peq = calloc((UCHAR_MAX + 1) * ctx->blocks, sizeof(*ctx->peq));
+	ctx->vp = malloc(2 * ctx->blocks * sizeof(*ctx->vp));
+	ctx->pattern = malloc((m + 1) * sizeof(*ctx->pattern));
+	ctx->columns = aligned_alloc(64, (m + 1) * 64);
+	if (!ctx->peq || !ctx->vp || !ctx->pattern || !ctx->columns)
+	{
+		lev_ctx_free(ctx);
+		return -ENOMEM;
+	}
+
+	for (size_t i = 0; i < m; ++i)
+	{
+		ctx->peq[p[i] * ctx->blocks + i / LEV_WORD_BITS] |=
+			(uint64_t)1 << (i % LEV_WORD_BITS);
+		ctx->pattern[i] = p[i];
+	}
+
+	return 0;
+}
+
+void lev_ctx_free(struct lev_ctx * ctx)
 {
-	size_t max_len;
+	free(ctx->peq);
+	free(ctx->vp);
+	free(ctx->pattern);
+	free(ctx->columns);
+	free(ctx->chars);
+	free(ctx->rows);
+	memset(ctx, 0, sizeof(*ctx));
+}
 
-	max_len = (strlen(s1) > strlen(s2)) ? strlen(s1) : strlen(s2);
+int lev_ctx_dist(struct lev_ctx * ctx, char const * str, size_t len)
+{
+	unsigned char const * t = (unsigned char const *)str;
+
+	if (ctx->needle_len == 0)
+		return (int)len;
+
+	if (ctx->needle_len <= LEV_WORD_BITS)
+		return lev_myers_word(ctx->peq, ctx->needle_len, t, len,
+				INT_MAX);
+
+	return lev_myers_blocks(ctx->peq, ctx->blocks, ctx->needle_len, t,
+			len, ctx->vp);
+}
+
+int lev_ctx_dist_bounded(struct lev_ctx * ctx, char const * str, size_t len,
+		int max)
+{
+	size_t m = ctx->needle_len;
+	size_t diff = len > m ? len - m : m - len;
+	int ret;
+
+	if (max < 0 || diff > (size_t)max)
+		return LEV_EXCEEDS_BOUND;
+
+	if (m == 0)
+		return (int)len;
+
+	if (m <= LEV_WORD_BITS)
+		return lev_myers_word(ctx->peq, m,
+				(unsigned char const *)str, len, max);
+
+	if (max >= UINT16_MAX - 1 || len == 0)
+	{
+		ret = lev_ctx_dist(ctx, str, len);
+		return ret <= max ? ret : LEV_EXCEEDS_BOUND;
+	}
+
+	ret = lev_reserve((void **)&ctx->rows, &ctx->rows_capacity,
+			2 * (len + 1) * sizeof(*ctx->rows));
+	if (ret < 0)
+		return ret;
+
+	return lev_banded((unsigned char const *)ctx->needle, m,
+			(unsigned char const *)str, len, max, ctx->rows);
+}
+
+/* @brief Gather the characters of a batch, one row per string position.
+ *
+ * Row j holds the j-th character of every string of the batch, so that a
+ * vector load reads the same position of all the lanes. Strings shorter than
+ * the longest one are padded with zeros, which are never read back.
+ *
+ * @return The length of the longest string, or -ENOMEM.
+ */
+static int64_t lev_batch_transpose(struct lev_ctx * ctx,
+		char const * const * strs, size_t const * lens, size_t count,
+		size_t lanes, uint16_t * lane_lens)
+{
+	size_t max_len = 0;
+
+	for (size_t l = 0; l < lanes; ++l)
+	{
+		lane_lens[l] = l < count ? (uint16_t)lens[l] : 0;
+		if (lane_lens[l] > max_len)
+			max_len = lane_lens[l];
+	}
+
+	if (lev_reserve((void **)&ctx->chars, &ctx->chars_capacity,
+				max_len * lanes * sizeof(*ctx->chars)) < 0)
+		return -ENOMEM;
+
+	memset(ctx->chars, 0, max_len * lanes * sizeof(*ctx->chars));
+	for (size_t l = 0; l < count; ++l)
+	{
+		for (size_t j = 0; j < lens[l]; ++j)
+			ctx->chars[j * lanes + l] = (unsigned char)strs[l][j];
+	}
+
+	return (int64_t)max_len;
+}
+
+/* @brief Score strings with the batch kernel of a context, each with its own
+ * bound, or none when maxes is NULL. */
+static int lev_ctx_batch_run(struct lev_ctx * ctx, char const * const * strs,
+		size_t const * lens, size_t count, int const * maxes,
+		int * dists)
+{
+	size_t lanes = lev_isa_width(ctx->isa);
+	size_t m = ctx->needle_len;
+	uint16_t lane_lens[LEV_BATCH_MAX];
+	uint16_t bounds[LEV_BATCH_MAX];
+	uint16_t res[LEV_BATCH_MAX];
+
+	for (size_t first = 0; first < count; first += lanes)
+	{
+		size_t nb = count - first < lanes ? count - first : lanes;
+		int scalar = ctx->isa == LEV_ISA_SCALAR || m >= UINT16_MAX;
+		int64_t max_len;
+
+		/* Cells are 16 bits wide, longer strings go through the
+		 * scalar path. */
+		for (size_t l = 0; l < nb; ++l)
+			scalar |= lens[first + l] >= UINT16_MAX;
+
+		if (scalar)
+		{
+			for (size_t l = 0; l < nb; ++l)
+			{
+				size_t k = first + l;
+
+				dists[k] = maxes ? lev_ctx_dist_bounded(ctx,
+						strs[k], lens[k], maxes[k]) :
+					lev_ctx_dist(ctx, strs[k], lens[k]);
+				if (dists[k] < 0)
+					return dists[k];
+			}
+			continue;
+		}
+
+		for (size_t l = 0; l < lanes; ++l)
+		{
+			int max = maxes && l < nb ? maxes[first + l] : INT_MAX;
+
+			bounds[l] = max < 0 ? 0 : max >= UINT16_MAX ?
+				UINT16_MAX : (uint16_t)max;
+		}
+
+		max_len = lev_batch_transpose(ctx, strs + first, lens + first,
+				nb, lanes, lane_lens);
+		if (max_len < 0)
+			return (int)max_len;
+
+		if (ctx->isa == LEV_ISA_AVX512)
+			lev_batch_avx512(ctx->pattern, m, ctx->chars, lane_lens,
+					bounds, (size_t)max_len, ctx->columns,
+					res);
+		else if (ctx->isa == LEV_ISA_AVX2)
+			lev_batch_avx2(ctx->pattern, m, ctx->chars, lane_lens,
+					bounds, (size_t)max_len, ctx->columns,
+					res);
+		else
+			lev_batch_sse41(ctx->pattern, m, ctx->chars, lane_lens,
+					bounds, (size_t)max_len, ctx->columns,
+					res);
+
+		for (size_t l = 0; l < nb; ++l)
+		{
+			size_t k = first + l;
+
+			dists[k] = res[l];
+			if (maxes && (maxes[k] < 0 || res[l] > maxes[k]))
+				dists[k] = LEV_EXCEEDS_BOUND;
+		}
+	}
+
+	return 0;
+}
+
+int lev_ctx_batch(struct lev_ctx * ctx, char const * const * strs,
+		size_t const * lens, size_t count, int * dists)
+{
+	return lev_ctx_batch_run(ctx, strs, lens, count, NULL, dists);
+}
+
+int lev_ctx_batch_bounded(struct lev_ctx * ctx, char const * const * strs,
+		size_t const * lens, size_t count, int const * maxes,
+		int * dists)
+{
+	return lev_ctx_batch_run(ctx, strs, lens, count, maxes, dists);
+}
+
+int lev_batch_dist_isa(enum lev_isa isa, char const * needle,
+		char const * const * strs, size_t count, int * dists)
+{
+	struct lev_ctx ctx;
+	size_t * lens;
+	int ret;
+
+	lens = malloc((count + 1) * sizeof(*lens));
+	if (!lens)
+		return -ENOMEM;
+
+	for (size_t i = 0; i < count; ++i)
+		lens[i] = strlen(strs[i]);
+
+	ret = lev_ctx_init(&ctx, needle);
+	if (ret < 0)
+	{
+		free(lens);
+		return ret;
+	}
+
+	ctx.isa = isa;
+	ret = lev_ctx_batch(&ctx, strs, lens, count, dists);
+
+	lev_ctx_free(&ctx);
+	free(lens);
+
+	return ret;
+}
+
+int lev_batch_dist(char const * needle, char const * const * strs,
+		size_t count, int * dists)
+{
+	return lev_batch_dist_isa(lev_batch_isa(), needle, strs, count, dists);
+}
+
+double lev_len_percent(int lev_dist, size_t len1, size_t len2)
+{
+	size_t max_len = len1 > len2 ? len1 : len2;
 
 	return (1 - ((double)lev_dist / (double)max_len)) * 100;
 }
+
+double lev_dist_percent(int lev_dist, char const * s1, char const * s2)
+{
+	return lev_len_percent(lev_dist, strlen(s1), strlen(s2));
+}
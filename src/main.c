@@ -27,20 +27,104 @@
 #include <sys/stat.h>
 
 #include "common.h"
-#include "pipe.h"
-#include "child.h"
-#include "parent.h"
+#include "cache.h"
+#include "index.h"
+#include "deps.h"
+#include "ldcache.h"
+#include "pool.h"
+#include "scan.h"
+#include "serve.h"
+#include "stats.h"
+#include "store.h"
+#include "symspell.h"
+#include "watch.h"
+#include "topk.h"
+#include "uring.h"
+#include "walk.h"
 
 static void usage(void)
 {
 	printf(
 		"Usage: moses [options] [needle] [haystack]\n"
+		"       moses [options] --needles FILE [haystack]\n"
+		"       moses [options] --serve SOCKET [haystack]\n"
+		"       moses [options] --connect SOCKET [needle]\n"
+		"       find ... | moses [options] --from-stdin [needle]\n"
+		"       moses [options] --system [needle]\n"
+		"       moses [options] --deps BINARY [needle]\n"
 		"Search for the symbol needle into haystack (a file or a folder).\n"
 		"  -h  --help         display this help message and exit.\n"
 		"  -v  --version      output version information and exit.\n"
 		"  -l  --verbose      display additional informations.\n"
 		"  -d  --min_distance the minimum distance to needle for a "
-			"string to be a match.\n");
+			"string to be a match.\n"
+		"  -n  --nm           list symbols with nm(1) instead of reading "
+			"the ELF files directly.\n"
+		"  -j  --jobs         number of threads scanning the haystacks "
+			"in parallel.\n"
+		"  -i  --index        read and update the symbol index stored in "
+			"this file.\n"
+		"  -b  --build-index  only build the index, every argument is a "
+			"haystack.\n"
+		"  -t  --top          only print the K best matches, best first. "
+			"The minimum\n"
+		"                     distance is 0 unless given.\n"
+		"  -N  --needles      search every needle listed in this file, "
+			"one per line,\n"
+		"                     '-' for the standard input.\n"
+		"  -S  --serve        keep the symbols of haystack in memory and "
+			"answer the\n"
+		"                     queries sent to this Unix socket.\n"
+		"  -B  --bk-tree      with -S, also build a BK-tree to answer the "
+			"queries\n"
+		"                     allowing few edits.\n"
+		"  -k  --symspell     with -S, also index the deletions of up to "
+			"K characters\n"
+		"                     of the short names, to answer the queries "
+			"allowing at most\n"
+		"                     K edits.\n"
+		"  -c  --connect      send the query to the server listening on "
+			"this socket.\n"
+		"  -w  --watch        after the first scan, print the matches "
+			"gained (+) and\n"
+		"                     lost (-) as libraries change, until "
+			"interrupted.\n"
+		"  -s  --stats        print the time of each phase and counters "
+			"of the scan to\n"
+		"                     the standard error, as JSON with "
+			"-s=json or\n"
+		"                     --stats=json.\n"
+		"  -u  --io-uring     load the ELF files in batches with io_uring, "
+			"many reads in\n"
+		"                     flight at once.\n"
+		"  -D  --defined-only only search the symbols the haystacks "
+			"define.\n"
+		"  -y  --type         only search the symbols of these types: "
+			"notype, object,\n"
+		"                     func, section, file, common, tls, ifunc. "
+			"With -n, the type\n"
+		"                     is guessed from the letter nm gives.\n"
+		"  -g  --binding      only search the symbols of these bindings: "
+			"local, global,\n"
+		"                     weak, unique.\n"
+		"  -V  --visibility   only search the symbols of these "
+			"visibilities: default,\n"
+		"                     internal, hidden, protected. Not with -n.\n"
+		"  -e  --symbol-version only search the symbols of this version, "
+			"such as\n"
+		"                     GLIBC_2.34.\n"
+		"  -I  --from-stdin   also search the haystacks listed on the "
+			"standard input,\n"
+		"                     one per line, as they arrive.\n"
+		"  -0  --null         with -I, the haystacks are separated by NUL "
+			"characters,\n"
+		"                     as printed by find -print0.\n"
+		"  -L  --system       also search every library the dynamic "
+			"loader knows of,\n"
+		"                     as listed in " LDCACHE_PATH ".\n"
+		"  -r  --deps         also search this binary and the libraries "
+			"it needs,\n"
+		"                     resolved as the dynamic loader does.\n");
 }
 
 static void version(void)
@@ -54,19 +138,112 @@ static void version(void)
 		"This program comes with ABSOLUTELY NO WARRANTY.\n");
 }
 
+/* @brief Load the needles listed in a file, one per line.
+ *
+ * @param args The arguments of the program.
+ * @param path The path of the file, '-' for the standard input.
+ * @return 0 on success, less than 0 otherwise.
+ */
+static int read_needles(struct args * args, char const * path)
+{
+	FILE * file = strcmp(path, "-") ? fopen(path, "r") : stdin;
+	size_t capacity = 0;
+	char * line = NULL;
+	size_t size = 0;
+	ssize_t len;
+	int ret = 0;
+
+	if (!file)
+	{
+		printf("Error: failed to open file %s: %s\n", path,
+			strerror(errno));
+		return -errno;
+	}
+
+	while ((len = getline(&line, &size, file)) >= 0)
+	{
+		while (len && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+			line[--len] = '\0';
+		if (!len)
+			continue;
+
+		if (args->needle_nb == capacity)
+		{
+			size_t new_capacity = capacity ? capacity * 2 : 16;
+			char ** needles = realloc(args->needles,
+					new_capacity * sizeof(*needles));
+
+			if (!needles)
+			{
+				ret = -ENOMEM;
+				break;
+			}
+			args->needles = needles;
+			capacity = new_capacity;
+		}
+
+		args->needles[args->needle_nb] = strndup(line, (size_t)len);
+		if (!args->needles[args->needle_nb])
+		{
+			ret = -ENOMEM;
+			break;
+		}
+		args->needle_nb++;
+	}
+
+	if (!ret && ferror(file))
+		ret = -EIO;
+	if (ret < 0)
+		printf("Error: failed to read the needles from %s: %s\n",
+			path, strerror(-ret));
+	else if (!args->needle_nb)
+	{
+		printf("Error: no needle in %s.\n", path);
+		ret = -EINVAL;
+	}
+
+	free(line);
+	if (file != stdin)
+		fclose(file);
+
+	return ret;
+}
+
 static char check_arguments(int argc, char *argv[], struct args * args)
 {
 	int opt;
-	int haystack_nb = 0;
+	int min_distance_set = 0;
 	struct option long_options[] = {
 		{"help", no_argument, 0, 'h'},
 		{"version", no_argument, 0, 'v'},
 		{"verbose", no_argument, 0, 'l'},
 		{"min_distance", required_argument, 0, 'd'},
+		{"nm", no_argument, 0, 'n'},
+		{"jobs", required_argument, 0, 'j'},
+		{"index", required_argument, 0, 'i'},
+		{"build-index", no_argument, 0, 'b'},
+		{"top", required_argument, 0, 't'},
+		{"needles", required_argument, 0, 'N'},
+		{"serve", required_argument, 0, 'S'},
+		{"connect", required_argument, 0, 'c'},
+		{"bk-tree", no_argument, 0, 'B'},
+		{"symspell", required_argument, 0, 'k'},
+		{"watch", no_argument, 0, 'w'},
+		{"stats", optional_argument, 0, 's'},
+		{"io-uring", no_argument, 0, 'u'},
+		{"defined-only", no_argument, 0, 'D'},
+		{"type", required_argument, 0, 'y'},
+		{"binding", required_argument, 0, 'g'},
+		{"visibility", required_argument, 0, 'V'},
+		{"symbol-version", required_argument, 0, 'e'},
+		{"from-stdin", no_argument, 0, 'I'},
+		{"null", no_argument, 0, '0'},
+		{"system", no_argument, 0, 'L'},
+		{"deps", required_argument, 0, 'r'},
 		{0, 0, 0, 0}
 	};
 
-	while ((opt = getopt_long(argc, argv, "hvld:", long_options, NULL)) != -1) {
+	while ((opt = getopt_long(argc, argv, "hvlnbwBuDI0Ld:j:i:t:N:S:c:k:s::y:g:V:e:r:", long_options, NULL)) != -1) {
 		switch (opt) {
 		case 'v':
 			if (optind < argc) {
@@ -78,6 +255,9 @@ static char check_arguments(int argc, char *argv[], struct args * args)
 		case 'l':
 			args->verbose = 1;
 			break;
+		case 'n':
+			args->use_nm = 1;
+			break;
 		case 'd':
 			args->min_distance = atof(optarg);
 			if (args->min_distance == 0)
@@ -86,7 +266,132 @@ static char check_arguments(int argc, char *argv[], struct args * args)
 				usage();
 				return -EINVAL;
 			}
+			min_distance_set = 1;
+			break;
+		case 'j':
+		{
+			char * end = NULL;
+			unsigned long jobs = strtoul(optarg, &end, 10);
+
+			if (*end || jobs == 0 || jobs > MAX_JOBS)
+			{
+				printf("Invalid argument to 'j' option.\n");
+				usage();
+				return -EINVAL;
+			}
+			args->jobs = (unsigned)jobs;
+			break;
+		}
+		case 'i':
+			args->index_path = optarg;
+			break;
+		case 'b':
+			args->build_index = 1;
+			break;
+		case 't':
+		{
+			char * end = NULL;
+			unsigned long top = strtoul(optarg, &end, 10);
+
+			if (*end || top == 0 || top > MAX_TOP)
+			{
+				printf("Invalid argument to 't' option.\n");
+				usage();
+				return -EINVAL;
+			}
+			args->top = top;
+			break;
+		}
+		case 'N':
+			args->needles_path = optarg;
+			break;
+		case 'S':
+			args->serve_path = optarg;
+			break;
+		case 'c':
+			args->connect_path = optarg;
+			break;
+		case 'w':
+			args->watch_mode = 1;
+			break;
+		case 'B':
+			args->bktree = 1;
+			break;
+		case 'u':
+			args->io_uring = 1;
+			break;
+		case 'D':
+			args->filter.defined_only = 1;
+			args->filter.active = 1;
+			break;
+		case 'y':
+			if (filter_types(&args->filter, optarg) < 0)
+			{
+				printf("Invalid argument to 'y' option.\n");
+				usage();
+				return -EINVAL;
+			}
+			break;
+		case 'g':
+			if (filter_bindings(&args->filter, optarg) < 0)
+			{
+				printf("Invalid argument to 'g' option.\n");
+				usage();
+				return -EINVAL;
+			}
+			break;
+		case 'V':
+			if (filter_visibilities(&args->filter, optarg) < 0)
+			{
+				printf("Invalid argument to 'V' option.\n");
+				usage();
+				return -EINVAL;
+			}
+			break;
+		case 'e':
+			args->filter.version = optarg;
+			args->filter.active = 1;
+			break;
+		case 'I':
+			args->from_stdin = 1;
+			break;
+		case '0':
+			args->null_separated = 1;
+			break;
+		case 'L':
+			args->system = 1;
+			break;
+		case 'r':
+			args->deps_path = optarg;
+			break;
+		case 's':
+			/* The short option takes its argument glued, as in -sjson,
+			 * but -s=json reads like the long one: accept both. */
+			if (optarg && *optarg == '=')
+				++optarg;
+			if (optarg && strcmp(optarg, "json"))
+			{
+				printf("Invalid argument to 's' option.\n");
+				usage();
+				return -EINVAL;
+			}
+			args->print_stats = 1;
+			args->stats_json = !!optarg;
+			break;
+		case 'k':
+		{
+			char * end = NULL;
+			long edits = strtol(optarg, &end, 10);
+
+			if (*end || edits < 1 || edits > SYMSPELL_MAX_EDITS)
+			{
+				printf("Invalid argument to 'k' option.\n");
+				usage();
+				return -EINVAL;
+			}
+			args->symspell = (int)edits;
 			break;
+		}
 		case 'h':
 		case '?':
 			usage();
@@ -96,251 +401,449 @@ static char check_arguments(int argc, char *argv[], struct args * args)
 		}
 	}
 
-	while (optind < argc)
+	if (args->needles_path)
 	{
-		if (!args->needle)
-		{
-			args->needle = strndup(argv[optind],
-					strlen(argv[optind]));
-		}
-		else
+		if (read_needles(args, args->needles_path) < 0)
+			return -EINVAL;
+		args->print_needle = 1;
+	}
+
+	if (optind < argc && !args->needle_nb && !args->build_index &&
+			!args->serve_path)
+	{
+		args->needles = calloc(1, sizeof(*args->needles));
+		if (!args->needles)
+			return -ENOMEM;
+		args->needles[0] = strndup(argv[optind], strlen(argv[optind]));
+		args->needle_nb = 1;
+		optind++;
+	}
+
+	/* getopt moved the operands last, the rest of them are haystacks. */
+	args->haystacks = argv + optind;
+	args->haystack_nb = (size_t)(argc - optind);
+
+	/* The best matches are wanted however far they are from the needle. */
+	if (args->top && !min_distance_set)
+		args->min_distance = 0;
+
+	if (args->connect_path)
+	{
+		if (!args->needle_nb || args->haystack_nb ||
+				args->from_stdin || args->system ||
+				args->deps_path ||
+				args->build_index ||
+				args->serve_path ||
+				args->watch_mode || args->filter.active)
 		{
-			args->haystacks[haystack_nb++] = strndup(argv[optind],
-					strlen(argv[optind]));
+			printf("Option 'c' only takes needles.\n");
+			usage();
+			return -EINVAL;
 		}
 
-		optind++;
+		return 0;
 	}
 
-	if (!args->needle || !args->haystacks[0])
+	if (args->serve_path && (args->needles_path || args->top ||
+				args->build_index || args->index_path ||
+				args->use_nm || args->watch_mode ||
+				args->filter.active))
 	{
+		printf("Option 'S' only takes haystacks.\n");
 		usage();
 		return -EINVAL;
 	}
 
-	return 0;
-}
+	if (args->bktree && !args->serve_path)
+	{
+		printf("Option 'B' requires option 'S'.\n");
+		usage();
+		return -EINVAL;
+	}
 
-/* Strip the filename from a full file path. */
-static void get_path(char * file_path)
-{
-	size_t i = strlen(file_path);
+	if (args->symspell && !args->serve_path)
+	{
+		printf("Option 'k' requires option 'S'.\n");
+		usage();
+		return -EINVAL;
+	}
+
+	if ((!args->needle_nb && !args->build_index && !args->serve_path) ||
+			(!args->haystack_nb && !args->from_stdin && !args->system &&
+			 !args->deps_path))
+	{
+		usage();
+		return -EINVAL;
+	}
 
-	if (i <= 1 || !strncmp(file_path, "/", i))
-		return;
+	if (args->null_separated && !args->from_stdin)
+	{
+		printf("Option '0' requires option 'I'.\n");
+		usage();
+		return -EINVAL;
+	}
 
-	i -= 2;
-	while (i > 0 && file_path[i] != '/')
-		i--;
-	if (file_path[i + 1] == '/')
-		file_path[i + 1] = '\0';
+	if (args->from_stdin && args->needles_path &&
+			!strcmp(args->needles_path, "-"))
+	{
+		printf("The needles and the haystacks cannot both be read from "
+			"the standard input.\n");
+		usage();
+		return -EINVAL;
+	}
+
+	if (args->build_index && !args->index_path)
+	{
+		printf("Option 'b' requires an index file.\n");
+		usage();
+		return -EINVAL;
+	}
+
+	if (args->index_path && args->use_nm)
+	{
+		printf("The index cannot be used with nm.\n");
+		usage();
+		return -EINVAL;
+	}
+
+	if ((args->top || args->needles_path) && args->build_index)
+	{
+		printf("Options 't' and 'N' need a needle.\n");
+		usage();
+		return -EINVAL;
+	}
+
+	if (args->use_nm && args->filter.visibilities)
+	{
+		printf("nm does not tell the visibility of the symbols.\n");
+		usage();
+		return -EINVAL;
+	}
+
+	/* The batches only read the symbols and their names. */
+	if (args->io_uring && args->filter.version)
+	{
+		printf("Option 'e' cannot be used with option 'u'.\n");
+		usage();
+		return -EINVAL;
+	}
+
+	if (args->io_uring && (args->use_nm || args->index_path ||
+				args->serve_path))
+	{
+		printf("Option 'u' only reads the ELF files directly, without "
+			"nm, index or server.\n");
+		usage();
+		return -EINVAL;
+	}
+
+	if (args->watch_mode && (args->top || args->build_index))
+	{
+		printf("Option 'w' cannot print the best matches or only build "
+			"the index.\n");
+		usage();
+		return -EINVAL;
+	}
+
+	return 0;
 }
 
-static int search(struct args * args, char * file)
+/* Paths gathered for search_batch_task, each followed by a NUL character. */
+struct batch
+{
+	char * paths;
+	size_t size;
+	size_t capacity;
+	size_t count;
+};
+
+/* @brief Search the files of the batch, or queue them for the workers.
+ *
+ * @param args The arguments of the program.
+ * @param pool The workers, NULL for a serial scan.
+ * @param batch The batch, emptied.
+ * @return 0 on success, -ENOMEM on failure.
+ */
+static int flush_batch(struct args * args, struct pool * pool,
+		struct batch * batch)
 {
-	int pfds[PFD_NUMBER] = { 0 };
-	pid_t pid;
 	int ret = 0;
 
-	if (args->verbose)
-		printf("Searching in haystack: %s\n", file);
+	if (!batch->count)
+		return 0;
 
-	ret = pipe(pfds);
-	if (ret < 0)
+	/* There is always room for the empty path ending the batch. */
+	batch->paths[batch->size] = '\0';
+
+	if (!pool)
 	{
-		printf("Error: failed to create pipe: %s.\n",
-				strerror(errno));
-		return ret;
+		search_batch_task(args, 0, batch->paths);
+		free(batch->paths);
 	}
-
-	pid = fork();
-	switch (pid)
+	else if (pool_submit(pool, batch->paths) < 0)
 	{
-		case -1:
-			printf("Error: failed to create child process: %s\n",
-					strerror(errno));
-			ret = errno;
-			break;
-		case PID_CHILD: /* Child process. */
-			run_child(file, pfds, args->verbose);
-			break;
-		default: /* Parent process. */
-			ret = run_parent(args, pfds, pid, file);
-			break;
+		printf("Failed to allocate memory: %s\n", strerror(ENOMEM));
+		free(batch->paths);
+		ret = -ENOMEM;
 	}
 
+	memset(batch, 0, sizeof(*batch));
+
 	return ret;
 }
 
-/* @brief Check if a file is a shared elf object.
+/* @brief Add a file to the batch, searching the batch once it is full.
  *
- * Check the first four bytes of the file (magic numbers) to check its type.
+ * @return 0 on success, -ENOMEM on failure.
+ */
+static int batch_file(struct args * args, struct pool * pool,
+		struct batch * batch, char const * file)
+{
+	size_t length = strlen(file) + 1;
+
+	if (batch->size + length + 1 > batch->capacity)
+	{
+		size_t capacity = batch->capacity ? batch->capacity : 4096;
+		char * paths;
+
+		while (batch->size + length + 1 > capacity)
+			capacity *= 2;
+
+		paths = realloc(batch->paths, capacity);
+		if (!paths)
+		{
+			printf("Failed to allocate memory: %s\n",
+				strerror(ENOMEM));
+			return -ENOMEM;
+		}
+		batch->paths = paths;
+		batch->capacity = capacity;
+	}
+
+	memcpy(batch->paths + batch->size, file, length);
+	batch->size += length;
+
+	if (++batch->count < URING_BATCH)
+		return 0;
+
+	return flush_batch(args, pool, batch);
+}
+
+/* @brief Search a regular file of the haystacks, or queue it for the
+ * workers.
  *
- * @param file_path The path of the file to open.
- * @return 1 if the file is a shared elf object, 0 otherwise.
+ * @param args The arguments of the program.
+ * @param pool The workers, NULL for a serial scan.
+ * @param batch The files waiting to be loaded with io_uring.
+ * @param file The path of the file.
+ * @return 0 on success, less than 0 otherwise.
  */
-static int file_is_shared_elf(char * file_path)
+static int analyze_file(struct args * args, struct pool * pool,
+		struct batch * batch, char const * file)
 {
-	int res = 0;
-	char magic_numbers[4] = { 0 };
+	char * item;
 
-	FILE * file = fopen(file_path, "r");
-	if (!file)
+	if (args->io_uring)
+		return batch_file(args, pool, batch, file);
+
+	if (!pool && args->watch)
 	{
-		printf("Error: failed to open file %s: %s\n", file_path,
-			strerror(errno));
+		/* Gather the matches to record them. */
+		search_task(args, 0, (char *)file);
 		return 0;
 	}
 
-	size_t bytes_read = fread(magic_numbers, sizeof(char), 4, file);
-	if (bytes_read == 0)
+	if (!pool)
+		return search_file(args, &args->scan_ctxs[0], file, stdout);
+
+	item = strdup(file);
+	if (!item || pool_submit(pool, item) < 0)
 	{
-		int read_error = ferror(file);
-		if (read_error)
-		{
-			printf("Error: failed to read from file: %s\n",
-				file_path);
-			return 0;
-		}
+		printf("Failed to allocate memory: %s\n", strerror(ENOMEM));
+		free(item);
+		return -ENOMEM;
 	}
 
-	res = fclose(file);
-	if (res)
+	return 0;
+}
+
+/* @brief Search every file of a haystack, a regular file or a directory.
+ *
+ * @param args The arguments of the program.
+ * @param walk The walk of the haystacks.
+ * @param pool The workers, NULL for a serial scan.
+ * @param batch The files waiting to be loaded with io_uring.
+ * @param haystack The path of the haystack.
+ * @return -ENOMEM if the scan must stop, another value otherwise.
+ */
+static int scan_haystack(struct args * args, struct walk * walk,
+		struct pool * pool, struct batch * batch, char const * haystack)
+{
+	char const * file;
+	int ret;
+
+	/* Reset errno to 0. If an error occurs while calling 'stat' on
+	 * this file (for exemple because it does not exist, then errno
+	 * will be set. Then it will fail in the method read_fd which
+	 * calls getline, which uses errno to differentiate between EOF
+	 * and an actual error. */
+	errno = 0;
+
+	if (args->watch)
 	{
-		printf("Error: failed to close file %s: %s\n", file_path,
-			strerror(errno));
-		res = 0;
+		struct stat statbuff;
+
+		if (!stat(haystack, &statbuff) && S_ISREG(statbuff.st_mode) &&
+				watch_file(args->watch, haystack) < 0)
+			return -ENOMEM;
 	}
 
-	if (magic_numbers[0] == 0x7f &&
-		magic_numbers[1] == 0x45 &&
-		magic_numbers[2] == 0x4c &&
-		magic_numbers[3] == 0x46)
-		res = 1;
+	ret = walk_start(walk, haystack);
+	while (ret >= 0 && (ret = walk_next(walk, &file)) > 0)
+		ret = analyze_file(args, pool, batch, file);
 
-	return res;
+	return ret;
 }
 
-static int analyze_file(struct args * args, char * file)
+/* @brief Search the haystacks listed on the standard input.
+ *
+ * Each haystack is searched as soon as it is read, while the producer
+ * carries on. Only one path is held at a time, and the pool bounds the files
+ * waiting for the workers, so memory does not grow with the list.
+ *
+ * @param args The arguments of the program.
+ * @param walk The walk of the haystacks.
+ * @param pool The workers, NULL for a serial scan.
+ * @param batch The files waiting to be loaded with io_uring.
+ * @return -ENOMEM if the scan must stop, another value otherwise.
+ */
+static int scan_stdin(struct args * args, struct walk * walk,
+		struct pool * pool, struct batch * batch)
 {
+	int delimiter = args->null_separated ? '\0' : '\n';
+	char * line = NULL;
+	size_t size = 0;
+	ssize_t len;
 	int ret = 0;
-	struct stat statbuff;
 
-	if (!strcmp(file, ".") || !strcmp(file, ".."))
-		return 0;
+	while (ret != -ENOMEM &&
+			(len = getdelim(&line, &size, delimiter, stdin)) > 0)
+	{
+		if (line[len - 1] == delimiter)
+			line[--len] = '\0';
+		if (!len)
+			continue;
 
-	ret = stat(file, &statbuff);
+		ret = scan_haystack(args, walk, pool, batch, line);
+	}
+
+	if (ferror(stdin))
+		printf("Error: failed to read the haystacks: %s\n",
+			strerror(errno));
+
+	free(line);
+
+	return ret;
+}
+
+/* @brief Search the libraries listed in the cache of the dynamic loader.
+ *
+ * The cache gives the exact set of libraries the loader can find, without
+ * walking and probing every file of their directories. Its entries are often
+ * symbolic links to the same file, the walk only searches each one once.
+ *
+ * @param args The arguments of the program.
+ * @param walk The walk of the haystacks.
+ * @param pool The workers, NULL for a serial scan.
+ * @param batch The files waiting to be loaded with io_uring.
+ * @return -ENOMEM if the scan must stop, another value otherwise.
+ */
+static int scan_system(struct args * args, struct walk * walk,
+		struct pool * pool, struct batch * batch)
+{
+	struct ldcache cache;
+	int ret;
+
+	ret = ldcache_open(&cache, LDCACHE_PATH);
 	if (ret < 0)
 	{
-		printf("Failed to stat file '%s': %s. Skipping...\n", file,
-			strerror(errno));
+		printf("Error: failed to read %s: %s\n", LDCACHE_PATH,
+			strerror(-ret));
 		return ret;
 	}
 
-	switch (statbuff.st_mode & S_IFMT) {
-		case S_IFDIR: /* File is a directory. */
-		{
-			DIR * dir = NULL;
-			char * path = NULL;
+	for (size_t i = 0; i < cache.count && ret != -ENOMEM; ++i)
+	{
+		char const * path = ldcache_path(&cache, i);
 
-			dir = opendir(file);
-			if (!dir)
-				return -errno;
+		if (path)
+			ret = scan_haystack(args, walk, pool, batch, path);
+	}
 
-			path = strndup(file, strlen(file));
-			if (!path)
-			{
-				printf("Failed to allocate memory: %s\n",
-					strerror(errno));
-				return -errno;
-			}
-			get_path(path);
+	ldcache_close(&cache);
 
-			while (1)
-			{
-				char * fullpath = NULL;
-				struct dirent * dirent = readdir(dir);
-				size_t size;
-
-				size = strlen(file) + strlen(dirent->d_name) + 2;
-
-				if (!dirent && errno)
-				{
-					free(path);
-					closedir(dir);
-					return -errno;
-				}
-				else if (!dirent)
-					break;
-
-				/* Skip hidden files, '.' and '..' */
-				if (dirent->d_name[0] == '.')
-					continue;
-
-				fullpath = calloc(size, sizeof(char));
-				if (!fullpath)
-				{
-					printf("Failed to allocate memory: %s\n",
-						strerror(errno));
-					free(path);
-					closedir(dir);
-					return -errno;
-				}
-
-				strncpy(fullpath, path, size);
-				if (path[strlen(fullpath) - 1] != '/')
-					fullpath[strlen(fullpath)] = '/';
-				strncat(fullpath, dirent->d_name, strlen(fullpath));
-
-				ret = analyze_file(args, fullpath);
-				if (ret < 0)
-				{
-					printf("ici.\n");
-					free(fullpath);
-					free(path);
-					closedir(dir);
-					return ret;
-				}
-
-				free(fullpath);
-			}
+	return ret;
+}
 
-			free(path);
-			closedir(dir);
+/* @brief Search a binary and the libraries it needs, its DT_NEEDED closure.
+ *
+ * The closure is resolved first, each library read once, then searched like
+ * any other haystack, by the workers when there are some. A library that
+ * cannot be found is reported, the others are still searched.
+ *
+ * @param args The arguments of the program.
+ * @param walk The walk of the haystacks.
+ * @param pool The workers, NULL for a serial scan.
+ * @param batch The files waiting to be loaded with io_uring.
+ * @return -ENOMEM if the scan must stop, another value otherwise.
+ */
+static int scan_deps(struct args * args, struct walk * walk,
+		struct pool * pool, struct batch * batch)
+{
+	struct deps deps;
+	int ret;
 
-			break;
-		}
-		case S_IFREG: /* File is a regular file. */
-		{
-			if (!file_is_shared_elf(file))
-				break;
+	ret = deps_resolve(&deps, args->deps_path);
+	if (ret < 0)
+	{
+		printf("Error: failed to resolve the libraries of %s: %s\n",
+			args->deps_path, strerror(-ret));
+		return ret;
+	}
 
-			ret = search(args, file);
-			if (ret < 0)
-			{
-				printf("The search for symbol '%s' failed. "
-					"Skipping...\n", file);
-				return ret;
-			}
-			break;
+	for (size_t i = 0; i < deps.count && ret != -ENOMEM; ++i)
+	{
+		struct dep const * object = &deps.objects[i];
+
+		if (!object->path)
+		{
+			printf("Error: %s, needed by %s, was not found.\n",
+				object->name,
+				deps.objects[object->parent].name);
+			continue;
 		}
-		default:
-			printf("File '%s' is neither a shared object nor a "
-				"directory. Skipping...\n", file);
-			break;
+
+		if (args->verbose)
+			printf("%s => %s\n", object->name, object->path);
+
+		ret = scan_haystack(args, walk, pool, batch, object->path);
 	}
 
+	deps_free(&deps);
+
 	return ret;
 }
 
 int main(int argc, char *argv[])
 {
 	int ret = 0;
+	struct pool * pool = NULL;
+	struct walk * walk = NULL;
+	struct batch batch = { 0 };
+	uint64_t start = 0;
 	struct args args = {
-		NULL,
-		{ 0 },
-		MIN_DISTANCE,
-		0
+		.min_distance = MIN_DISTANCE,
+		.jobs = 1
 	};
 
 	ret = check_arguments(argc, argv, &args);
@@ -350,36 +853,222 @@ int main(int argc, char *argv[])
 	}
 
 	if (args.verbose)
+	{
 		printf("Minimum distance for a match: %f\n", args.min_distance);
+		if (args.needles_path)
+			printf("Needles: %zu\n", args.needle_nb);
+	}
 
-	for(int i = 0; i < MAX_HAYSTACKS; i++)
+	if (args.connect_path)
 	{
-		if (!args.haystacks[i])
-			break;
+		ret = -serve_connect(&args, args.connect_path);
+		goto END;
+	}
 
-		/* Reset errno to 0. If an error occurs while calling 'stat' on
-		 * this file (for exemple because it does not exist, then errno
-		 * will be set. Then it will fail in the method read_fd which
-		 * calls getline, which uses errno to differentiate between EOF
-		 * and an actual error. */
-		errno = 0;
+	if (args.index_path)
+	{
+		args.index = index_open(args.index_path);
+		if (!args.index)
+		{
+			printf("Failed to allocate memory: %s\n",
+				strerror(ENOMEM));
+			ret = ENOMEM;
+			goto END;
+		}
+	}
 
-		ret = analyze_file(&args, args.haystacks[i]);
-		if (ret == -ENOMEM)
-			break;
+	if (args.needle_nb)
+	{
+		args.cache = cache_create();
+		if (!args.cache)
+		{
+			printf("Failed to allocate memory: %s\n",
+				strerror(ENOMEM));
+			ret = ENOMEM;
+			goto END;
+		}
 	}
 
-END:
-	for(int i = 0; i < MAX_HAYSTACKS; i++)
+	if (args.top)
 	{
-		if(!args.haystacks[i])
-			break;
+		args.topks = calloc(args.needle_nb, sizeof(*args.topks));
+		for (size_t i = 0; args.topks && i < args.needle_nb; ++i)
+		{
+			args.topks[i] = topk_create(args.top);
+			if (!args.topks[i])
+				break;
+		}
+
+		if (!args.topks || !args.topks[args.needle_nb - 1])
+		{
+			printf("Failed to allocate memory: %s\n",
+				strerror(ENOMEM));
+			ret = ENOMEM;
+			goto END;
+		}
+	}
+
+	if (args.watch_mode)
+	{
+		args.watch = watch_create();
+		if (!args.watch)
+		{
+			printf("Error: failed to watch the haystacks: %s\n",
+				strerror(errno));
+			ret = errno;
+			goto END;
+		}
+	}
+
+	if (args.serve_path)
+	{
+		args.store = store_create();
+		if (!args.store)
+		{
+			printf("Failed to allocate memory: %s\n",
+				strerror(ENOMEM));
+			ret = ENOMEM;
+			goto END;
+		}
+	}
 
-		free(args.haystacks[i]);
+	if (args.print_stats)
+	{
+		args.stats = calloc(1, sizeof(*args.stats));
+		if (!args.stats)
+		{
+			printf("Failed to allocate memory: %s\n",
+				strerror(ENOMEM));
+			ret = ENOMEM;
+			goto END;
+		}
+		start = stats_now(args.stats);
+	}
+
+	args.scan_ctxs = calloc(args.jobs, sizeof(*args.scan_ctxs));
+	if (!args.scan_ctxs)
+	{
+		printf("Failed to allocate memory: %s\n", strerror(ENOMEM));
+		ret = ENOMEM;
+		goto END;
 	}
 
-	if(args.needle)
-		free(args.needle);
+	for (unsigned i = 0; i < args.jobs; ++i)
+	{
+		if (scan_ctx_init(&args.scan_ctxs[i], &args,
+					args.jobs > 1 || args.watch) < 0)
+		{
+			printf("Failed to allocate memory: %s\n",
+				strerror(ENOMEM));
+			ret = ENOMEM;
+			goto END;
+		}
+	}
+
+	walk = walk_create(&args);
+	if (!walk)
+	{
+		printf("Failed to allocate memory: %s\n", strerror(ENOMEM));
+		ret = ENOMEM;
+		goto END;
+	}
+
+	if (args.jobs > 1)
+	{
+		pool = pool_create(args.jobs, args.io_uring ?
+				search_batch_task : search_task, &args);
+		if (!pool)
+		{
+			printf("Error: failed to start the worker threads.\n");
+			ret = ENOMEM;
+			goto END;
+		}
+	}
+
+	for (size_t i = 0; i < args.haystack_nb && ret != -ENOMEM; ++i)
+		ret = scan_haystack(&args, walk, pool, &batch, args.haystacks[i]);
+
+	if (args.system && ret != -ENOMEM)
+		ret = scan_system(&args, walk, pool, &batch);
+
+	if (args.deps_path && ret != -ENOMEM)
+		ret = scan_deps(&args, walk, pool, &batch);
+
+	if (args.from_stdin && ret != -ENOMEM)
+		ret = scan_stdin(&args, walk, pool, &batch);
+
+	if (ret != -ENOMEM && flush_batch(&args, pool, &batch) < 0)
+		ret = -ENOMEM;
+	free(batch.paths);
+
+	if (pool)
+		pool_destroy(pool);
+
+	for (size_t i = 0; args.topks && i < args.needle_nb; ++i)
+		topk_print(args.topks[i], stdout,
+				args.print_needle ? args.needles[i] : NULL,
+				args.verbose);
+
+	if (args.index)
+	{
+		uint64_t save = stats_now(args.stats);
+
+		if (index_save(args.index, args.build_index) < 0)
+			ret = EIO;
+		stats_phase(args.stats, STATS_INDEX, save);
+	}
+
+	if (args.stats)
+	{
+		for (unsigned i = 0; i < args.jobs; ++i)
+			stats_merge(args.stats, args.scan_ctxs[i].stats);
+		stats_print(args.stats, stderr, args.stats_json,
+				stats_now(args.stats) - start);
+	}
+
+	if (args.store && ret != -ENOMEM)
+	{
+		store_sort(args.store);
+		ret = -serve_run(&args, args.serve_path);
+	}
+
+	if (args.watch && ret != -ENOMEM)
+		ret = -watch_run(&args);
+
+END:
+	if (walk)
+		walk_destroy(walk);
+
+	if (args.index)
+		index_close(args.index);
+
+	if (args.cache)
+		cache_destroy(args.cache);
+
+	if (args.store)
+		store_destroy(args.store);
+
+	if (args.watch)
+		watch_destroy(args.watch);
+
+	for (size_t i = 0; args.topks && i < args.needle_nb; ++i)
+	{
+		if (args.topks[i])
+			topk_destroy(args.topks[i]);
+	}
+	free(args.topks);
+
+	for (unsigned i = 0; args.scan_ctxs && i < args.jobs; ++i)
+		scan_ctx_free(&args.scan_ctxs[i]);
+	free(args.scan_ctxs);
+
+	if (args.stats)
+		stats_free(args.stats);
+	free(args.stats);
+
+	for (size_t i = 0; i < args.needle_nb; ++i)
+		free(args.needles[i]);
+	free(args.needles);
 
 	return ret;
 }
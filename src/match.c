@@ -0,0 +1,298 @@
+/* moses Find symbol in shared libraries.
+ * Copyright (C) 2022  Mathias Schmitt
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "cache.h"
+#include "common.h"
+#include "levenshtein.h"
+#include "match.h"
+#include "topk.h"
+
+/* @brief Give the similarity a symbol needs to be a match for a needle.
+ *
+ * With --top, the K-th best match found so far raises it above the minimum
+ * distance, so that the filters reject more candidates as the scan goes.
+ */
+static double match_threshold(struct args const * args, size_t needle)
+{
+	double threshold = args->min_distance;
+
+	if (args->topks && topk_threshold(args->topks[needle]) > threshold)
+		threshold = topk_threshold(args->topks[needle]);
+
+	return threshold;
+}
+
+int match_print(struct args const * args, size_t needle,
+		struct lev_ctx * lev, FILE * out, char const * file,
+		char const * symbol, size_t len, int dist)
+{
+	double lev_distance;
+
+	if (dist < 0 || dist == LEV_EXCEEDS_BOUND)
+		return 0;
+
+	lev_distance = lev_len_percent(dist, lev->needle_len, len);
+	if (lev_distance < match_threshold(args, needle))
+		return 0;
+
+	if (args->topks)
+	{
+		if (topk_offer(args->topks[needle], lev_distance, file,
+					symbol) < 0)
+			printf("Failed to allocate memory: %s\n",
+				strerror(ENOMEM));
+		return 1;
+	}
+
+	/* With several needles, tell which one the symbol matches. */
+	if (args->print_needle)
+		fprintf(out, "%s\t", lev->needle);
+
+	fprintf(out, "%s\t%s%s%.1f%%\n", file, symbol,
+			args->verbose ? " matches " : "\t", lev_distance);
+
+	return 1;
+}
+
+size_t match_symbol(struct args const * args, struct lev_ctx * levs,
+		FILE * out, char const * file, char const * symbol)
+{
+	size_t len = strlen(symbol);
+	size_t matches = 0;
+	uint64_t hash = 0;
+
+	if (args->cache)
+		hash = cache_hash(symbol, len);
+
+	for (size_t n = 0; n < args->needle_nb; ++n)
+	{
+		struct lev_ctx * lev = &levs[n];
+		int max;
+		int dist;
+
+		if (args->cache && cache_lookup(args->cache, (unsigned)n, symbol,
+					len, hash, &dist))
+		{
+			matches += (size_t)match_print(args, n, lev, out, file,
+					symbol, len, dist);
+			continue;
+		}
+
+		/* The bound only depends on the length of the name and never
+		 * gets looser, so telling that it is exceeded is as good as the
+		 * distance itself for the cache. */
+		max = lev_max_edits(match_threshold(args, n), lev->needle_len,
+				len);
+		dist = lev_ctx_dist_bounded(lev, symbol, len, max);
+		if (dist < 0)
+			continue;
+
+		if (args->cache)
+			cache_insert(args->cache, (unsigned)n, symbol, len, hash,
+					dist);
+
+		matches += (size_t)match_print(args, n, lev, out, file, symbol,
+				len, dist);
+	}
+
+	return matches;
+}
+
+/* A chunk of the symbols of a library, scored against every needle in turn
+ * so that their lengths and hashes are only computed once.
+ */
+struct batch
+{
+	char const * names[MATCH_BATCH_SIZE];
+	size_t lens[MATCH_BATCH_SIZE];
+	uint64_t hashes[MATCH_BATCH_SIZE];
+	unsigned char hashed[MATCH_BATCH_SIZE];
+	size_t count;
+
+	/* The symbols passing the length filter of the needle being scored,
+	 * by index in the chunk, their bounds and their distances. */
+	size_t candidates[MATCH_BATCH_SIZE];
+	int maxes[MATCH_BATCH_SIZE];
+	int dists[MATCH_BATCH_SIZE];
+	size_t candidate_nb;
+
+	/* The candidates missing from the cache, by index in candidates. */
+	size_t misses[MATCH_BATCH_SIZE];
+	size_t miss_nb;
+};
+
+/* @brief Gather the candidates of a chunk for a needle and look them up in
+ * the cache.
+ */
+static void match_filter(struct args const * args, size_t needle,
+		struct lev_ctx * lev, struct batch * batch)
+{
+	double threshold = match_threshold(args, needle);
+	size_t needle_len = lev->needle_len;
+
+	batch->candidate_nb = 0;
+	batch->miss_nb = 0;
+
+	for (size_t i = 0; i < batch->count; ++i)
+	{
+		size_t len = batch->lens[i];
+		size_t diff = len > needle_len ? len - needle_len :
+			needle_len - len;
+		int max = lev_max_edits(threshold, needle_len, len);
+		size_t c = batch->candidate_nb;
+
+		/* Only the candidates that pass the length filter are worth
+		 * a lookup or a lane. */
+		if (max < 0 || diff > (size_t)max)
+			continue;
+
+		batch->candidates[c] = i;
+		batch->maxes[c] = max;
+		batch->candidate_nb++;
+
+		if (!args->cache)
+		{
+			batch->misses[batch->miss_nb++] = c;
+			continue;
+		}
+
+		if (!batch->hashed[i])
+		{
+			batch->hashes[i] = cache_hash(batch->names[i], len);
+			batch->hashed[i] = 1;
+		}
+
+		if (!cache_lookup(args->cache, (unsigned)needle, batch->names[i],
+					len, batch->hashes[i], &batch->dists[c]))
+			batch->misses[batch->miss_nb++] = c;
+	}
+}
+
+/* @brief Score the candidates of a chunk missing from the cache, then print
+ * the matching ones in order.
+ *
+ * Every candidate is scored with its bound, so that the kernels give up as
+ * soon as it cannot match. Needles of a single word go through the
+ * bit-parallel kernel, which is faster than the vector one on real symbols.
+ * Longer needles would fall back to a banded DP, the vector kernel is
+ * several times faster for them.
+ */
+static size_t match_batch(struct args const * args, size_t needle,
+		struct lev_ctx * lev, FILE * out, char const * file,
+		struct batch * batch)
+{
+	size_t matches = 0;
+
+	if (batch->miss_nb)
+	{
+		char const * names[MATCH_BATCH_SIZE];
+		size_t lens[MATCH_BATCH_SIZE];
+		int maxes[MATCH_BATCH_SIZE];
+		int dists[MATCH_BATCH_SIZE];
+
+		for (size_t i = 0; i < batch->miss_nb; ++i)
+		{
+			size_t c = batch->misses[i];
+			size_t s = batch->candidates[c];
+
+			names[i] = batch->names[s];
+			lens[i] = batch->lens[s];
+			maxes[i] = batch->maxes[c];
+		}
+
+		/* If the vector kernel fails, the scalar one still scores
+		 * what it can. */
+		if (lev->needle_len <= LEV_WORD_BITS ||
+				lev_ctx_batch_bounded(lev, names, lens,
+					batch->miss_nb, maxes, dists) < 0)
+		{
+			for (size_t i = 0; i < batch->miss_nb; ++i)
+				dists[i] = lev_ctx_dist_bounded(lev, names[i],
+						lens[i], maxes[i]);
+		}
+
+		for (size_t i = 0; i < batch->miss_nb; ++i)
+		{
+			size_t c = batch->misses[i];
+			size_t s = batch->candidates[c];
+
+			batch->dists[c] = dists[i];
+			if (args->cache && dists[i] >= 0)
+				cache_insert(args->cache, (unsigned)needle,
+						names[i], lens[i],
+						batch->hashes[s], dists[i]);
+		}
+	}
+
+	for (size_t c = 0; c < batch->candidate_nb; ++c)
+	{
+		size_t s = batch->candidates[c];
+
+		matches += (size_t)match_print(args, needle, lev, out, file,
+				batch->names[s], batch->lens[s], batch->dists[c]);
+	}
+
+	return matches;
+}
+
+/* @brief Score a chunk against every needle and empty it. */
+static size_t match_chunk(struct args const * args, struct lev_ctx * levs,
+		FILE * out, char const * file, struct batch * batch)
+{
+	size_t matches = 0;
+
+	for (size_t n = 0; n < args->needle_nb; ++n)
+	{
+		match_filter(args, n, &levs[n], batch);
+		matches += match_batch(args, n, &levs[n], out, file, batch);
+	}
+
+	batch->count = 0;
+
+	return matches;
+}
+
+size_t match_symbols(struct args const * args, struct lev_ctx * levs,
+		FILE * out, char const * file, char const * const * symbols,
+		size_t count)
+{
+	size_t matches = 0;
+	struct batch batch;
+
+	batch.count = 0;
+
+	for (size_t i = 0; i < count; ++i)
+	{
+		size_t c = batch.count++;
+
+		batch.names[c] = symbols[i];
+		batch.lens[c] = strlen(symbols[i]);
+		batch.hashed[c] = 0;
+
+		if (batch.count == MATCH_BATCH_SIZE)
+			matches += match_chunk(args, levs, out, file, &batch);
+	}
+
+	if (batch.count)
+		matches += match_chunk(args, levs, out, file, &batch);
+
+	return matches;
+}
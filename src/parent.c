@@ -6,43 +6,69 @@
 #include <sys/types.h>
 #include <sys/wait.h>
 
-#include "levenshtein.h"
 #include "common.h"
 #include "parent.h"
-
-static void extract_symbol(char * str)
+#include "match.h"
+#include "scan.h"
+#include "stats.h"
+
+/* @brief Split a line of nm in the type, name and version of a symbol.
+ *
+ * The name is moved to the start of the line. Versioned names end with
+ * @VERSION, or @@VERSION for the default version, which is cut from the name.
+ *
+ * @param str The line, ending with a new line.
+ * @param type Set to the letter nm gives to the symbol.
+ * @return The version of the symbol, within the line, or NULL if it has none.
+ */
+static char const * extract_symbol(char * str, char * type)
 {
 	size_t len = strlen(str);
 	size_t i = 0;
+	char * version;
 
 	while(len > 0 && str[len] != ' ')
 		len--;
 
+	/* The type is the column before the name. */
+	*type = len > 0 ? str[len - 1] : '\0';
+
 	len++; /* Remove whitespace. */
 
 	while(str[len] && str[len] != '\n')
 		str[i++] = str[len++];
 	str[i] = '\0';
+
+	version = strchr(str, '@');
+	if (!version)
+		return NULL;
+
+	*version++ = '\0';
+	if (*version == '@')
+		version++;
+
+	return version;
 }
 
 
-static int read_fd(FILE * stream, struct args * args, char const * file)
+static int read_fd(FILE * stream, struct args * args, struct scan_ctx * ctx,
+		char const * file, FILE * out)
 {
+	uint64_t start = stats_now(ctx->stats);
 	int ret = 0;
-	size_t buffer_size = 0;
-	char * buffer = NULL;
 
 	while (1)
 	{
 		ssize_t bytes = 0;
+		size_t matches;
+		char const * version;
+		char type;
 
-		bytes = getline(&buffer, &buffer_size, stream);
+		/* getline only tells EOF and errors apart through errno. */
+		errno = 0;
+		bytes = getline(&ctx->line, &ctx->line_size, stream);
 		if (bytes < 0 && errno)
 		{
-			free(buffer);
-			buffer = NULL;
-			buffer_size = 0;
-
 			printf("Error(%d): failed to read from fd %d: %s\n",
 				getpid(), fileno(stream), strerror(errno));
 			ret = errno;
@@ -53,25 +79,35 @@ static int read_fd(FILE * stream, struct args * args, char const * file)
 			break;
 		}
 
-		extract_symbol(buffer);
-		double lev_distance = lev_dist_percent(
-				lev_string_dist(args->needle, buffer),
-				args->needle, buffer);
-		if (lev_distance >= args->min_distance)
-			printf("%s\t%s%s%.1f%%\n", file, buffer,
-					args->verbose ? " matches " : "\t",
-					lev_distance);
+		version = extract_symbol(ctx->line, &type);
+		if (args->filter.active && !filter_nm(&args->filter, type,
+					version))
+		{
+			if (ctx->stats)
+				ctx->stats->bytes += (size_t)bytes;
+			continue;
+		}
+		start = stats_phase(ctx->stats, STATS_READ, start);
+
+		matches = match_symbol(args, ctx->levs, out, file, ctx->line);
+		start = stats_phase(ctx->stats, STATS_MATCH, start);
+
+		if (ctx->stats)
+		{
+			ctx->stats->symbols++;
+			ctx->stats->matches += matches;
+			ctx->stats->bytes += (size_t)bytes;
+		}
 	}
 
-	free(buffer);
-	buffer = NULL;
-	buffer_size = 0;
+	stats_phase(ctx->stats, STATS_READ, start);
 
 	return ret;
 }
 
 
-int run_parent(struct args * args, int pfds[PFD_NUMBER], pid_t pid, char const * file)
+int run_parent(struct args * args, struct scan_ctx * ctx, int pfds[PFD_NUMBER],
+		pid_t pid, char const * file, FILE * out)
 {
 	int ret = 0;
 	FILE * istream = NULL;
@@ -86,10 +122,6 @@ int run_parent(struct args * args, int pfds[PFD_NUMBER], pid_t pid, char const *
 		goto END;
 	}
 
-	/* Redirect the pipe to stdin. */
-	close(STDIN_FILENO);
-	dup2(pfds[PFD_READ], STDIN_FILENO);
-
 	istream = fdopen(pfds[PFD_READ], "r");
 	if (istream == NULL)
 	{
@@ -102,8 +134,11 @@ int run_parent(struct args * args, int pfds[PFD_NUMBER], pid_t pid, char const *
 	}
 
 	int wstatus = 0;
-	ret = read_fd(istream, args, file);
+	ret = read_fd(istream, args, ctx, file, out);
+
+	uint64_t start = stats_now(ctx->stats);
 	waitpid(pid, &wstatus, 0);
+	stats_phase(ctx->stats, STATS_NM, start);
 
 END:
 	if (istream)
@@ -0,0 +1,285 @@
+/* moses Find symbol in shared libraries.
+ * Copyright (C) 2022  Mathias Schmitt
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "pool.h"
+
+#define DEQUE_INITIAL_SIZE 64
+
+/* Items queued per worker before pool_submit waits for room. */
+#define POOL_QUEUE_PER_WORKER 256
+
+/* A ring buffer of items. The owner pushes and pops at the tail, thieves
+ * take the oldest items from the head.
+ */
+struct deque
+{
+	pthread_mutex_t lock;
+	char ** items;
+	size_t head;
+	size_t count;
+	size_t capacity;
+};
+
+struct worker
+{
+	struct pool * pool;
+	struct deque deque;
+	unsigned id;
+	pthread_t thread;
+};
+
+struct pool
+{
+	struct worker * workers;
+	unsigned worker_nb;
+	unsigned running;
+	unsigned next;
+
+	pool_fn fn;
+	void * data;
+
+	/* Protects pending and closing, used to put idle workers to sleep and
+	 * the submitter to wait for room. */
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	pthread_cond_t room;
+	size_t pending;
+	size_t max_pending;
+	int closing;
+};
+
+static int deque_push(struct deque * deque, char * item)
+{
+	pthread_mutex_lock(&deque->lock);
+
+	if (deque->count == deque->capacity)
+	{
+		size_t capacity = deque->capacity ? deque->capacity * 2 :
+			DEQUE_INITIAL_SIZE;
+		char ** items = malloc(capacity * sizeof(*items));
+
+		if (!items)
+		{
+			pthread_mutex_unlock(&deque->lock);
+			return -ENOMEM;
+		}
+
+		for (size_t i = 0; i < deque->count; ++i)
+			items[i] = deque->items[(deque->head + i) %
+				deque->capacity];
+
+		free(deque->items);
+		deque->items = items;
+		deque->head = 0;
+		deque->capacity = capacity;
+	}
+
+	deque->items[(deque->head + deque->count) % deque->capacity] = item;
+	deque->count++;
+
+	pthread_mutex_unlock(&deque->lock);
+
+	return 0;
+}
+
+/* @brief Take an item from the deque.
+ *
+ * @param deque The deque.
+ * @param steal Take the oldest item instead of the newest one.
+ * @return The item, or NULL if the deque is empty.
+ */
+static char * deque_take(struct deque * deque, int steal)
+{
+	char * item = NULL;
+
+	pthread_mutex_lock(&deque->lock);
+
+	if (deque->count)
+	{
+		if (steal)
+		{
+			item = deque->items[deque->head];
+			deque->head = (deque->head + 1) % deque->capacity;
+		}
+		else
+		{
+			item = deque->items[(deque->head + deque->count - 1) %
+				deque->capacity];
+		}
+		deque->count--;
+	}
+
+	pthread_mutex_unlock(&deque->lock);
+
+	return item;
+}
+
+static char * find_work(struct worker * worker)
+{
+	struct pool * pool = worker->pool;
+	char * item = deque_take(&worker->deque, 0);
+
+	for (unsigned i = 1; !item && i < pool->worker_nb; ++i)
+	{
+		struct worker * victim =
+			&pool->workers[(worker->id + i) % pool->worker_nb];
+
+		item = deque_take(&victim->deque, 1);
+	}
+
+	return item;
+}
+
+static void * worker_run(void * arg)
+{
+	struct worker * worker = arg;
+	struct pool * pool = worker->pool;
+
+	while (1)
+	{
+		char * item = find_work(worker);
+
+		if (item)
+		{
+			pthread_mutex_lock(&pool->lock);
+			if (pool->pending-- == pool->max_pending)
+				pthread_cond_signal(&pool->room);
+			pthread_mutex_unlock(&pool->lock);
+
+			pool->fn(pool->data, worker->id, item);
+			free(item);
+			continue;
+		}
+
+		pthread_mutex_lock(&pool->lock);
+		while (!pool->pending && !pool->closing)
+			pthread_cond_wait(&pool->cond, &pool->lock);
+
+		if (!pool->pending && pool->closing)
+		{
+			pthread_mutex_unlock(&pool->lock);
+			break;
+		}
+		pthread_mutex_unlock(&pool->lock);
+	}
+
+	return NULL;
+}
+
+struct pool * pool_create(unsigned workers, pool_fn fn, void * data)
+{
+	struct pool * pool = calloc(1, sizeof(*pool));
+	unsigned started = 0;
+
+	if (!pool)
+		return NULL;
+
+	pool->workers = calloc(workers, sizeof(*pool->workers));
+	if (!pool->workers)
+	{
+		free(pool);
+		return NULL;
+	}
+
+	pool->worker_nb = workers;
+	pool->max_pending = (size_t)workers * POOL_QUEUE_PER_WORKER;
+	pool->fn = fn;
+	pool->data = data;
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->cond, NULL);
+	pthread_cond_init(&pool->room, NULL);
+
+	for (unsigned i = 0; i < workers; ++i)
+	{
+		pool->workers[i].pool = pool;
+		pool->workers[i].id = i;
+		pthread_mutex_init(&pool->workers[i].deque.lock, NULL);
+	}
+
+	for (; started < workers; ++started)
+	{
+		if (pthread_create(&pool->workers[started].thread, NULL,
+					worker_run, &pool->workers[started]))
+			break;
+	}
+
+	/* Run with the threads that could be started, if any. The deques of
+	 * the others are drained by stealing. */
+	pool->running = started;
+	if (!started)
+	{
+		pool_destroy(pool);
+		return NULL;
+	}
+
+	return pool;
+}
+
+int pool_submit(struct pool * pool, char * item)
+{
+	struct worker * worker = &pool->workers[pool->next++ % pool->worker_nb];
+	int ret;
+
+	/* The slot is reserved before the push, a worker may take the item
+	 * as soon as it is in the deque. */
+	pthread_mutex_lock(&pool->lock);
+	while (pool->pending >= pool->max_pending)
+		pthread_cond_wait(&pool->room, &pool->lock);
+	pool->pending++;
+	pthread_mutex_unlock(&pool->lock);
+
+	ret = deque_push(&worker->deque, item);
+
+	pthread_mutex_lock(&pool->lock);
+	if (ret < 0)
+	{
+		if (pool->pending-- == pool->max_pending)
+			pthread_cond_signal(&pool->room);
+	}
+	else
+		pthread_cond_signal(&pool->cond);
+	pthread_mutex_unlock(&pool->lock);
+
+	return ret < 0 ? ret : 0;
+}
+
+void pool_destroy(struct pool * pool)
+{
+	pthread_mutex_lock(&pool->lock);
+	pool->closing = 1;
+	pthread_cond_broadcast(&pool->cond);
+	pthread_mutex_unlock(&pool->lock);
+
+	for (unsigned i = 0; i < pool->running; ++i)
+		pthread_join(pool->workers[i].thread, NULL);
+
+	for (unsigned i = 0; i < pool->worker_nb; ++i)
+	{
+		pthread_mutex_destroy(&pool->workers[i].deque.lock);
+		free(pool->workers[i].deque.items);
+	}
+
+	pthread_mutex_destroy(&pool->lock);
+	pthread_cond_destroy(&pool->cond);
+	pthread_cond_destroy(&pool->room);
+	free(pool->workers);
+	free(pool);
+}
@@ -0,0 +1,546 @@
+/* moses Find symbol in shared libraries.
+ * Copyright (C) 2022  Mathias Schmitt
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "levenshtein.h"
+#include "match.h"
+#include "qgram.h"
+#include "store.h"
+
+/* A symbol of the store, while the names are being numbered. */
+struct entry
+{
+	char const * name;
+	uint32_t len;
+	uint32_t lib;
+	uint32_t symbol;
+};
+
+/* A match of a query, to be printed in the order of the store. */
+struct hit
+{
+	uint32_t lib;
+	uint32_t symbol;
+	uint32_t name;
+	int dist;
+};
+
+static int entry_compare(void const * e1, void const * e2)
+{
+	struct entry const * entry1 = e1;
+	struct entry const * entry2 = e2;
+	int ret;
+
+	if (entry1->len != entry2->len)
+		return entry1->len < entry2->len ? -1 : 1;
+
+	ret = strcmp(entry1->name, entry2->name);
+	if (ret)
+		return ret;
+
+	if (entry1->lib != entry2->lib)
+		return entry1->lib < entry2->lib ? -1 : 1;
+
+	return (entry1->symbol > entry2->symbol) -
+		(entry1->symbol < entry2->symbol);
+}
+
+static int u32_compare(void const * v1, void const * v2)
+{
+	uint32_t a = *(uint32_t const *)v1;
+	uint32_t b = *(uint32_t const *)v2;
+
+	return (a > b) - (a < b);
+}
+
+static int u64_compare(void const * v1, void const * v2)
+{
+	uint64_t a = *(uint64_t const *)v1;
+	uint64_t b = *(uint64_t const *)v2;
+
+	return (a > b) - (a < b);
+}
+
+static int hit_compare(void const * h1, void const * h2)
+{
+	struct hit const * hit1 = h1;
+	struct hit const * hit2 = h2;
+
+	if (hit1->lib != hit2->lib)
+		return hit1->lib < hit2->lib ? -1 : 1;
+
+	return (hit1->symbol > hit2->symbol) - (hit1->symbol < hit2->symbol);
+}
+
+static uint32_t qgram_at(char const * str)
+{
+	unsigned char const * p = (unsigned char const *)str;
+
+	return (uint32_t)p[0] << 16 | (uint32_t)p[1] << 8 | p[2];
+}
+
+/* @brief Number the distinct names of the store by length. */
+static int qgram_names(struct qgram_index * index, struct store const * store)
+{
+	struct entry * entries;
+	size_t total = 0;
+	size_t e = 0;
+	size_t id = 0;
+
+	for (size_t i = 0; i < store->lib_nb; ++i)
+		total += store->libs[i].count;
+	if (!total || total >= UINT32_MAX)
+		return total ? -EOVERFLOW : 0;
+
+	entries = malloc(total * sizeof(*entries));
+	if (!entries)
+		return -ENOMEM;
+
+	for (size_t i = 0; i < store->lib_nb; ++i)
+	{
+		for (size_t j = 0; j < store->libs[i].count; ++j)
+		{
+			entries[e].name = store->libs[i].names[j];
+			entries[e].len = (uint32_t)strlen(entries[e].name);
+			entries[e].lib = (uint32_t)i;
+			entries[e].symbol = (uint32_t)j;
+			e++;
+		}
+	}
+
+	qsort(entries, total, sizeof(*entries), entry_compare);
+
+	index->names = malloc(total * sizeof(*index->names));
+	index->lens = malloc(total * sizeof(*index->lens));
+	index->occ_start = malloc((total + 1) * sizeof(*index->occ_start));
+	index->occurrences = malloc(total * sizeof(*index->occurrences));
+	index->max_len = entries[total - 1].len;
+	index->len_start = malloc((index->max_len + 2) *
+			sizeof(*index->len_start));
+	if (!index->names || !index->lens || !index->occ_start ||
+			!index->occurrences || !index->len_start)
+	{
+		free(entries);
+		return -ENOMEM;
+	}
+
+	for (e = 0; e < total; ++e)
+	{
+		if (!e || entries[e].len != entries[e - 1].len ||
+				strcmp(entries[e].name, entries[e - 1].name))
+		{
+			index->names[id] = entries[e].name;
+			index->lens[id] = entries[e].len;
+			index->occ_start[id] = (uint32_t)e;
+			id++;
+		}
+
+		index->occurrences[e].lib = entries[e].lib;
+		index->occurrences[e].symbol = entries[e].symbol;
+	}
+	index->occ_start[id] = (uint32_t)total;
+	index->name_nb = id;
+
+	id = 0;
+	for (size_t len = 0; len <= index->max_len + 1; ++len)
+	{
+		while (id < index->name_nb && index->lens[id] < len)
+			id++;
+		index->len_start[len] = (uint32_t)id;
+	}
+
+	free(entries);
+
+	return 0;
+}
+
+/* @brief Build the posting lists of the q-grams of the names. */
+static int qgram_postings(struct qgram_index * index)
+{
+	uint64_t * pairs;
+	size_t pair_nb = 0;
+	size_t p = 0;
+
+	for (size_t i = 0; i < index->name_nb; ++i)
+		pair_nb += index->lens[i] >= QGRAM_Q ?
+			index->lens[i] - QGRAM_Q + 1 : 0;
+	if (pair_nb >= UINT32_MAX)
+		return -EOVERFLOW;
+
+	pairs = malloc((pair_nb ? pair_nb : 1) * sizeof(*pairs));
+	if (!pairs)
+		return -ENOMEM;
+
+	for (size_t i = 0; i < index->name_nb; ++i)
+	{
+		for (size_t j = 0; j + QGRAM_Q <= index->lens[i]; ++j)
+			pairs[p++] = (uint64_t)qgram_at(index->names[i] + j) << 32 |
+				i;
+	}
+
+	qsort(pairs, pair_nb, sizeof(*pairs), u64_compare);
+
+	index->gram_nb = 0;
+	for (p = 0; p < pair_nb; ++p)
+		index->gram_nb += !p || pairs[p] >> 32 != pairs[p - 1] >> 32;
+
+	index->grams = malloc((index->gram_nb + 1) * sizeof(*index->grams));
+	index->post_start = malloc((index->gram_nb + 1) *
+			sizeof(*index->post_start));
+	index->postings = malloc((pair_nb ? pair_nb : 1) *
+			sizeof(*index->postings));
+	if (!index->grams || !index->post_start || !index->postings)
+	{
+		free(pairs);
+		return -ENOMEM;
+	}
+
+	index->gram_nb = 0;
+	for (p = 0; p < pair_nb; ++p)
+	{
+		if (!p || pairs[p] >> 32 != pairs[p - 1] >> 32)
+		{
+			index->grams[index->gram_nb] = (uint32_t)(pairs[p] >> 32);
+			index->post_start[index->gram_nb++] = (uint32_t)p;
+		}
+		index->postings[p] = (uint32_t)pairs[p];
+	}
+	index->post_start[index->gram_nb] = (uint32_t)pair_nb;
+
+	free(pairs);
+
+	return 0;
+}
+
+int qgram_build(struct qgram_index * index, struct store const * store)
+{
+	int ret;
+
+	memset(index, 0, sizeof(*index));
+
+	ret = qgram_names(index, store);
+	if (!ret && index->name_nb)
+		ret = qgram_postings(index);
+	if (ret < 0)
+		qgram_free(index);
+
+	return ret;
+}
+
+void qgram_free(struct qgram_index * index)
+{
+	free(index->names);
+	free(index->lens);
+	free(index->len_start);
+	free(index->occurrences);
+	free(index->occ_start);
+	free(index->grams);
+	free(index->post_start);
+	free(index->postings);
+	memset(index, 0, sizeof(*index));
+}
+
+/* @brief Shared q-grams below which a name of length n is further than k
+ * edits from a needle of length m. It is 0 or less when every name of
+ * this length has to be verified.
+ */
+static long qgram_lemma(size_t m, size_t n, int k)
+{
+	return (long)(m > n ? m : n) - QGRAM_Q + 1 - (long)k * QGRAM_Q;
+}
+
+/* @brief Find a q-gram, or return index->gram_nb. */
+static size_t qgram_find(struct qgram_index const * index, uint32_t gram)
+{
+	size_t lo = 0;
+	size_t hi = index->gram_nb;
+
+	while (lo < hi)
+	{
+		size_t mid = lo + (hi - lo) / 2;
+
+		if (index->grams[mid] < gram)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo < index->gram_nb && index->grams[lo] == gram ? lo :
+		index->gram_nb;
+}
+
+/* Scratch memory of a query. */
+struct query
+{
+	/* Shared q-grams of the names from first to last. */
+	uint16_t * counts;
+	uint32_t first;
+	uint32_t last;
+	uint32_t * touched;
+	size_t touched_nb;
+
+	/* The names matching the needle. */
+	uint32_t * names;
+	int * dists;
+	size_t match_nb;
+	size_t match_capacity;
+};
+
+/* @brief Count the q-grams each name shares with the needle. */
+static int query_count(struct qgram_index const * index, struct query * query,
+		char const * needle, size_t m)
+{
+	size_t gram_nb = m >= QGRAM_Q ? m - QGRAM_Q + 1 : 0;
+	uint32_t * grams = malloc((gram_nb ? gram_nb : 1) * sizeof(*grams));
+
+	if (!grams)
+		return -ENOMEM;
+
+	for (size_t i = 0; i < gram_nb; ++i)
+		grams[i] = qgram_at(needle + i);
+	qsort(grams, gram_nb, sizeof(*grams), u32_compare);
+
+	for (size_t i = 0; i < gram_nb; )
+	{
+		size_t a = 1;
+		size_t g;
+		uint32_t lo;
+		uint32_t hi;
+
+		while (i + a < gram_nb && grams[i + a] == grams[i])
+			a++;
+		g = qgram_find(index, grams[i]);
+		i += a;
+		if (g == index->gram_nb)
+			continue;
+
+		/* Only the part of the list within the length filter. */
+		lo = index->post_start[g];
+		hi = index->post_start[g + 1];
+		while (lo < hi)
+		{
+			uint32_t mid = lo + (hi - lo) / 2;
+
+			if (index->postings[mid] < query->first)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+
+		for (uint32_t p = lo; p < index->post_start[g + 1] &&
+				index->postings[p] < query->last; )
+		{
+			uint32_t id = index->postings[p];
+			uint16_t * count = &query->counts[id - query->first];
+			size_t b = 0;
+
+			while (p < index->post_start[g + 1] &&
+					index->postings[p] == id)
+			{
+				b++;
+				p++;
+			}
+
+			if (!*count)
+				query->touched[query->touched_nb++] = id;
+			*count = (uint16_t)(*count + (a < b ? a : b) > UINT16_MAX ?
+					UINT16_MAX : *count + (a < b ? a : b));
+		}
+	}
+
+	free(grams);
+
+	return 0;
+}
+
+/* @brief Compute the distance of a name and record it if it matches. */
+static int query_verify(struct qgram_index const * index,
+		struct query * query, struct lev_ctx * lev, uint32_t id, int k)
+{
+	int dist = lev_ctx_dist_bounded(lev, index->names[id], index->lens[id],
+			k);
+
+	if (dist < 0)
+		return dist;
+	if (dist == LEV_EXCEEDS_BOUND)
+		return 0;
+
+	if (query->match_nb == query->match_capacity)
+	{
+		size_t capacity = query->match_capacity ?
+			query->match_capacity * 2 : 64;
+		uint32_t * names = realloc(query->names,
+				capacity * sizeof(*names));
+		int * dists;
+
+		if (!names)
+			return -ENOMEM;
+		query->names = names;
+
+		dists = realloc(query->dists, capacity * sizeof(*dists));
+		if (!dists)
+			return -ENOMEM;
+		query->dists = dists;
+		query->match_capacity = capacity;
+	}
+
+	query->names[query->match_nb] = id;
+	query->dists[query->match_nb++] = dist;
+
+	return 0;
+}
+
+int qgram_print(struct qgram_index const * index, struct store const * store,
+		struct args const * args, struct lev_ctx * lev, FILE * out,
+		uint32_t const * names, int const * dists, size_t count)
+{
+	struct hit * hits;
+	size_t hit_nb = 0;
+
+	for (size_t i = 0; i < count; ++i)
+		hit_nb += index->occ_start[names[i] + 1] -
+			index->occ_start[names[i]];
+
+	hits = malloc((hit_nb ? hit_nb : 1) * sizeof(*hits));
+	if (!hits)
+		return -ENOMEM;
+
+	hit_nb = 0;
+	for (size_t i = 0; i < count; ++i)
+	{
+		for (uint32_t o = index->occ_start[names[i]];
+				o < index->occ_start[names[i] + 1]; ++o)
+		{
+			hits[hit_nb].lib = index->occurrences[o].lib;
+			hits[hit_nb].symbol = index->occurrences[o].symbol;
+			hits[hit_nb].name = names[i];
+			hits[hit_nb++].dist = dists[i];
+		}
+	}
+
+	qsort(hits, hit_nb, sizeof(*hits), hit_compare);
+
+	for (size_t h = 0; h < hit_nb; ++h)
+	{
+		struct hit const * hit = &hits[h];
+
+		match_print(args, 0, lev, out, store->libs[hit->lib].file,
+				index->names[hit->name], index->lens[hit->name],
+				hit->dist);
+	}
+
+	free(hits);
+
+	return 0;
+}
+
+int qgram_query(struct qgram_index const * index, struct store const * store,
+		struct args const * args, struct lev_ctx * lev, FILE * out)
+{
+	struct query query = { 0 };
+	double threshold = args->min_distance;
+	size_t m = lev->needle_len;
+	size_t unfiltered = 0;
+	size_t lo = SIZE_MAX;
+	size_t hi = 0;
+	int ret = 0;
+
+	/* With --top, the threshold rises as the scan goes. */
+	if (args->topks || !index->name_nb)
+		return 0;
+
+	for (size_t n = 0; n <= index->max_len; ++n)
+	{
+		int k = lev_max_edits(threshold, m, n);
+		size_t diff = n > m ? n - m : m - n;
+
+		if (k < 0 || diff > (size_t)k)
+			continue;
+
+		lo = lo == SIZE_MAX ? n : lo;
+		hi = n;
+		if (qgram_lemma(m, n, k) <= 0)
+			unfiltered += index->len_start[n + 1] - index->len_start[n];
+	}
+
+	if (lo == SIZE_MAX)
+		return 1;
+
+	/* The filter is worthless when most names have to be verified. */
+	if (unfiltered * 4 > index->name_nb)
+		return 0;
+
+	query.first = index->len_start[lo];
+	query.last = index->len_start[hi + 1];
+	query.counts = calloc(query.last - query.first + 1,
+			sizeof(*query.counts));
+	query.touched = malloc((query.last - query.first + 1) *
+			sizeof(*query.touched));
+	if (!query.counts || !query.touched)
+	{
+		ret = -ENOMEM;
+		goto END;
+	}
+
+	ret = query_count(index, &query, lev->needle, m);
+	if (ret < 0)
+		goto END;
+
+	for (size_t t = 0; t < query.touched_nb && ret >= 0; ++t)
+	{
+		uint32_t id = query.touched[t];
+		size_t n = index->lens[id];
+		int k = lev_max_edits(threshold, m, n);
+		long lemma = qgram_lemma(m, n, k);
+
+		/* The names of unfiltered lengths are all verified below. */
+		if (lemma > 0 && query.counts[id - query.first] >= lemma)
+			ret = query_verify(index, &query, lev, id, k);
+	}
+
+	for (size_t n = lo; n <= hi && ret >= 0; ++n)
+	{
+		int k = lev_max_edits(threshold, m, n);
+		size_t diff = n > m ? n - m : m - n;
+
+		if (k < 0 || diff > (size_t)k || qgram_lemma(m, n, k) > 0)
+			continue;
+
+		for (uint32_t id = index->len_start[n];
+				id < index->len_start[n + 1] && ret >= 0; ++id)
+			ret = query_verify(index, &query, lev, id, k);
+	}
+	if (ret < 0)
+		goto END;
+
+	ret = qgram_print(index, store, args, lev, out, query.names,
+			query.dists, query.match_nb);
+	if (!ret)
+		ret = 1;
+
+END:
+	free(query.counts);
+	free(query.touched);
+	free(query.names);
+	free(query.dists);
+
+	return ret;
+}
@@ -0,0 +1,704 @@
+/* moses Find symbol in shared libraries.
+ * Copyright (C) 2022  Mathias Schmitt
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "common.h"
+#include "pipe.h"
+#include "child.h"
+#include "parent.h"
+#include "elfsym.h"
+#include "filter.h"
+#include "index.h"
+#include "match.h"
+#include "scan.h"
+#include "stats.h"
+#include "store.h"
+#include "uring.h"
+#include "watch.h"
+
+int scan_ctx_init(struct scan_ctx * ctx, struct args const * args,
+		int buffered)
+{
+	int ret;
+
+	memset(ctx, 0, sizeof(*ctx));
+
+	if (args->needle_nb)
+	{
+		ctx->levs = calloc(args->needle_nb, sizeof(*ctx->levs));
+		if (!ctx->levs)
+			return -ENOMEM;
+		ctx->lev_nb = args->needle_nb;
+
+		for (size_t i = 0; i < args->needle_nb; ++i)
+		{
+			ret = lev_ctx_init(&ctx->levs[i], args->needles[i]);
+			if (ret < 0)
+			{
+				scan_ctx_free(ctx);
+				return ret;
+			}
+		}
+	}
+
+	/* Without io_uring, the batches are loaded with elf_open. */
+	if (args->io_uring)
+	{
+		ctx->ring = uring_create();
+		if (!ctx->ring && args->verbose)
+			printf("io_uring is not available, reading the files "
+				"synchronously: %s\n", strerror(errno));
+	}
+
+	if (args->stats)
+	{
+		ctx->stats = calloc(1, sizeof(*ctx->stats));
+		if (!ctx->stats)
+		{
+			scan_ctx_free(ctx);
+			return -ENOMEM;
+		}
+	}
+
+	if (buffered)
+	{
+		ctx->out = open_memstream(&ctx->out_buffer, &ctx->out_size);
+		if (!ctx->out)
+		{
+			scan_ctx_free(ctx);
+			return -ENOMEM;
+		}
+	}
+
+	return 0;
+}
+
+void scan_ctx_free(struct scan_ctx * ctx)
+{
+	if (ctx->out)
+		fclose(ctx->out);
+
+	for (size_t i = 0; ctx->levs && i < ctx->lev_nb; ++i)
+		lev_ctx_free(&ctx->levs[i]);
+	free(ctx->levs);
+	free(ctx->out_buffer);
+	free(ctx->names);
+	free(ctx->syms);
+	free(ctx->indexes);
+	free(ctx->line);
+	if (ctx->ring)
+		uring_destroy(ctx->ring);
+	if (ctx->stats)
+		stats_free(ctx->stats);
+	free(ctx->stats);
+	memset(ctx, 0, sizeof(*ctx));
+}
+
+/* @brief Make room for the symbols of a library in the scratch arrays. */
+static int scan_ctx_reserve(struct scan_ctx * ctx, size_t count)
+{
+	char const ** names;
+	struct elf_symbol * syms;
+	size_t * indexes;
+	size_t capacity;
+
+	if (count <= ctx->capacity)
+		return 0;
+
+	capacity = ctx->capacity ? ctx->capacity : 1024;
+	while (capacity < count)
+		capacity *= 2;
+
+	names = realloc(ctx->names, capacity * sizeof(*names));
+	if (!names)
+		return -ENOMEM;
+	ctx->names = names;
+
+	syms = realloc(ctx->syms, capacity * sizeof(*syms));
+	if (!syms)
+		return -ENOMEM;
+	ctx->syms = syms;
+
+	indexes = realloc(ctx->indexes, capacity * sizeof(*indexes));
+	if (!indexes)
+		return -ENOMEM;
+	ctx->indexes = indexes;
+
+	ctx->capacity = capacity;
+
+	return 0;
+}
+
+/* @brief Check if a file is a shared elf object.
+ *
+ * Check the first four bytes of the file (magic numbers) to check its type.
+ *
+ * @param file_path The path of the file to open.
+ * @return 1 if the file is a shared elf object, 0 otherwise.
+ */
+static int file_is_shared_elf(char const * file_path)
+{
+	int res = 0;
+	char magic_numbers[4] = { 0 };
+
+	FILE * file = fopen(file_path, "r");
+	if (!file)
+	{
+		printf("Error: failed to open file %s: %s\n", file_path,
+			strerror(errno));
+		return 0;
+	}
+
+	size_t bytes_read = fread(magic_numbers, sizeof(char), 4, file);
+	if (bytes_read == 0)
+	{
+		int read_error = ferror(file);
+		if (read_error)
+		{
+			printf("Error: failed to read from file: %s\n",
+				file_path);
+			return 0;
+		}
+	}
+
+	res = fclose(file);
+	if (res)
+	{
+		printf("Error: failed to close file %s: %s\n", file_path,
+			strerror(errno));
+		res = 0;
+	}
+
+	if (magic_numbers[0] == 0x7f &&
+		magic_numbers[1] == 0x45 &&
+		magic_numbers[2] == 0x4c &&
+		magic_numbers[3] == 0x46)
+		res = 1;
+
+	return res;
+}
+
+static int search_nm(struct args * args, struct scan_ctx * ctx,
+		char const * file, FILE * out)
+{
+	uint64_t start = stats_now(ctx->stats);
+	int pfds[PFD_NUMBER] = { 0 };
+	int is_elf;
+	pid_t pid;
+	int ret = 0;
+
+	is_elf = file_is_shared_elf(file);
+	start = stats_phase(ctx->stats, STATS_MAGIC, start);
+	if (ctx->stats)
+	{
+		ctx->stats->elf += (size_t)is_elf;
+		ctx->stats->not_elf += (size_t)!is_elf;
+	}
+	if (!is_elf)
+		return 0;
+
+	if (args->verbose)
+		fprintf(out, "Searching in haystack: %s\n", file);
+
+	/* Other threads may fork at the same time, do not let their children
+	 * inherit this pipe or they would keep it open. */
+	ret = pipe2(pfds, O_CLOEXEC);
+	if (ret < 0)
+	{
+		printf("Error: failed to create pipe: %s.\n",
+				strerror(errno));
+		return ret;
+	}
+
+	pid = fork();
+	stats_phase(ctx->stats, STATS_NM, start);
+	switch (pid)
+	{
+		case -1:
+			printf("Error: failed to create child process: %s\n",
+					strerror(errno));
+			ret = errno;
+			break;
+		case PID_CHILD: /* Child process. */
+			run_child(file, pfds, args->verbose);
+			break;
+		default: /* Parent process. */
+			ret = run_parent(args, ctx, pfds, pid, file, out);
+			break;
+	}
+
+	if (ret < 0)
+		printf("The search for symbol '%s' failed. "
+			"Skipping...\n", file);
+
+	return ret;
+}
+
+/* @brief Count a file that could not be searched, and tell why unless it is
+ * simply not an ELF object. */
+static void search_skip(struct scan_ctx * ctx, char const * file, int error)
+{
+	if (error != -ENOEXEC)
+		printf("Error: failed to open file %s: %s\n", file,
+			strerror(-error));
+
+	if (!ctx->stats)
+		return;
+	if (error == -ENOEXEC)
+		ctx->stats->not_elf++;
+	else
+		ctx->stats->skipped++;
+}
+
+/* @brief Count the symbols of an ELF file that was searched. */
+static void search_count(struct scan_ctx * ctx, size_t symbols,
+		size_t matches, size_t bytes)
+{
+	if (!ctx->stats)
+		return;
+
+	ctx->stats->elf++;
+	ctx->stats->symbols += symbols;
+	ctx->stats->matches += matches;
+	ctx->stats->bytes += bytes;
+}
+
+/* @brief Give the number of bytes of an ELF file the search reads: its
+ * headers, its symbols and their strings, and the version tables when the
+ * symbols are filtered on their version. */
+static size_t search_bytes(struct args const * args,
+		struct elf_file const * elf)
+{
+	size_t bytes = elf->headers_size +
+		elf->dynsym_count * elf->dynsym_entsize + elf->dynstr_size;
+
+	if (args->filter.version)
+		bytes += elf->versym_size + elf->verdef_size +
+			elf->verneed_size;
+
+	return bytes;
+}
+
+/* @brief Read a symbol of a file and tell if it is worth scoring.
+ *
+ * @param args The arguments of the program.
+ * @param elf The file.
+ * @param index The index of the symbol.
+ * @param sym Filled with the symbol.
+ * @return 1 if the symbol passes the filters, 0 otherwise.
+ */
+static int search_symbol(struct args const * args,
+		struct elf_file const * elf, size_t index, struct elf_symbol * sym)
+{
+	if (elf_symbol(elf, index, sym) < 0 || !sym->name[0])
+		return 0;
+
+	if (!args->filter.active)
+		return 1;
+
+	if (args->filter.version)
+		sym->version = elf_version(elf, index);
+
+	return filter_symbol(&args->filter, sym);
+}
+
+/* @brief Gather the symbols named exactly like the needles through the hash
+ * tables of a file.
+ *
+ * @param args The arguments of the program.
+ * @param ctx The scratch memory of the thread, its names are filled.
+ * @param elf The file.
+ * @param count Set to the number of symbols gathered.
+ * @return 0 on success, -ENOENT if the file has no hash table.
+ */
+static int search_exact(struct args const * args, struct scan_ctx * ctx,
+		struct elf_file const * elf, size_t * count)
+{
+	size_t found = 0;
+
+	*count = 0;
+
+	for (size_t n = 0; n < args->needle_nb; ++n)
+	{
+		size_t nb;
+		int seen = 0;
+
+		/* A needle given twice would gather its symbols twice. */
+		for (size_t m = 0; m < n && !seen; ++m)
+			seen = !strcmp(args->needles[m], args->needles[n]);
+		if (seen)
+			continue;
+
+		if (elf_lookup(elf, args->needles[n], ctx->indexes + found,
+					ctx->capacity - found, &nb) < 0)
+			return -ENOENT;
+		found += nb;
+	}
+
+	for (size_t i = 0; i < found; ++i)
+	{
+		struct elf_symbol sym;
+
+		if (search_symbol(args, elf, ctx->indexes[i], &sym))
+			ctx->names[(*count)++] = sym.name;
+	}
+
+	return 0;
+}
+
+/* @brief Search the needles in the dynamic symbol table of a loaded file.
+ *
+ * @param args The arguments of the program.
+ * @param ctx The scratch memory of the thread.
+ * @param file The path of the file.
+ * @param elf The file, closed before returning.
+ * @param out The stream the matches are printed to.
+ * @param start When the file started to be loaded.
+ * @return 0 on success, -ENOMEM on failure.
+ */
+static int search_symbols(struct args * args, struct scan_ctx * ctx,
+		char const * file, struct elf_file * elf, FILE * out,
+		uint64_t start)
+{
+	size_t count = 0;
+	size_t matches;
+	int ret;
+
+	if (args->verbose)
+		fprintf(out, "Searching in haystack: %s\n", file);
+
+	ret = scan_ctx_reserve(ctx, elf->dynsym_count);
+	if (ret < 0)
+	{
+		elf_close(elf);
+		return ret;
+	}
+
+	/* Only the symbols named like a needle can be exact matches, the
+	 * hash tables find them without going through the whole table. */
+	if (args->min_distance < 100.0 ||
+			search_exact(args, ctx, elf, &count) < 0)
+	{
+		count = 0;
+
+		/* Index 0 is always the undefined symbol. */
+		for (size_t i = 1; i < elf->dynsym_count; ++i)
+		{
+			struct elf_symbol sym;
+
+			if (search_symbol(args, elf, i, &sym))
+				ctx->names[count++] = sym.name;
+		}
+	}
+
+	start = stats_phase(ctx->stats, STATS_OPEN, start);
+	matches = match_symbols(args, ctx->levs, out, file, ctx->names, count);
+	stats_phase(ctx->stats, STATS_MATCH, start);
+	search_count(ctx, count, matches, search_bytes(args, elf));
+
+	elf_close(elf);
+
+	return 0;
+}
+
+/* @brief Search the needles in the dynamic symbol table of an ELF file.
+ *
+ * The file is mapped in memory and .dynsym is walked directly, without
+ * spawning any process.
+ *
+ * @param args The arguments of the program.
+ * @param ctx The scratch memory of the thread.
+ * @param file The path of the file to search.
+ * @param out The stream the matches are printed to.
+ * @return 0 on success or if the file is not an ELF object.
+ */
+static int search_elf(struct args * args, struct scan_ctx * ctx,
+		char const * file, FILE * out)
+{
+	uint64_t start = stats_now(ctx->stats);
+	struct elf_file elf;
+	int ret;
+
+	ret = elf_open(&elf, file);
+	if (ret < 0)
+	{
+		stats_phase(ctx->stats, STATS_OPEN, start);
+		search_skip(ctx, file, ret);
+		return 0;
+	}
+
+	return search_symbols(args, ctx, file, &elf, out, start);
+}
+
+/* @brief Search the needles in a file through the symbol index.
+ *
+ * The symbols come from the index when it holds an up to date entry for the
+ * file. Otherwise they are extracted from the ELF file and recorded.
+ *
+ * @param args The arguments of the program.
+ * @param ctx The scratch memory of the thread.
+ * @param file The path of the file to search.
+ * @param out The stream the matches are printed to.
+ * @return 0 on success, -ENOMEM if the index could not be updated.
+ */
+static int search_index(struct args * args, struct scan_ctx * ctx,
+		char const * file, FILE * out)
+{
+	uint64_t start = stats_now(ctx->stats);
+	struct index_view view;
+	struct elf_file elf;
+	struct stat statbuff;
+	size_t count = 0;
+	size_t kept = 0;
+	size_t matches = 0;
+	int found;
+	int ret;
+
+	if (stat(file, &statbuff) < 0)
+	{
+		printf("Failed to stat file '%s': %s. Skipping...\n", file,
+			strerror(errno));
+		if (ctx->stats)
+			ctx->stats->skipped++;
+		return 0;
+	}
+
+	found = index_lookup(args->index, &statbuff, &view);
+	start = stats_phase(ctx->stats, STATS_INDEX, start);
+
+	if (found)
+	{
+		if (ctx->stats)
+			ctx->stats->index_hits++;
+
+		if (view.flags & INDEX_NOT_ELF)
+		{
+			if (ctx->stats)
+				ctx->stats->not_elf++;
+			return 0;
+		}
+
+		if (!args->needle_nb)
+		{
+			search_count(ctx, 0, 0, 0);
+			return 0;
+		}
+
+		if (args->verbose)
+			fprintf(out, "Searching in haystack: %s\n", file);
+
+		ret = scan_ctx_reserve(ctx, view.count);
+		if (ret < 0)
+			return ret;
+
+		for (size_t i = 0; i < view.count; ++i)
+		{
+			struct index_sym const * stored = &view.syms[i];
+			struct elf_symbol sym = {
+				.name = view.strings + stored->name,
+				.info = stored->info,
+				.other = stored->other,
+				.shndx = stored->shndx,
+				.version = stored->version == INDEX_NO_VERSION ?
+					NULL : view.strings + stored->version
+			};
+
+			if (!args->filter.active ||
+					filter_symbol(&args->filter, &sym))
+				ctx->names[count++] = sym.name;
+		}
+
+		matches = match_symbols(args, ctx->levs, out, file, ctx->names,
+				count);
+		stats_phase(ctx->stats, STATS_MATCH, start);
+		search_count(ctx, count, matches, 0);
+
+		return 0;
+	}
+
+	ret = elf_open(&elf, file);
+	start = stats_phase(ctx->stats, STATS_OPEN, start);
+	if (ret < 0)
+	{
+		search_skip(ctx, file, ret);
+		if (ret != -ENOEXEC)
+			return 0;
+
+		ret = index_add(args->index, &statbuff, INDEX_NOT_ELF, NULL, 0);
+		stats_phase(ctx->stats, STATS_INDEX, start);
+		return ret;
+	}
+
+	ret = scan_ctx_reserve(ctx, elf.dynsym_count);
+	if (ret < 0)
+	{
+		elf_close(&elf);
+		return ret;
+	}
+
+	/* Index 0 is always the undefined symbol. */
+	for (size_t i = 1; i < elf.dynsym_count; ++i)
+	{
+		if (elf_symbol(&elf, i, &ctx->syms[count]) < 0 ||
+				!ctx->syms[count].name[0])
+			continue;
+		ctx->syms[count].version = elf_version(&elf, i);
+		count++;
+	}
+	start = stats_phase(ctx->stats, STATS_OPEN, start);
+
+	/* The index keeps every symbol, the filters of later runs may
+	 * differ. */
+	ret = index_add(args->index, &statbuff, 0, ctx->syms, count);
+	start = stats_phase(ctx->stats, STATS_INDEX, start);
+
+	for (size_t i = 0; i < count; ++i)
+	{
+		if (!args->filter.active ||
+				filter_symbol(&args->filter, &ctx->syms[i]))
+			ctx->names[kept++] = ctx->syms[i].name;
+	}
+
+	if (args->needle_nb)
+	{
+		if (args->verbose)
+			fprintf(out, "Searching in haystack: %s\n", file);
+
+		matches = match_symbols(args, ctx->levs, out, file, ctx->names,
+				kept);
+		stats_phase(ctx->stats, STATS_MATCH, start);
+	}
+	search_count(ctx, args->needle_nb ? kept : 0, matches,
+			search_bytes(args, &elf));
+
+	elf_close(&elf);
+
+	return ret;
+}
+
+int search_file(struct args * args, struct scan_ctx * ctx, char const * file,
+		FILE * out)
+{
+	uint64_t start = stats_now(ctx->stats);
+	size_t elf = ctx->stats ? ctx->stats->elf : 0;
+	int ret;
+
+	if (args->store)
+		return store_file(args->store, file);
+
+	if (ctx->stats)
+		ctx->stats->files++;
+
+	if (args->index)
+		ret = search_index(args, ctx, file, out);
+	else if (!args->use_nm)
+		ret = search_elf(args, ctx, file, out);
+	else
+		ret = search_nm(args, ctx, file, out);
+
+	/* Only the files searched as ELF objects are libraries. */
+	if (ret >= 0 && ctx->stats && ctx->stats->elf != elf)
+		stats_library(ctx->stats, file, start);
+
+	return ret;
+}
+
+/* @brief Print the matches gathered for a file, and record them in watch
+ * mode. */
+static void search_flush(struct args * args, struct scan_ctx * ctx,
+		char const * file)
+{
+	if (!fflush(ctx->out))
+	{
+		if (args->watch)
+			watch_record(args->watch, file, ctx->out_buffer,
+					ctx->out_size);
+		if (ctx->out_size)
+			fwrite(ctx->out_buffer, 1, ctx->out_size, stdout);
+	}
+
+	/* Rewind the stream, its buffer is reused for the next file. */
+	fseek(ctx->out, 0, SEEK_SET);
+}
+
+void search_task(void * data, unsigned worker, char * file)
+{
+	struct args * args = data;
+	struct scan_ctx * ctx = &args->scan_ctxs[worker];
+
+	search_file(args, ctx, file, ctx->out);
+	search_flush(args, ctx, file);
+}
+
+void search_batch_task(void * data, unsigned worker, char * batch)
+{
+	struct args * args = data;
+	struct scan_ctx * ctx = &args->scan_ctxs[worker];
+	FILE * out = ctx->out ? ctx->out : stdout;
+	char const * paths[URING_BATCH];
+	struct elf_file elfs[URING_BATCH];
+	int results[URING_BATCH];
+
+	while (*batch)
+	{
+		uint64_t start = stats_now(ctx->stats);
+		uint64_t share;
+		size_t count = 0;
+
+		for (; *batch && count < URING_BATCH; ++count)
+		{
+			paths[count] = batch;
+			batch += strlen(batch) + 1;
+		}
+
+		uring_load(ctx->ring, paths, count, elfs, results);
+
+		/* The reads of a batch overlap, they are not told apart
+		 * between its files. Each is charged an even share, so that
+		 * its time still includes loading it. */
+		share = (stats_phase(ctx->stats, STATS_OPEN, start) - start) /
+			count;
+
+		for (size_t i = 0; i < count; ++i)
+		{
+			uint64_t file_start = stats_now(ctx->stats);
+
+			if (ctx->stats)
+				ctx->stats->files++;
+
+			if (results[i] < 0)
+				search_skip(ctx, paths[i], results[i]);
+			else if (search_symbols(args, ctx, paths[i], &elfs[i], out,
+						file_start) < 0)
+				printf("Failed to allocate memory: %s\n",
+					strerror(ENOMEM));
+			else
+				stats_library(ctx->stats, paths[i],
+						file_start - share);
+
+			if (ctx->out)
+				search_flush(args, ctx, paths[i]);
+		}
+	}
+}
@@ -0,0 +1,666 @@
+/* moses Find symbol in shared libraries.
+ * Copyright (C) 2022  Mathias Schmitt
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "bktree.h"
+#include "common.h"
+#include "levenshtein.h"
+#include "match.h"
+#include "qgram.h"
+#include "serve.h"
+#include "store.h"
+#include "symspell.h"
+#include "topk.h"
+
+struct server
+{
+	struct args * args;
+	struct qgram_index qgram;
+	struct bktree bktree;
+	struct symspell symspell;
+
+	/* The connected clients, shut down when the server stops. */
+	pthread_mutex_t lock;
+	pthread_cond_t done;
+	int * clients;
+	size_t client_nb;
+	size_t capacity;
+};
+
+struct client
+{
+	struct server * server;
+	int fd;
+};
+
+static volatile sig_atomic_t serve_stop;
+
+static void serve_signal(int sig)
+{
+	(void)sig;
+	serve_stop = 1;
+}
+
+/* @brief Read exactly size bytes.
+ *
+ * @return 1 on success, 0 if the peer closed the connection before the first
+ * byte, less than 0 otherwise.
+ */
+static int read_full(int fd, void * buffer, size_t size)
+{
+	char * p = buffer;
+	size_t done = 0;
+
+	while (done < size)
+	{
+		ssize_t ret = read(fd, p + done, size - done);
+
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret < 0)
+			return -errno;
+		if (ret == 0)
+			return done ? -EPIPE : 0;
+		done += (size_t)ret;
+	}
+
+	return 1;
+}
+
+static int write_full(int fd, void const * buffer, size_t size)
+{
+	char const * p = buffer;
+	size_t done = 0;
+
+	while (done < size)
+	{
+		ssize_t ret = send(fd, p + done, size - done, MSG_NOSIGNAL);
+
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret < 0)
+			return -errno;
+		done += (size_t)ret;
+	}
+
+	return 0;
+}
+
+/* @brief Give the largest edit count a match may have.
+ *
+ * The distance is relative to the lengths, so every length of the index
+ * gives its own bound.
+ *
+ * @param index The q-gram index, for the lengths of the names.
+ * @param args The arguments of the query.
+ * @param m The length of the needle.
+ * @param longest Set to the length of the longest name that may match.
+ * @return The largest bound, -1 if no name may match.
+ */
+static int serve_radius(struct qgram_index const * index,
+		struct args const * args, size_t m, size_t * longest)
+{
+	int k = -1;
+
+	*longest = 0;
+	for (size_t n = 0; n <= index->max_len; ++n)
+	{
+		int max = lev_max_edits(args->min_distance, m, n);
+		size_t diff = n > m ? n - m : m - n;
+
+		if (max < 0 || diff > (size_t)max)
+			continue;
+		if (max > k)
+			k = max;
+		*longest = n;
+	}
+
+	return k;
+}
+
+/* @brief Answer a query allowing few edits through the SymSpell index.
+ *
+ * @return 1 if the query was answered, 0 if the index is missing, more edits
+ * are allowed or names too long to be indexed may match, -ENOMEM on
+ * failure.
+ */
+static int serve_symspell(struct server const * server,
+		struct args const * args, struct lev_ctx * lev, FILE * out)
+{
+	struct qgram_index const * index = &server->qgram;
+	struct symspell_result result = { 0 };
+	size_t longest;
+	int k;
+	int ret;
+
+	if (!server->symspell.entry_nb || args->topks)
+		return 0;
+
+	k = serve_radius(index, args, lev->needle_len, &longest);
+	if (k > server->symspell.max_edits || longest > SYMSPELL_MAX_LEN)
+		return 0;
+
+	ret = symspell_query(&server->symspell, index->names, index->lens, lev,
+			k, &result);
+	if (!ret)
+		ret = qgram_print(index, server->args->store, args, lev, out,
+				result.names, result.dists, result.count);
+
+	symspell_result_free(&result);
+
+	return ret < 0 ? ret : 1;
+}
+
+/* @brief Answer a query allowing few edits through the BK-tree.
+ *
+ * @return 1 if the query was answered, 0 if the tree is missing or more
+ * edits are allowed, -ENOMEM on failure.
+ */
+static int serve_bktree(struct server const * server, struct args const * args,
+		struct lev_ctx * lev, FILE * out)
+{
+	struct qgram_index const * index = &server->qgram;
+	struct bktree_result result = { 0 };
+	size_t longest;
+	int k;
+	int ret;
+
+	if (!server->bktree.node_nb || args->topks)
+		return 0;
+
+	/* The tree takes a single radius, the largest bound of any length. */
+	k = serve_radius(index, args, lev->needle_len, &longest);
+	if (k > BKTREE_MAX_EDITS)
+		return 0;
+
+	ret = bktree_query(&server->bktree, index->names, index->lens, lev, k,
+			&result);
+	if (!ret)
+		ret = qgram_print(index, server->args->store, args, lev, out,
+				result.names, result.dists, result.count);
+
+	bktree_result_free(&result);
+
+	return ret < 0 ? ret : 1;
+}
+
+/* @brief Score the symbols of the store against a needle.
+ *
+ * With --symspell or --bk-tree, queries allowing few edits go through the
+ * SymSpell index or the BK-tree. The
+ * q-gram index rules out most symbols when the minimum distance is high,
+ * otherwise every symbol is scored.
+ *
+ * @param server The server.
+ * @param request The query.
+ * @param needle The needle of the query.
+ * @param out The stream the matches are printed to.
+ * @return 0 on success, -ENOMEM on failure.
+ */
+static int serve_query(struct server const * server,
+		struct serve_request const * request, char * needle, FILE * out)
+{
+	struct store const * store = server->args->store;
+	struct topk * topk = NULL;
+	struct lev_ctx lev;
+	struct args args = {
+		.needles = &needle,
+		.needle_nb = 1,
+		.print_needle = !!(request->flags & SERVE_PRINT_NEEDLE),
+		.min_distance = request->min_distance,
+		.verbose = !!request->verbose,
+	};
+	int ret;
+
+	ret = lev_ctx_init(&lev, needle);
+	if (ret < 0)
+		return ret;
+
+	if (request->top)
+	{
+		topk = topk_create(request->top);
+		if (!topk)
+		{
+			lev_ctx_free(&lev);
+			return -ENOMEM;
+		}
+		args.top = request->top;
+		args.topks = &topk;
+	}
+
+	ret = serve_symspell(server, &args, &lev, out);
+	if (ret == 0)
+		ret = serve_bktree(server, &args, &lev, out);
+	if (ret == 0)
+		ret = qgram_query(&server->qgram, store, &args, &lev, out);
+	for (size_t i = 0; ret == 0 && i < store->lib_nb; ++i)
+		match_symbols(&args, &lev, out, store->libs[i].file,
+				store->libs[i].names, store->libs[i].count);
+
+	if (topk)
+	{
+		topk_print(topk, out, args.print_needle ? needle : NULL,
+				args.verbose);
+		topk_destroy(topk);
+	}
+
+	lev_ctx_free(&lev);
+
+	return ret < 0 ? ret : 0;
+}
+
+/* @brief Check a query before reading its needle. */
+static int request_valid(struct serve_request const * request)
+{
+	return request->size > 0 && request->size <= SERVE_MAX_NEEDLE &&
+		request->top <= MAX_TOP &&
+		request->min_distance <= 100.0;
+}
+
+static void server_remove(struct server * server, int fd)
+{
+	pthread_mutex_lock(&server->lock);
+
+	for (size_t i = 0; i < server->client_nb; ++i)
+	{
+		if (server->clients[i] != fd)
+			continue;
+
+		server->clients[i] = server->clients[--server->client_nb];
+		break;
+	}
+
+	pthread_cond_signal(&server->done);
+	pthread_mutex_unlock(&server->lock);
+}
+
+static void * serve_client(void * data)
+{
+	struct client * client = data;
+	struct server * server = client->server;
+	char * buffer = NULL;
+	size_t size = 0;
+	FILE * out;
+
+	out = open_memstream(&buffer, &size);
+
+	while (out)
+	{
+		struct serve_request request;
+		struct serve_response response = { 0 };
+		char * needle;
+
+		if (read_full(client->fd, &request, sizeof(request)) <= 0)
+			break;
+
+		if (!request_valid(&request))
+		{
+			response.status = -EINVAL;
+			write_full(client->fd, &response, sizeof(response));
+			break;
+		}
+
+		needle = malloc(request.size + 1);
+		if (!needle || read_full(client->fd, needle, request.size) <= 0)
+		{
+			free(needle);
+			break;
+		}
+		needle[request.size] = '\0';
+
+		response.status = serve_query(server, &request, needle, out);
+		free(needle);
+
+		if (fflush(out))
+			response.status = -ENOMEM;
+		if (response.status == 0)
+			response.size = (uint32_t)size;
+
+		if (write_full(client->fd, &response, sizeof(response)) < 0 ||
+				write_full(client->fd, buffer,
+					response.size) < 0)
+			break;
+
+		/* Rewind the stream, its buffer is reused for the next query. */
+		fseek(out, 0, SEEK_SET);
+	}
+
+	if (out)
+		fclose(out);
+	free(buffer);
+
+	server_remove(server, client->fd);
+	close(client->fd);
+	free(client);
+
+	return NULL;
+}
+
+/* @brief Start the thread of a newly connected client. */
+static int server_add(struct server * server, int fd)
+{
+	struct client * client = malloc(sizeof(*client));
+	pthread_attr_t attr;
+	pthread_t thread;
+	int ret = -ENOMEM;
+
+	if (!client)
+		return -ENOMEM;
+
+	client->server = server;
+	client->fd = fd;
+
+	pthread_mutex_lock(&server->lock);
+
+	if (server->client_nb == server->capacity)
+	{
+		size_t capacity = server->capacity ? server->capacity * 2 : 16;
+		int * clients = realloc(server->clients,
+				capacity * sizeof(*clients));
+
+		if (!clients)
+			goto END;
+		server->clients = clients;
+		server->capacity = capacity;
+	}
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	ret = -pthread_create(&thread, &attr, serve_client, client);
+	pthread_attr_destroy(&attr);
+	if (ret < 0)
+		goto END;
+
+	server->clients[server->client_nb++] = fd;
+
+END:
+	pthread_mutex_unlock(&server->lock);
+
+	if (ret < 0)
+		free(client);
+
+	return ret;
+}
+
+/* @brief Tell if a socket was left behind by a server that is gone.
+ *
+ * @return 1 if nothing listens on it anymore, 0 if a server still does,
+ * less than 0 on failure.
+ */
+static int serve_stale(struct sockaddr_un const * addr)
+{
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	int ret = 0;
+
+	if (fd < 0)
+		return -errno;
+
+	if (connect(fd, (struct sockaddr const *)addr, sizeof(*addr)) < 0)
+		ret = errno == ECONNREFUSED ? 1 : -errno;
+
+	close(fd);
+
+	return ret;
+}
+
+/* @brief Create the socket of the server.
+ *
+ * A stale socket, left behind by a server that is gone, is replaced, but
+ * not the one of a server still running.
+ */
+static int serve_listen(char const * path)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	struct stat statbuff;
+	int fd;
+
+	if (strlen(path) >= sizeof(addr.sun_path))
+		return -ENAMETOOLONG;
+	strcpy(addr.sun_path, path);
+
+	if (!lstat(path, &statbuff) && S_ISSOCK(statbuff.st_mode))
+	{
+		int ret = serve_stale(&addr);
+
+		if (ret == 0)
+			return -EADDRINUSE;
+		if (ret < 0)
+			return ret;
+		unlink(path);
+	}
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -errno;
+
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+			listen(fd, SOMAXCONN) < 0)
+	{
+		int ret = -errno;
+
+		close(fd);
+		return ret;
+	}
+
+	return fd;
+}
+
+int serve_run(struct args * args, char const * path)
+{
+	struct server server = { .args = args };
+	struct sigaction action = { .sa_handler = serve_signal };
+	sigset_t mask;
+	sigset_t old_mask;
+	int ret = 0;
+	int fd;
+
+	ret = qgram_build(&server.qgram, args->store);
+	if (ret == 0 && args->bktree)
+		ret = bktree_build(&server.bktree, server.qgram.names,
+				server.qgram.name_nb);
+	if (ret == 0 && args->symspell)
+		ret = symspell_build(&server.symspell, server.qgram.names,
+				server.qgram.lens, server.qgram.name_nb,
+				args->symspell);
+	if (ret < 0)
+	{
+		printf("Error: failed to index the symbols: %s\n",
+			strerror(-ret));
+		qgram_free(&server.qgram);
+		bktree_free(&server.bktree);
+		return ret;
+	}
+
+	fd = serve_listen(path);
+	if (fd < 0)
+	{
+		printf("Error: failed to listen on %s: %s\n", path,
+			strerror(-fd));
+		qgram_free(&server.qgram);
+		bktree_free(&server.bktree);
+		symspell_free(&server.symspell);
+		return fd;
+	}
+
+	pthread_mutex_init(&server.lock, NULL);
+	pthread_cond_init(&server.done, NULL);
+
+	/* The signals are only let through while waiting for a client, so
+	 * that none is lost between the check of serve_stop and the wait. The
+	 * client threads inherit the blocked mask. */
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &mask, &old_mask);
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+
+	printf("Serving %zu symbols (%zu distinct) from %zu libraries on %s\n",
+		args->store->symbol_nb, server.qgram.name_nb,
+		args->store->lib_nb, path);
+	if (args->symspell)
+		printf("SymSpell index: %zu deletions, %.1f MiB\n",
+			server.symspell.entry_nb,
+			(double)symspell_size(&server.symspell) / (1024 * 1024));
+	fflush(stdout);
+
+	while (!serve_stop)
+	{
+		struct pollfd pfd = { .fd = fd, .events = POLLIN };
+		int client;
+
+		if (ppoll(&pfd, 1, NULL, &old_mask) < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			ret = -errno;
+			break;
+		}
+
+		client = accept4(fd, NULL, NULL, SOCK_CLOEXEC);
+		if (client < 0)
+			continue;
+
+		if (server_add(&server, client) < 0)
+		{
+			printf("Error: failed to serve a client: %s\n",
+				strerror(ENOMEM));
+			close(client);
+		}
+	}
+
+	close(fd);
+	unlink(path);
+
+	/* Wake up the clients waiting for a query and wait for them. */
+	pthread_mutex_lock(&server.lock);
+	for (size_t i = 0; i < server.client_nb; ++i)
+		shutdown(server.clients[i], SHUT_RDWR);
+	while (server.client_nb)
+		pthread_cond_wait(&server.done, &server.lock);
+	pthread_mutex_unlock(&server.lock);
+
+	pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+	pthread_cond_destroy(&server.done);
+	pthread_mutex_destroy(&server.lock);
+	free(server.clients);
+	qgram_free(&server.qgram);
+	bktree_free(&server.bktree);
+	symspell_free(&server.symspell);
+
+	return ret;
+}
+
+int serve_connect(struct args * args, char const * path)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	char * buffer = NULL;
+	int ret = 0;
+	int fd;
+
+	if (strlen(path) >= sizeof(addr.sun_path))
+		return -ENAMETOOLONG;
+	strcpy(addr.sun_path, path);
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+	{
+		ret = -errno;
+		printf("Error: failed to connect to %s: %s\n", path,
+			strerror(-ret));
+		goto END;
+	}
+
+	for (size_t i = 0; i < args->needle_nb; ++i)
+	{
+		size_t len = strlen(args->needles[i]);
+		struct serve_request request = {
+			.size = (uint32_t)len,
+			.flags = args->print_needle ? SERVE_PRINT_NEEDLE : 0,
+			.top = (uint32_t)args->top,
+			.verbose = (uint32_t)args->verbose,
+			.min_distance = args->min_distance,
+		};
+		struct serve_response response;
+
+		if (len > SERVE_MAX_NEEDLE)
+		{
+			printf("Error: needle too long: %s\n", args->needles[i]);
+			ret = -EINVAL;
+			break;
+		}
+
+		ret = write_full(fd, &request, sizeof(request));
+		if (!ret)
+			ret = write_full(fd, args->needles[i], len);
+		if (!ret)
+			ret = read_full(fd, &response, sizeof(response));
+		if (ret == 0)
+			ret = -EPIPE;
+		if (ret < 0)
+		{
+			printf("Error: failed to query %s: %s\n", path,
+				strerror(-ret));
+			break;
+		}
+
+		if (response.status < 0)
+		{
+			ret = response.status;
+			printf("Error: the query failed: %s\n", strerror(-ret));
+			break;
+		}
+
+		free(buffer);
+		buffer = malloc(response.size ? response.size : 1);
+		if (!buffer)
+		{
+			ret = -ENOMEM;
+			break;
+		}
+
+		ret = response.size ? read_full(fd, buffer, response.size) : 1;
+		if (ret <= 0)
+		{
+			ret = ret ? ret : -EPIPE;
+			printf("Error: failed to query %s: %s\n", path,
+				strerror(-ret));
+			break;
+		}
+		ret = 0;
+
+		fwrite(buffer, 1, response.size, stdout);
+	}
+
+END:
+	free(buffer);
+	if (fd >= 0)
+		close(fd);
+
+	return ret;
+}
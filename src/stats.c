@@ -0,0 +1,207 @@
+/* moses Find symbol in shared libraries.
+ * Copyright (C) 2022  Mathias Schmitt
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "stats.h"
+
+static char const * const phase_names[STATS_PHASE_NB] = {
+	[STATS_WALK] = "walk",
+	[STATS_OPEN] = "open",
+	[STATS_MAGIC] = "magic",
+	[STATS_NM] = "nm",
+	[STATS_READ] = "read",
+	[STATS_INDEX] = "index",
+	[STATS_MATCH] = "match",
+};
+
+uint64_t stats_now(struct stats const * stats)
+{
+	struct timespec ts;
+
+	if (!stats)
+		return 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+uint64_t stats_phase(struct stats * stats, enum stats_phase phase,
+		uint64_t start)
+{
+	uint64_t now = stats_now(stats);
+
+	if (stats)
+		stats->phase_ns[phase] += now - start;
+
+	return now;
+}
+
+/* @brief Insert a library in the slowest ones, taking its path. */
+static void stats_insert(struct stats * stats, char * file, uint64_t ns)
+{
+	size_t i = stats->slowest_nb;
+
+	if (i == STATS_SLOWEST)
+	{
+		if (ns <= stats->slowest[i - 1].ns)
+		{
+			free(file);
+			return;
+		}
+		free(stats->slowest[--i].file);
+	}
+	else
+	{
+		stats->slowest_nb++;
+	}
+
+	for (; i && stats->slowest[i - 1].ns < ns; --i)
+		stats->slowest[i] = stats->slowest[i - 1];
+
+	stats->slowest[i].file = file;
+	stats->slowest[i].ns = ns;
+}
+
+void stats_library(struct stats * stats, char const * file, uint64_t start)
+{
+	uint64_t ns;
+	char * copy;
+
+	if (!stats)
+		return;
+
+	ns = stats_now(stats) - start;
+
+	/* Most libraries are not among the slowest, do not copy their path. */
+	if (stats->slowest_nb == STATS_SLOWEST &&
+			ns <= stats->slowest[STATS_SLOWEST - 1].ns)
+		return;
+
+	copy = strdup(file);
+	if (copy)
+		stats_insert(stats, copy, ns);
+}
+
+void stats_merge(struct stats * total, struct stats * stats)
+{
+	for (size_t i = 0; i < STATS_PHASE_NB; ++i)
+		total->phase_ns[i] += stats->phase_ns[i];
+
+	total->files += stats->files;
+	total->skipped += stats->skipped;
+	total->elf += stats->elf;
+	total->not_elf += stats->not_elf;
+	total->index_hits += stats->index_hits;
+	total->symbols += stats->symbols;
+	total->matches += stats->matches;
+	total->bytes += stats->bytes;
+
+	for (size_t i = 0; i < stats->slowest_nb; ++i)
+		stats_insert(total, stats->slowest[i].file, stats->slowest[i].ns);
+
+	memset(stats, 0, sizeof(*stats));
+}
+
+static double seconds(uint64_t ns)
+{
+	return (double)ns / 1e9;
+}
+
+/* @brief Print a path as a JSON string. */
+static void json_string(FILE * out, char const * str)
+{
+	fputc('"', out);
+	for (; *str; ++str)
+	{
+		unsigned char c = (unsigned char)*str;
+
+		if (c == '"' || c == '\\')
+			fprintf(out, "\\%c", c);
+		else if (c < 0x20)
+			fprintf(out, "\\u%04x", c);
+		else
+			fputc(c, out);
+	}
+	fputc('"', out);
+}
+
+static void stats_print_json(struct stats const * stats, FILE * out,
+		uint64_t wall_ns)
+{
+	fprintf(out, "{\"wall_s\": %.6f, \"files\": %zu, \"skipped\": %zu, "
+		"\"elf\": %zu, \"not_elf\": %zu, \"index_hits\": %zu, "
+		"\"symbols\": %zu, \"matches\": %zu, \"bytes\": %zu, "
+		"\"phases\": {", seconds(wall_ns), stats->files,
+		stats->skipped, stats->elf, stats->not_elf, stats->index_hits,
+		stats->symbols, stats->matches, stats->bytes);
+
+	for (size_t i = 0; i < STATS_PHASE_NB; ++i)
+		fprintf(out, "%s\"%s_s\": %.6f", i ? ", " : "", phase_names[i],
+			seconds(stats->phase_ns[i]));
+
+	fprintf(out, "}, \"slowest\": [");
+	for (size_t i = 0; i < stats->slowest_nb; ++i)
+	{
+		fprintf(out, "%s{\"file\": ", i ? ", " : "");
+		json_string(out, stats->slowest[i].file);
+		fprintf(out, ", \"time_s\": %.6f}",
+			seconds(stats->slowest[i].ns));
+	}
+	fprintf(out, "]}\n");
+}
+
+void stats_print(struct stats const * stats, FILE * out, int json,
+		uint64_t wall_ns)
+{
+	if (json)
+	{
+		stats_print_json(stats, out, wall_ns);
+		return;
+	}
+
+	fprintf(out, "Statistics:\n");
+	fprintf(out, "  wall time       %10.6f s\n", seconds(wall_ns));
+	fprintf(out, "  files           %10zu\n", stats->files);
+	fprintf(out, "    skipped       %10zu\n", stats->skipped);
+	fprintf(out, "    ELF           %10zu\n", stats->elf);
+	fprintf(out, "    not ELF       %10zu\n", stats->not_elf);
+	fprintf(out, "    from index    %10zu\n", stats->index_hits);
+	fprintf(out, "  symbols scored  %10zu\n", stats->symbols);
+	fprintf(out, "  matches         %10zu\n", stats->matches);
+	fprintf(out, "  bytes read      %10zu\n", stats->bytes);
+
+	for (size_t i = 0; i < STATS_PHASE_NB; ++i)
+		fprintf(out, "  %-15s %10.6f s\n", phase_names[i],
+			seconds(stats->phase_ns[i]));
+
+	if (stats->slowest_nb)
+		fprintf(out, "  slowest libraries:\n");
+	for (size_t i = 0; i < stats->slowest_nb; ++i)
+		fprintf(out, "    %10.6f s  %s\n", seconds(stats->slowest[i].ns),
+			stats->slowest[i].file);
+}
+
+void stats_free(struct stats * stats)
+{
+	for (size_t i = 0; i < stats->slowest_nb; ++i)
+		free(stats->slowest[i].file);
+	memset(stats, 0, sizeof(*stats));
+}
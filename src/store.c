@@ -0,0 +1,161 @@
+/* moses Find symbol in shared libraries.
+ * Copyright (C) 2022  Mathias Schmitt
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "elfsym.h"
+#include "store.h"
+
+struct store * store_create(void)
+{
+	struct store * store = calloc(1, sizeof(*store));
+
+	if (!store)
+		return NULL;
+
+	pthread_mutex_init(&store->lock, NULL);
+
+	return store;
+}
+
+static void store_lib_free(struct store_lib * lib)
+{
+	free(lib->file);
+	free(lib->names);
+	free(lib->strings);
+}
+
+void store_destroy(struct store * store)
+{
+	for (size_t i = 0; i < store->lib_nb; ++i)
+		store_lib_free(&store->libs[i]);
+
+	pthread_mutex_destroy(&store->lock);
+	free(store->libs);
+	free(store);
+}
+
+/* @brief Copy the names of the dynamic symbols of a mapped file. */
+static int store_lib_load(struct store_lib * lib, struct elf_file const * elf)
+{
+	size_t size = 0;
+	char * p;
+
+	/* Index 0 is always the undefined symbol. */
+	for (size_t i = 1; i < elf->dynsym_count; ++i)
+	{
+		struct elf_symbol sym;
+
+		if (elf_symbol(elf, i, &sym) < 0 || !sym.name[0])
+			continue;
+
+		size += strlen(sym.name) + 1;
+		lib->count++;
+	}
+
+	lib->names = malloc(lib->count * sizeof(*lib->names) + 1);
+	lib->strings = malloc(size + 1);
+	if (!lib->names || !lib->strings)
+		return -ENOMEM;
+
+	p = lib->strings;
+	lib->count = 0;
+	for (size_t i = 1; i < elf->dynsym_count; ++i)
+	{
+		struct elf_symbol sym;
+		size_t len;
+
+		if (elf_symbol(elf, i, &sym) < 0 || !sym.name[0])
+			continue;
+
+		len = strlen(sym.name) + 1;
+		memcpy(p, sym.name, len);
+		lib->names[lib->count++] = p;
+		p += len;
+	}
+
+	return 0;
+}
+
+int store_file(struct store * store, char const * file)
+{
+	struct store_lib lib = { 0 };
+	struct elf_file elf;
+	int ret;
+
+	ret = elf_open(&elf, file);
+	if (ret == -ENOEXEC)
+		return 0;
+	if (ret < 0)
+	{
+		printf("Error: failed to open file %s: %s\n", file,
+			strerror(-ret));
+		return 0;
+	}
+
+	lib.file = strdup(file);
+	ret = lib.file ? store_lib_load(&lib, &elf) : -ENOMEM;
+	elf_close(&elf);
+	if (ret < 0)
+		goto ERROR;
+
+	pthread_mutex_lock(&store->lock);
+
+	if (store->lib_nb == store->capacity)
+	{
+		size_t capacity = store->capacity ? store->capacity * 2 : 64;
+		struct store_lib * libs = realloc(store->libs,
+				capacity * sizeof(*libs));
+
+		if (!libs)
+		{
+			pthread_mutex_unlock(&store->lock);
+			ret = -ENOMEM;
+			goto ERROR;
+		}
+		store->libs = libs;
+		store->capacity = capacity;
+	}
+
+	store->libs[store->lib_nb++] = lib;
+	store->symbol_nb += lib.count;
+
+	pthread_mutex_unlock(&store->lock);
+
+	return 0;
+
+ERROR:
+	store_lib_free(&lib);
+	return ret;
+}
+
+static int store_lib_compare(void const * l1, void const * l2)
+{
+	struct store_lib const * lib1 = l1;
+	struct store_lib const * lib2 = l2;
+
+	return strcmp(lib1->file, lib2->file);
+}
+
+void store_sort(struct store * store)
+{
+	qsort(store->libs, store->lib_nb, sizeof(*store->libs),
+			store_lib_compare);
+}
@@ -0,0 +1,420 @@
+/* moses Find symbol in shared libraries.
+ * Copyright (C) 2022  Mathias Schmitt
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cache.h"
+#include "levenshtein.h"
+#include "symspell.h"
+
+typedef int (*variant_fn)(void * data, uint32_t key);
+
+/* State of the two passes over the variants of the names. */
+struct builder
+{
+	struct symspell * index;
+	uint32_t * cursor;
+	uint32_t name;
+};
+
+/* The variants of a needle. */
+struct variants
+{
+	uint32_t * keys;
+	size_t count;
+	size_t capacity;
+};
+
+static uint32_t variant_key(char const * str, size_t len)
+{
+	uint64_t hash = cache_hash(str, len);
+
+	return (uint32_t)(hash ^ hash >> 32);
+}
+
+/* @brief Call fn on every string made by deleting 1 to edits characters of
+ * buffer, each set of positions once.
+ *
+ * The buffer is modified during the walk, and restored.
+ */
+static int variants_walk(char * buffer, size_t len, size_t start, int edits,
+		variant_fn fn, void * data)
+{
+	int ret = 0;
+
+	for (size_t i = start; i < len && ret >= 0; ++i)
+	{
+		char removed = buffer[i];
+
+		memmove(buffer + i, buffer + i + 1, len - i - 1);
+
+		ret = fn(data, variant_key(buffer, len - 1));
+		if (ret >= 0 && edits > 1)
+			ret = variants_walk(buffer, len - 1, i, edits - 1, fn,
+					data);
+
+		memmove(buffer + i + 1, buffer + i, len - i - 1);
+		buffer[i] = removed;
+	}
+
+	return ret;
+}
+
+/* @brief Call fn on a string and all its deletion variants. */
+static int variants_of(char const * str, size_t len, int edits,
+		variant_fn fn, void * data)
+{
+	char buffer[SYMSPELL_MAX_LEN + 1];
+	char * copy = len <= SYMSPELL_MAX_LEN ? buffer : malloc(len);
+	int ret;
+
+	if (!copy)
+		return -ENOMEM;
+	memcpy(copy, str, len);
+
+	ret = fn(data, variant_key(copy, len));
+	if (ret >= 0 && edits > 0)
+		ret = variants_walk(copy, len, 0, edits, fn, data);
+
+	if (copy != buffer)
+		free(copy);
+
+	return ret;
+}
+
+static uint32_t bucket_of(struct symspell const * index, uint32_t key)
+{
+	return index->bits ? key >> (32 - index->bits) : 0;
+}
+
+static int builder_count(void * data, uint32_t key)
+{
+	struct builder * builder = data;
+
+	builder->index->bucket_start[bucket_of(builder->index, key)]++;
+
+	return 0;
+}
+
+static int builder_fill(void * data, uint32_t key)
+{
+	struct builder * builder = data;
+	struct symspell * index = builder->index;
+	uint32_t pos = builder->cursor[bucket_of(index, key)]++;
+
+	index->keys[pos] = key;
+	index->names[pos] = builder->name;
+
+	return 0;
+}
+
+static int u64_compare(void const * v1, void const * v2)
+{
+	uint64_t a = *(uint64_t const *)v1;
+	uint64_t b = *(uint64_t const *)v2;
+
+	return (a > b) - (a < b);
+}
+
+static int u32_compare(void const * v1, void const * v2)
+{
+	uint32_t a = *(uint32_t const *)v1;
+	uint32_t b = *(uint32_t const *)v2;
+
+	return (a > b) - (a < b);
+}
+
+/* @brief Number of strings made by deleting up to k characters of a string
+ * of length n, duplicates included. */
+static uint64_t variant_count(uint64_t n, int k)
+{
+	uint64_t total = 0;
+	uint64_t binomial = 1;
+
+	for (uint64_t d = 0; d <= (uint64_t)k && d <= n; ++d)
+	{
+		total += binomial;
+		binomial = binomial * (n - d) / (d + 1);
+	}
+
+	return total;
+}
+
+/* @brief Sort every bucket by key and drop the names found twice under
+ * the same key. */
+static int symspell_compact(struct symspell * index)
+{
+	size_t bucket_nb = (size_t)1 << index->bits;
+	uint64_t * pairs;
+	size_t largest = 1;
+	uint32_t out = 0;
+
+	for (size_t b = 0; b < bucket_nb; ++b)
+	{
+		size_t size = index->bucket_start[b + 1] - index->bucket_start[b];
+
+		largest = size > largest ? size : largest;
+	}
+
+	pairs = malloc(largest * sizeof(*pairs));
+	if (!pairs)
+		return -ENOMEM;
+
+	for (size_t b = 0; b < bucket_nb; ++b)
+	{
+		uint32_t lo = index->bucket_start[b];
+		uint32_t hi = index->bucket_start[b + 1];
+		size_t size = hi - lo;
+
+		for (size_t i = 0; i < size; ++i)
+			pairs[i] = (uint64_t)index->keys[lo + i] << 32 |
+				index->names[lo + i];
+		qsort(pairs, size, sizeof(*pairs), u64_compare);
+
+		index->bucket_start[b] = out;
+		for (size_t i = 0; i < size; ++i)
+		{
+			if (i && pairs[i] == pairs[i - 1])
+				continue;
+			index->keys[out] = (uint32_t)(pairs[i] >> 32);
+			index->names[out++] = (uint32_t)pairs[i];
+		}
+	}
+	index->bucket_start[bucket_nb] = out;
+	index->entry_nb = out;
+
+	free(pairs);
+
+	return 0;
+}
+
+int symspell_build(struct symspell * index, char const * const * names,
+		uint32_t const * lens, size_t count, int max_edits)
+{
+	struct builder builder = { .index = index };
+	uint64_t total = 0;
+	size_t bucket_nb;
+	uint32_t sum = 0;
+	int ret = -ENOMEM;
+
+	memset(index, 0, sizeof(*index));
+	index->max_edits = max_edits;
+
+	for (size_t i = 0; i < count; ++i)
+	{
+		if (lens[i] <= SYMSPELL_MAX_LEN)
+			total += variant_count(lens[i], max_edits);
+	}
+	if (total >= UINT32_MAX || count >= UINT32_MAX)
+		return -EOVERFLOW;
+
+	/* About four variants per bucket. */
+	while (index->bits < 28 && ((uint64_t)4 << index->bits) < total)
+		index->bits++;
+	bucket_nb = (size_t)1 << index->bits;
+
+	index->bucket_start = calloc(bucket_nb + 1,
+			sizeof(*index->bucket_start));
+	index->keys = malloc((total ? total : 1) * sizeof(*index->keys));
+	index->names = malloc((total ? total : 1) * sizeof(*index->names));
+	builder.cursor = malloc(bucket_nb * sizeof(*builder.cursor));
+	if (!index->bucket_start || !index->keys || !index->names ||
+			!builder.cursor)
+		goto END;
+
+	/* Count the variants of each bucket, then place them. */
+	for (size_t i = 0; i < count; ++i)
+	{
+		if (lens[i] > SYMSPELL_MAX_LEN)
+			continue;
+		ret = variants_of(names[i], lens[i], max_edits, builder_count,
+				&builder);
+		if (ret < 0)
+			goto END;
+	}
+
+	for (size_t b = 0; b < bucket_nb; ++b)
+	{
+		uint32_t size = index->bucket_start[b];
+
+		index->bucket_start[b] = sum;
+		builder.cursor[b] = sum;
+		sum += size;
+	}
+	index->bucket_start[bucket_nb] = sum;
+
+	for (size_t i = 0; i < count; ++i)
+	{
+		if (lens[i] > SYMSPELL_MAX_LEN)
+			continue;
+		builder.name = (uint32_t)i;
+		ret = variants_of(names[i], lens[i], max_edits, builder_fill,
+				&builder);
+		if (ret < 0)
+			goto END;
+	}
+
+	ret = symspell_compact(index);
+
+END:
+	free(builder.cursor);
+	if (ret < 0)
+		symspell_free(index);
+
+	return ret;
+}
+
+void symspell_free(struct symspell * index)
+{
+	free(index->bucket_start);
+	free(index->keys);
+	free(index->names);
+	memset(index, 0, sizeof(*index));
+}
+
+size_t symspell_size(struct symspell const * index)
+{
+	if (!index->bucket_start)
+		return 0;
+
+	return (((size_t)1 << index->bits) + 1) * sizeof(*index->bucket_start) +
+		index->entry_nb * (sizeof(*index->keys) + sizeof(*index->names));
+}
+
+static int variants_add(void * data, uint32_t key)
+{
+	struct variants * variants = data;
+
+	if (variants->count == variants->capacity)
+	{
+		size_t capacity = variants->capacity ? variants->capacity * 2 :
+			256;
+		uint32_t * keys = realloc(variants->keys,
+				capacity * sizeof(*keys));
+
+		if (!keys)
+			return -ENOMEM;
+		variants->keys = keys;
+		variants->capacity = capacity;
+	}
+
+	variants->keys[variants->count++] = key;
+
+	return 0;
+}
+
+static int result_add(struct symspell_result * result, uint32_t name,
+		int dist)
+{
+	if (result->count == result->capacity)
+	{
+		size_t capacity = result->capacity ? result->capacity * 2 : 64;
+		uint32_t * names = realloc(result->names,
+				capacity * sizeof(*names));
+		int * dists;
+
+		if (!names)
+			return -ENOMEM;
+		result->names = names;
+
+		dists = realloc(result->dists, capacity * sizeof(*dists));
+		if (!dists)
+			return -ENOMEM;
+		result->dists = dists;
+		result->capacity = capacity;
+	}
+
+	result->names[result->count] = name;
+	result->dists[result->count++] = dist;
+
+	return 0;
+}
+
+int symspell_query(struct symspell const * index, char const * const * names,
+		uint32_t const * lens, struct lev_ctx * lev, int k,
+		struct symspell_result * result)
+{
+	struct variants variants = { 0 };
+	struct variants candidates = { 0 };
+	int ret;
+
+	result->count = 0;
+	result->verified = 0;
+	if (!index->entry_nb || k < 0)
+		return 0;
+
+	ret = variants_of(lev->needle, lev->needle_len, k, variants_add,
+			&variants);
+	if (ret < 0)
+		goto END;
+	qsort(variants.keys, variants.count, sizeof(*variants.keys),
+			u32_compare);
+
+	for (size_t v = 0; v < variants.count && ret >= 0; ++v)
+	{
+		uint32_t key = variants.keys[v];
+		uint32_t b = bucket_of(index, key);
+		uint32_t hi = index->bucket_start[b + 1];
+
+		if (v && key == variants.keys[v - 1])
+			continue;
+
+		for (uint32_t e = index->bucket_start[b]; e < hi &&
+				index->keys[e] <= key && ret >= 0; ++e)
+		{
+			if (index->keys[e] == key)
+				ret = variants_add(&candidates, index->names[e]);
+		}
+	}
+	if (ret < 0)
+		goto END;
+
+	qsort(candidates.keys, candidates.count, sizeof(*candidates.keys),
+			u32_compare);
+
+	/* Hash collisions are weeded out here too. */
+	for (size_t c = 0; c < candidates.count && ret >= 0; ++c)
+	{
+		uint32_t name = candidates.keys[c];
+		int dist;
+
+		if (c && name == candidates.keys[c - 1])
+			continue;
+
+		dist = lev_ctx_dist_bounded(lev, names[name], lens[name], k);
+		result->verified++;
+		if (dist < 0)
+			ret = dist;
+		else if (dist <= k)
+			ret = result_add(result, name, dist);
+	}
+
+END:
+	free(variants.keys);
+	free(candidates.keys);
+
+	return ret < 0 ? ret : 0;
+}
+
+void symspell_result_free(struct symspell_result * result)
+{
+	free(result->names);
+	free(result->dists);
+	memset(result, 0, sizeof(*result));
+}
@@ -0,0 +1,217 @@
+/* moses Find symbol in shared libraries.
+ * Copyright (C) 2022  Mathias Schmitt
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "topk.h"
+
+struct topk_entry
+{
+	double percent;
+	char * file;
+	char * symbol;
+};
+
+/* A heap whose root is the worst of the K best matches. */
+struct topk
+{
+	pthread_mutex_t lock;
+	struct topk_entry * heap;
+	size_t count;
+	size_t k;
+
+	/* Read without the lock by the scanning threads. */
+	_Atomic double threshold;
+};
+
+/* @brief Order two matches, best first. */
+static int entry_compare(struct topk_entry const * e1,
+		struct topk_entry const * e2)
+{
+	int ret;
+
+	if (e1->percent != e2->percent)
+		return e1->percent > e2->percent ? -1 : 1;
+
+	ret = strcmp(e1->symbol, e2->symbol);
+	if (ret)
+		return ret;
+
+	return strcmp(e1->file, e2->file);
+}
+
+static int entry_qsort(void const * e1, void const * e2)
+{
+	return entry_compare(e1, e2);
+}
+
+static void heap_swap(struct topk * topk, size_t i, size_t j)
+{
+	struct topk_entry tmp = topk->heap[i];
+
+	topk->heap[i] = topk->heap[j];
+	topk->heap[j] = tmp;
+}
+
+static void heap_up(struct topk * topk, size_t i)
+{
+	while (i)
+	{
+		size_t parent = (i - 1) / 2;
+
+		if (entry_compare(&topk->heap[i], &topk->heap[parent]) <= 0)
+			break;
+		heap_swap(topk, i, parent);
+		i = parent;
+	}
+}
+
+static void heap_down(struct topk * topk, size_t i)
+{
+	while (1)
+	{
+		size_t worst = i;
+		size_t left = 2 * i + 1;
+		size_t right = left + 1;
+
+		if (left < topk->count &&
+				entry_compare(&topk->heap[left],
+					&topk->heap[worst]) > 0)
+			worst = left;
+		if (right < topk->count &&
+				entry_compare(&topk->heap[right],
+					&topk->heap[worst]) > 0)
+			worst = right;
+		if (worst == i)
+			break;
+
+		heap_swap(topk, i, worst);
+		i = worst;
+	}
+}
+
+struct topk * topk_create(size_t k)
+{
+	struct topk * topk = calloc(1, sizeof(*topk));
+
+	if (!topk)
+		return NULL;
+
+	topk->heap = calloc(k, sizeof(*topk->heap));
+	if (!topk->heap)
+	{
+		free(topk);
+		return NULL;
+	}
+
+	topk->k = k;
+	atomic_init(&topk->threshold, 0.0);
+	pthread_mutex_init(&topk->lock, NULL);
+
+	return topk;
+}
+
+void topk_destroy(struct topk * topk)
+{
+	for (size_t i = 0; i < topk->count; ++i)
+	{
+		free(topk->heap[i].file);
+		free(topk->heap[i].symbol);
+	}
+
+	pthread_mutex_destroy(&topk->lock);
+	free(topk->heap);
+	free(topk);
+}
+
+double topk_threshold(struct topk * topk)
+{
+	return atomic_load_explicit(&topk->threshold, memory_order_relaxed);
+}
+
+int topk_offer(struct topk * topk, double percent, char const * file,
+		char const * symbol)
+{
+	struct topk_entry entry = { percent, (char *)file, (char *)symbol };
+	int ret = 0;
+
+	pthread_mutex_lock(&topk->lock);
+
+	if (topk->count == topk->k &&
+			entry_compare(&entry, &topk->heap[0]) >= 0)
+		goto END;
+
+	entry.file = strdup(file);
+	entry.symbol = strdup(symbol);
+	if (!entry.file || !entry.symbol)
+	{
+		free(entry.file);
+		free(entry.symbol);
+		ret = -ENOMEM;
+		goto END;
+	}
+
+	if (topk->count < topk->k)
+	{
+		topk->heap[topk->count++] = entry;
+		heap_up(topk, topk->count - 1);
+	}
+	else
+	{
+		free(topk->heap[0].file);
+		free(topk->heap[0].symbol);
+		topk->heap[0] = entry;
+		heap_down(topk, 0);
+	}
+
+	if (topk->count == topk->k)
+		atomic_store_explicit(&topk->threshold, topk->heap[0].percent,
+				memory_order_relaxed);
+
+END:
+	pthread_mutex_unlock(&topk->lock);
+
+	return ret;
+}
+
+void topk_print(struct topk * topk, FILE * out, char const * needle,
+		int verbose)
+{
+	pthread_mutex_lock(&topk->lock);
+
+	qsort(topk->heap, topk->count, sizeof(*topk->heap), entry_qsort);
+
+	for (size_t i = 0; i < topk->count; ++i)
+	{
+		if (needle)
+			fprintf(out, "%s\t", needle);
+		fprintf(out, "%s\t%s%s%.1f%%\n", topk->heap[i].file,
+				topk->heap[i].symbol,
+				verbose ? " matches " : "\t",
+				topk->heap[i].percent);
+	}
+
+	/* The heap order is lost, rebuild it. */
+	for (size_t i = topk->count; i > 0; --i)
+		heap_down(topk, i - 1);
+
+	pthread_mutex_unlock(&topk->lock);
+}
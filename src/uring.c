@@ -0,0 +1,465 @@
+/* moses Find symbol in shared libraries.
+ * Copyright (C) 2022  Mathias Schmitt
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <elf.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "uring.h"
+
+/* Each file has at most two reads in flight. */
+#define URING_ENTRIES (2 * URING_BATCH)
+
+/* Set in the user data of the read of the strings of a file. */
+#define URING_STRINGS ((uint64_t)1 << 32)
+
+/* Largest section header table and symbol tables read, any larger file is
+ * mapped instead. */
+#define URING_MAX_TABLE (64u * 1024 * 1024)
+
+/* Steps of the loading of a file. */
+enum load_step
+{
+	LOAD_OPEN,
+	LOAD_HEADER,
+	LOAD_SECTIONS,
+	LOAD_TABLES,
+	LOAD_DONE,
+	/* Left to elf_open, for the files the ring does not handle. */
+	LOAD_MAP
+};
+
+struct load
+{
+	enum load_step step;
+	int fd;
+	int result;
+	unsigned pending;
+	unsigned char header[sizeof(Elf64_Ehdr)];
+	struct elf_layout layout;
+	unsigned char * table;
+	size_t table_size;
+	unsigned char * buffer;
+};
+
+struct uring
+{
+	int fd;
+
+	void * sq_map;
+	size_t sq_map_size;
+	unsigned * sq_head;
+	unsigned * sq_tail;
+	unsigned sq_mask;
+	unsigned * sq_array;
+	struct io_uring_sqe * sqes;
+	size_t sqes_size;
+	/* Tail once the queued entries are published, and how many of them
+	 * the kernel has not consumed yet. */
+	unsigned tail;
+	unsigned to_submit;
+
+	void * cq_map;
+	size_t cq_map_size;
+	unsigned * cq_head;
+	unsigned * cq_tail;
+	unsigned cq_mask;
+	struct io_uring_cqe * cqes;
+
+	/* The files being loaded. The kernel writes in them, so they are
+	 * given up with the ring if it ever fails. */
+	struct load loads[URING_BATCH];
+	int broken;
+};
+
+struct uring * uring_create(void)
+{
+	struct io_uring_params params;
+	struct uring * ring = calloc(1, sizeof(*ring));
+	unsigned char * sq;
+	unsigned char * cq;
+
+	if (!ring)
+		return NULL;
+
+	memset(&params, 0, sizeof(params));
+	ring->fd = (int)syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+	if (ring->fd < 0)
+	{
+		int error = errno;
+
+		free(ring);
+		errno = error;
+		return NULL;
+	}
+
+	ring->sq_map_size = params.sq_off.array +
+		params.sq_entries * sizeof(unsigned);
+	ring->cq_map_size = params.cq_off.cqes +
+		params.cq_entries * sizeof(struct io_uring_cqe);
+
+	/* Recent kernels map both rings at once. */
+	if (params.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		if (ring->cq_map_size > ring->sq_map_size)
+			ring->sq_map_size = ring->cq_map_size;
+		ring->cq_map_size = 0;
+	}
+
+	ring->sq_map = mmap(NULL, ring->sq_map_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	if (ring->sq_map == MAP_FAILED)
+		goto FAIL;
+
+	ring->cq_map = ring->sq_map;
+	if (ring->cq_map_size)
+	{
+		ring->cq_map = mmap(NULL, ring->cq_map_size,
+				PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+				ring->fd, IORING_OFF_CQ_RING);
+		if (ring->cq_map == MAP_FAILED)
+			goto FAIL;
+	}
+
+	ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED)
+		goto FAIL;
+
+	sq = ring->sq_map;
+	ring->sq_head = (unsigned *)(sq + params.sq_off.head);
+	ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+	ring->sq_mask = *(unsigned *)(sq + params.sq_off.ring_mask);
+	ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+	ring->tail = *ring->sq_tail;
+
+	cq = ring->cq_map;
+	ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+	ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+	ring->cq_mask = *(unsigned *)(cq + params.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+	return ring;
+
+FAIL:
+	uring_destroy(ring);
+	return NULL;
+}
+
+void uring_destroy(struct uring * ring)
+{
+	int broken = ring->broken;
+
+	if (ring->sqes && ring->sqes != MAP_FAILED)
+		munmap(ring->sqes, ring->sqes_size);
+	if (ring->cq_map_size && ring->cq_map && ring->cq_map != MAP_FAILED)
+		munmap(ring->cq_map, ring->cq_map_size);
+	if (ring->sq_map && ring->sq_map != MAP_FAILED)
+		munmap(ring->sq_map, ring->sq_map_size);
+	close(ring->fd);
+	if (!broken)
+		free(ring);
+}
+
+/* @brief Queue an operation on behalf of a file.
+ *
+ * The ring is sized so that it never runs out of entries.
+ */
+static struct io_uring_sqe * uring_queue(struct uring * ring, uint8_t opcode,
+		uint64_t file)
+{
+	unsigned index = ring->tail++ & ring->sq_mask;
+	struct io_uring_sqe * sqe = &ring->sqes[index];
+
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = opcode;
+	sqe->user_data = file;
+	ring->sq_array[index] = index;
+	ring->to_submit++;
+
+	return sqe;
+}
+
+/* @brief Queue a read of part of a file. */
+static void uring_read(struct uring * ring, uint64_t file, int fd,
+		void * buffer, size_t size, uint64_t offset)
+{
+	struct io_uring_sqe * sqe = uring_queue(ring, IORING_OP_READ, file);
+
+	sqe->fd = fd;
+	sqe->addr = (uint64_t)(uintptr_t)buffer;
+	sqe->len = (uint32_t)size;
+	sqe->off = offset;
+}
+
+/* @brief Submit the queued operations and wait for at least one of them.
+ *
+ * @return 0 on success, a negative errno value if the ring failed.
+ */
+static int uring_enter(struct uring * ring)
+{
+	long ret;
+
+	__atomic_store_n(ring->sq_tail, ring->tail, __ATOMIC_RELEASE);
+
+	do
+	{
+		ret = syscall(__NR_io_uring_enter, ring->fd, ring->to_submit, 1,
+				IORING_ENTER_GETEVENTS, NULL, 0);
+	} while (ret < 0 && (errno == EINTR || errno == EAGAIN ||
+				errno == EBUSY));
+
+	if (ret < 0)
+		return -errno;
+
+	ring->to_submit -= (unsigned)ret;
+
+	return 0;
+}
+
+/* @brief Close a file once it needs no more operation. */
+static void load_finish(struct load * load, int result)
+{
+	load->result = result;
+	load->step = LOAD_DONE;
+	if (load->fd >= 0)
+		close(load->fd);
+	load->fd = -1;
+}
+
+/* @brief Leave a file to elf_open. */
+static void load_defer(struct load * load)
+{
+	load_finish(load, 0);
+	load->step = LOAD_MAP;
+}
+
+/* @brief Move a file to its next step once an operation completed.
+ *
+ * @param part Which of the reads of the tables completed.
+ * @return 1 if the file is done, 0 if operations are still in flight.
+ */
+static int load_advance(struct uring * ring, struct load * load, size_t file,
+		unsigned part, int res, struct elf_file * elf)
+{
+	uint64_t tables;
+	int ret;
+
+	/* Both reads of the tables must complete before the buffer is
+	 * released, a short one means that the file is truncated. */
+	if (load->step == LOAD_TABLES)
+	{
+		uint64_t size = part ? load->layout.dynstr_size :
+			load->layout.dynsym_size;
+
+		if (res < 0 || (uint64_t)res != size)
+			load->result = res < 0 ? res : -ENOEXEC;
+		if (--load->pending)
+			return 0;
+
+		if (load->result == 0)
+		{
+			elf_attach(elf, &load->layout, load->buffer);
+			load->buffer = NULL;
+		}
+		load_finish(load, load->result);
+		return 1;
+	}
+
+	if (res < 0)
+	{
+		load_finish(load, res);
+		return 1;
+	}
+
+	switch (load->step)
+	{
+		case LOAD_OPEN:
+			load->fd = res;
+			load->step = LOAD_HEADER;
+			uring_read(ring, file, load->fd, load->header,
+					sizeof(load->header), 0);
+			return 0;
+		case LOAD_HEADER:
+			ret = elf_read_header(&load->layout, load->header,
+					(size_t)res);
+			if (ret < 0 || !load->layout.shoff)
+			{
+				load_finish(load, ret);
+				return 1;
+			}
+
+			load->table_size = (size_t)(load->layout.shnum *
+					load->layout.shentsize);
+			if (!load->layout.shnum || load->table_size > URING_MAX_TABLE)
+			{
+				load_defer(load);
+				return 1;
+			}
+
+			if (!load->table_size)
+			{
+				load_finish(load, -ENOEXEC);
+				return 1;
+			}
+
+			load->table = malloc(load->table_size);
+			if (!load->table)
+			{
+				load_finish(load, -ENOMEM);
+				return 1;
+			}
+			load->step = LOAD_SECTIONS;
+			uring_read(ring, file, load->fd, load->table,
+					load->table_size, load->layout.shoff);
+			return 0;
+		case LOAD_SECTIONS:
+			ret = (size_t)res == load->table_size ? 0 : -ENOEXEC;
+			if (!ret)
+				ret = elf_read_sections(&load->layout, load->table,
+						load->table_size);
+			if (ret < 0 || !load->layout.dynsym_size)
+			{
+				load_finish(load, ret);
+				return 1;
+			}
+
+			tables = load->layout.dynsym_size + load->layout.dynstr_size;
+			if (tables > URING_MAX_TABLE)
+			{
+				load_defer(load);
+				return 1;
+			}
+
+			load->buffer = malloc((size_t)tables);
+			if (!load->buffer)
+			{
+				load_finish(load, -ENOMEM);
+				return 1;
+			}
+			load->step = LOAD_TABLES;
+			load->pending = 2;
+			uring_read(ring, file, load->fd, load->buffer,
+					(size_t)load->layout.dynsym_size,
+					load->layout.dynsym_offset);
+			uring_read(ring, file | URING_STRINGS, load->fd,
+					load->buffer + load->layout.dynsym_size,
+					(size_t)load->layout.dynstr_size,
+					load->layout.dynstr_offset);
+			return 0;
+		default:
+			return 1;
+	}
+}
+
+void uring_load(struct uring * ring, char const * const * paths,
+		size_t count, struct elf_file * elfs, int * results)
+{
+	struct load * loads;
+	size_t done = 0;
+
+	if (ring && ring->broken)
+		ring = NULL;
+	loads = ring ? ring->loads : calloc(count, sizeof(*loads));
+
+	for (size_t i = 0; loads && i < count; ++i)
+	{
+		memset(&elfs[i], 0, sizeof(elfs[i]));
+		memset(&loads[i], 0, sizeof(loads[i]));
+		loads[i].fd = -1;
+		loads[i].step = ring ? LOAD_OPEN : LOAD_MAP;
+
+		if (ring)
+		{
+			struct io_uring_sqe * sqe = uring_queue(ring,
+					IORING_OP_OPENAT, i);
+
+			sqe->fd = AT_FDCWD;
+			sqe->addr = (uint64_t)(uintptr_t)paths[i];
+			sqe->open_flags = O_RDONLY | O_CLOEXEC;
+		}
+		else
+		{
+			done++;
+		}
+	}
+
+	if (!loads)
+	{
+		for (size_t i = 0; i < count; ++i)
+			results[i] = elf_open(&elfs[i], paths[i]);
+		return;
+	}
+
+	while (done < count)
+	{
+		unsigned head;
+		unsigned tail;
+
+		if (uring_enter(ring) < 0)
+		{
+			/* Reads may still be in flight, their buffers are
+			 * given up and the ring is not used anymore. */
+			ring->broken = 1;
+			for (size_t i = 0; i < count; ++i)
+			{
+				if (loads[i].step >= LOAD_DONE)
+					continue;
+				loads[i].table = NULL;
+				loads[i].buffer = NULL;
+				load_defer(&loads[i]);
+			}
+			break;
+		}
+
+		head = *ring->cq_head;
+		tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+		for (; head != tail; ++head)
+		{
+			struct io_uring_cqe const * cqe =
+				&ring->cqes[head & ring->cq_mask];
+			size_t i = (size_t)(cqe->user_data & ~URING_STRINGS);
+
+			done += (size_t)load_advance(ring, &loads[i], i,
+					!!(cqe->user_data & URING_STRINGS),
+					cqe->res, &elfs[i]);
+		}
+		__atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+	}
+
+	for (size_t i = 0; i < count; ++i)
+	{
+		free(loads[i].table);
+		free(loads[i].buffer);
+
+		if (loads[i].step == LOAD_MAP)
+			results[i] = elf_open(&elfs[i], paths[i]);
+		else
+			results[i] = loads[i].result;
+	}
+
+	if (!ring)
+		free(loads);
+}
@@ -0,0 +1,455 @@
+/* moses Find symbol in shared libraries.
+ * Copyright (C) 2022  Mathias Schmitt
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include "common.h"
+#include "stats.h"
+#include "walk.h"
+#include "watch.h"
+
+#define WALK_BUFFER_SIZE (32 * 1024)
+#define WALK_INITIAL_SLOTS 1024
+
+/* Entry returned by getdents64, which glibc does not always declare. */
+struct walk_dirent
+{
+	uint64_t d_ino;
+	int64_t d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[];
+};
+
+/* A directory being read. Its buffer is kept when the level is popped,
+ * for the next directory at the same depth. */
+struct walk_level
+{
+	int fd;
+	dev_t dev;
+	size_t path_len;
+	char * buffer;
+	size_t pos;
+	size_t end;
+};
+
+/* A device and inode already walked. Both zero is a free slot. */
+struct walk_key
+{
+	uint64_t dev;
+	uint64_t ino;
+};
+
+struct walk
+{
+	struct args * args;
+
+	struct walk_level * levels;
+	size_t depth;
+	size_t level_capacity;
+
+	/* Path of the current entry. */
+	char * path;
+	size_t path_capacity;
+
+	/* A haystack which is a single file, given by the next walk_next. */
+	int pending;
+
+	struct walk_key * seen;
+	size_t seen_nb;
+	size_t seen_slots;
+};
+
+struct walk * walk_create(struct args * args)
+{
+	struct walk * walk = calloc(1, sizeof(*walk));
+
+	if (!walk)
+		return NULL;
+
+	walk->args = args;
+	walk->seen_slots = WALK_INITIAL_SLOTS;
+	walk->seen = calloc(walk->seen_slots, sizeof(*walk->seen));
+	if (!walk->seen)
+	{
+		free(walk);
+		return NULL;
+	}
+
+	return walk;
+}
+
+void walk_destroy(struct walk * walk)
+{
+	for (size_t i = 0; i < walk->level_capacity; ++i)
+	{
+		if (i < walk->depth)
+			close(walk->levels[i].fd);
+		free(walk->levels[i].buffer);
+	}
+
+	free(walk->levels);
+	free(walk->path);
+	free(walk->seen);
+	free(walk);
+}
+
+static size_t key_slot(struct walk const * walk, uint64_t dev, uint64_t ino)
+{
+	uint64_t h = ino ^ (dev * 0x9e3779b97f4a7c15u);
+
+	h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9u;
+	h = (h ^ (h >> 27)) * 0x94d049bb133111ebu;
+
+	return (size_t)(h ^ (h >> 31)) & (walk->seen_slots - 1);
+}
+
+static struct walk_key * key_find(struct walk * walk, uint64_t dev,
+		uint64_t ino)
+{
+	size_t i = key_slot(walk, dev, ino);
+
+	while (walk->seen[i].dev || walk->seen[i].ino)
+	{
+		if (walk->seen[i].dev == dev && walk->seen[i].ino == ino)
+			break;
+		i = (i + 1) & (walk->seen_slots - 1);
+	}
+
+	return &walk->seen[i];
+}
+
+/* @brief Mark a file as walked.
+ *
+ * @return 1 the first time, 0 if it was already walked, -ENOMEM on
+ * failure.
+ */
+static int walk_visit(struct walk * walk, dev_t dev, ino_t ino)
+{
+	struct walk_key * key;
+
+	if ((walk->seen_nb + 1) * 2 > walk->seen_slots)
+	{
+		struct walk_key * old = walk->seen;
+		size_t old_slots = walk->seen_slots;
+
+		walk->seen = calloc(old_slots * 2, sizeof(*walk->seen));
+		if (!walk->seen)
+		{
+			walk->seen = old;
+			return -ENOMEM;
+		}
+		walk->seen_slots = old_slots * 2;
+
+		for (size_t i = 0; i < old_slots; ++i)
+		{
+			if (old[i].dev || old[i].ino)
+				*key_find(walk, old[i].dev, old[i].ino) = old[i];
+		}
+		free(old);
+	}
+
+	key = key_find(walk, (uint64_t)dev, (uint64_t)ino);
+	if (key->dev || key->ino)
+		return 0;
+
+	key->dev = (uint64_t)dev;
+	key->ino = (uint64_t)ino;
+	walk->seen_nb++;
+
+	return 1;
+}
+
+/* @brief Set the path of the current entry to the path of a directory
+ * followed by a name. */
+static int walk_path(struct walk * walk, size_t dir_len, char const * name)
+{
+	size_t len = strlen(name);
+	size_t needed = dir_len + len + 2;
+
+	if (needed > walk->path_capacity)
+	{
+		size_t capacity = walk->path_capacity ? walk->path_capacity : 256;
+		char * path;
+
+		while (capacity < needed)
+			capacity *= 2;
+		path = realloc(walk->path, capacity);
+		if (!path)
+			return -ENOMEM;
+		walk->path = path;
+		walk->path_capacity = capacity;
+	}
+
+	if (dir_len && walk->path[dir_len - 1] != '/')
+		walk->path[dir_len++] = '/';
+	memcpy(walk->path + dir_len, name, len + 1);
+
+	return 0;
+}
+
+static void walk_skip(struct walk * walk, char const * what, int error)
+{
+	printf("Failed to %s file '%s': %s. Skipping...\n", what, walk->path,
+		strerror(error));
+	if (walk->args->stats)
+		walk->args->stats->skipped++;
+}
+
+/* @brief Start reading the directory at the current path.
+ *
+ * @param fd The descriptor of the directory, owned by the walk.
+ */
+static int walk_push(struct walk * walk, int fd)
+{
+	struct walk_level * level;
+	struct stat statbuff;
+	int ret;
+
+	if (fstat(fd, &statbuff) < 0)
+	{
+		walk_skip(walk, "stat", errno);
+		close(fd);
+		return 0;
+	}
+
+	/* A directory reached again through a link would loop forever. */
+	ret = walk_visit(walk, statbuff.st_dev, statbuff.st_ino);
+	if (ret <= 0)
+	{
+		close(fd);
+		return ret;
+	}
+
+	if (walk->args->watch && watch_directory(walk->args->watch,
+				walk->path) < 0)
+	{
+		close(fd);
+		return -ENOMEM;
+	}
+
+	if (walk->depth == walk->level_capacity)
+	{
+		size_t capacity = walk->level_capacity ?
+			walk->level_capacity * 2 : 16;
+		struct walk_level * levels = realloc(walk->levels,
+				capacity * sizeof(*levels));
+
+		if (!levels)
+		{
+			close(fd);
+			return -ENOMEM;
+		}
+		memset(levels + walk->level_capacity, 0,
+				(capacity - walk->level_capacity) * sizeof(*levels));
+		walk->levels = levels;
+		walk->level_capacity = capacity;
+	}
+
+	level = &walk->levels[walk->depth];
+	if (!level->buffer)
+	{
+		level->buffer = malloc(WALK_BUFFER_SIZE);
+		if (!level->buffer)
+		{
+			close(fd);
+			return -ENOMEM;
+		}
+	}
+
+	level->fd = fd;
+	level->dev = statbuff.st_dev;
+	level->path_len = strlen(walk->path);
+	level->pos = 0;
+	level->end = 0;
+	walk->depth++;
+
+	return 0;
+}
+
+int walk_start(struct walk * walk, char const * path)
+{
+	uint64_t start = stats_now(walk->args->stats);
+	struct stat statbuff;
+	int ret = 0;
+	int fd;
+
+	if (!strcmp(path, ".") || !strcmp(path, ".."))
+		return 0;
+
+	ret = walk_path(walk, 0, path);
+	if (ret < 0)
+		return ret;
+
+	if (stat(path, &statbuff) < 0)
+	{
+		ret = -errno;
+		walk_skip(walk, "stat", errno);
+	}
+	else if (S_ISREG(statbuff.st_mode))
+	{
+		walk->pending = walk_visit(walk, statbuff.st_dev,
+				statbuff.st_ino);
+		ret = walk->pending < 0 ? walk->pending : 0;
+	}
+	else if (S_ISDIR(statbuff.st_mode))
+	{
+		fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if (fd < 0)
+		{
+			ret = -errno;
+			walk_skip(walk, "open", errno);
+		}
+		else
+		{
+			ret = walk_push(walk, fd);
+		}
+	}
+	else
+	{
+		printf("File '%s' is neither a shared object nor a "
+			"directory. Skipping...\n", path);
+		if (walk->args->stats)
+			walk->args->stats->skipped++;
+	}
+
+	stats_phase(walk->args->stats, STATS_WALK, start);
+
+	return ret;
+}
+
+/* @brief Handle an entry of the directory on top of the stack.
+ *
+ * @return 1 if it is a regular file to search, 0 if it was skipped or is a
+ * directory now on the stack, -ENOMEM on failure.
+ */
+static int walk_entry(struct walk * walk, struct walk_dirent const * entry)
+{
+	struct walk_level * level = &walk->levels[walk->depth - 1];
+	unsigned char type = entry->d_type;
+	dev_t dev = level->dev;
+	ino_t ino = (ino_t)entry->d_ino;
+	int ret;
+	int fd;
+
+	/* Skip hidden files, '.' and '..' */
+	if (entry->d_name[0] == '.')
+		return 0;
+
+	ret = walk_path(walk, level->path_len, entry->d_name);
+	if (ret < 0)
+		return ret;
+
+	/* Links are followed, as stat did. */
+	if (type == DT_UNKNOWN || type == DT_LNK)
+	{
+		struct stat statbuff;
+
+		if (fstatat(level->fd, entry->d_name, &statbuff, 0) < 0)
+		{
+			walk_skip(walk, "stat", errno);
+			return 0;
+		}
+
+		type = S_ISREG(statbuff.st_mode) ? DT_REG :
+			S_ISDIR(statbuff.st_mode) ? DT_DIR : DT_UNKNOWN;
+		dev = statbuff.st_dev;
+		ino = statbuff.st_ino;
+	}
+
+	switch (type)
+	{
+		case DT_REG:
+			return walk_visit(walk, dev, ino);
+		case DT_DIR:
+			fd = openat(level->fd, entry->d_name,
+					O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+			if (fd < 0)
+			{
+				walk_skip(walk, "open", errno);
+				return 0;
+			}
+			return walk_push(walk, fd);
+		default:
+			printf("File '%s' is neither a shared object nor a "
+				"directory. Skipping...\n", walk->path);
+			if (walk->args->stats)
+				walk->args->stats->skipped++;
+			return 0;
+	}
+}
+
+int walk_next(struct walk * walk, char const ** file)
+{
+	uint64_t start = stats_now(walk->args->stats);
+	int ret = 0;
+
+	if (walk->pending)
+	{
+		walk->pending = 0;
+		*file = walk->path;
+		return 1;
+	}
+
+	while (!ret && walk->depth)
+	{
+		struct walk_level * level = &walk->levels[walk->depth - 1];
+		struct walk_dirent const * entry;
+
+		if (level->pos == level->end)
+		{
+			long size = syscall(SYS_getdents64, level->fd,
+					level->buffer, WALK_BUFFER_SIZE);
+
+			if (size <= 0)
+			{
+				if (size < 0)
+				{
+					walk->path[level->path_len] = '\0';
+					walk_skip(walk, "read", errno);
+				}
+				close(level->fd);
+				walk->depth--;
+				continue;
+			}
+
+			level->pos = 0;
+			level->end = (size_t)size;
+		}
+
+		entry = (struct walk_dirent const *)(level->buffer + level->pos);
+		level->pos += entry->d_reclen;
+
+		ret = walk_entry(walk, entry);
+	}
+
+	stats_phase(walk->args->stats, STATS_WALK, start);
+
+	if (ret > 0)
+		*file = walk->path;
+
+	return ret;
+}
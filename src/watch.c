@@ -0,0 +1,778 @@
+/* moses Find symbol in shared libraries.
+ * Copyright (C) 2022  Mathias Schmitt
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as published
+ * by the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+
+#include "common.h"
+#include "scan.h"
+#include "watch.h"
+
+#define WATCH_EVENTS (IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | \
+		IN_CREATE | IN_DELETE)
+
+/* The matches of a library. */
+struct watch_lib
+{
+	char * file;
+	char * matches;
+	size_t size;
+};
+
+/* A watched directory. */
+struct watch_dir
+{
+	int wd;
+	char * path;
+
+	/* The only library watched in the directory, or NULL for all. */
+	char * only;
+};
+
+struct watch
+{
+	int fd;
+
+	/* Sorted by path, so that the libraries of a directory follow each
+	 * other. */
+	pthread_mutex_t lock;
+	struct watch_lib * libs;
+	size_t lib_nb;
+	size_t lib_capacity;
+
+	struct watch_dir * dirs;
+	size_t dir_nb;
+	size_t dir_capacity;
+};
+
+/* A line of matches, not terminated. */
+struct line
+{
+	char const * str;
+	size_t len;
+};
+
+struct watch * watch_create(void)
+{
+	struct watch * watch = calloc(1, sizeof(*watch));
+
+	if (!watch)
+		return NULL;
+
+	watch->fd = inotify_init1(IN_CLOEXEC);
+	if (watch->fd < 0)
+	{
+		free(watch);
+		return NULL;
+	}
+
+	pthread_mutex_init(&watch->lock, NULL);
+
+	return watch;
+}
+
+void watch_destroy(struct watch * watch)
+{
+	for (size_t i = 0; i < watch->lib_nb; ++i)
+	{
+		free(watch->libs[i].file);
+		free(watch->libs[i].matches);
+	}
+
+	for (size_t i = 0; i < watch->dir_nb; ++i)
+	{
+		free(watch->dirs[i].path);
+		free(watch->dirs[i].only);
+	}
+
+	close(watch->fd);
+	pthread_mutex_destroy(&watch->lock);
+	free(watch->libs);
+	free(watch->dirs);
+	free(watch);
+}
+
+/* @brief Join a directory and a name the way the scan does. */
+static char * path_join(char const * dir, char const * name)
+{
+	size_t len = strlen(dir);
+	char * path;
+
+	if (asprintf(&path, "%s%s%s", dir, len && dir[len - 1] == '/' ? "" :
+				"/", name) < 0)
+		return NULL;
+
+	return path;
+}
+
+static struct watch_dir * watch_find_dir(struct watch * watch, int wd)
+{
+	for (size_t i = 0; i < watch->dir_nb; ++i)
+	{
+		if (watch->dirs[i].wd == wd)
+			return &watch->dirs[i];
+	}
+
+	return NULL;
+}
+
+/* @brief Find a watched directory from its path. */
+static struct watch_dir * watch_find_path(struct watch * watch,
+		char const * path)
+{
+	for (size_t i = 0; i < watch->dir_nb; ++i)
+	{
+		if (!strcmp(watch->dirs[i].path, path))
+			return &watch->dirs[i];
+	}
+
+	return NULL;
+}
+
+/* @brief Forget the watched directory at the given index. */
+static void watch_dir_remove(struct watch * watch, size_t i)
+{
+	free(watch->dirs[i].path);
+	free(watch->dirs[i].only);
+	watch->dirs[i] = watch->dirs[--watch->dir_nb];
+}
+
+static int watch_add(struct watch * watch, char const * path,
+		char const * only)
+{
+	struct watch_dir * dir;
+	int wd;
+
+	wd = inotify_add_watch(watch->fd, path, WATCH_EVENTS | IN_ONLYDIR);
+	if (wd < 0)
+	{
+		printf("Error: failed to watch %s: %s\n", path, strerror(errno));
+		return -errno;
+	}
+
+	/* A directory watched again, for all its libraries or for another
+	 * one, is watched entirely. */
+	dir = watch_find_dir(watch, wd);
+	if (dir)
+	{
+		if (dir->only && (!only || strcmp(dir->only, only)))
+		{
+			free(dir->only);
+			dir->only = NULL;
+		}
+		return 0;
+	}
+
+	if (watch->dir_nb == watch->dir_capacity)
+	{
+		size_t capacity = watch->dir_capacity ? watch->dir_capacity * 2 :
+			16;
+		struct watch_dir * dirs = realloc(watch->dirs,
+				capacity * sizeof(*dirs));
+
+		if (!dirs)
+			return -ENOMEM;
+		watch->dirs = dirs;
+		watch->dir_capacity = capacity;
+	}
+
+	dir = &watch->dirs[watch->dir_nb];
+	dir->wd = wd;
+	dir->path = strdup(path);
+	dir->only = only ? strdup(only) : NULL;
+	if (!dir->path || (only && !dir->only))
+	{
+		free(dir->path);
+		free(dir->only);
+		return -ENOMEM;
+	}
+	watch->dir_nb++;
+
+	return 0;
+}
+
+int watch_directory(struct watch * watch, char const * path)
+{
+	return watch_add(watch, path, NULL);
+}
+
+int watch_file(struct watch * watch, char const * path)
+{
+	char * dir = strdup(path);
+	char * slash;
+	int ret;
+
+	if (!dir)
+		return -ENOMEM;
+
+	slash = strrchr(dir, '/');
+	if (!slash)
+		ret = watch_add(watch, ".", path);
+	else if (slash == dir)
+		ret = watch_add(watch, "/", slash + 1);
+	else
+	{
+		*slash = '\0';
+		ret = watch_add(watch, dir, slash + 1);
+	}
+
+	free(dir);
+
+	return ret;
+}
+
+/* @brief Find where a library is, or would be, in the sorted array. */
+static size_t watch_lib_index(struct watch const * watch, char const * file)
+{
+	size_t lo = 0;
+	size_t hi = watch->lib_nb;
+
+	while (lo < hi)
+	{
+		size_t mid = lo + (hi - lo) / 2;
+
+		if (strcmp(watch->libs[mid].file, file) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+/* @brief Forget the library at the given index. */
+static void watch_lib_remove(struct watch * watch, size_t i)
+{
+	free(watch->libs[i].file);
+	free(watch->libs[i].matches);
+	memmove(&watch->libs[i], &watch->libs[i + 1],
+			(watch->lib_nb - i - 1) * sizeof(*watch->libs));
+	watch->lib_nb--;
+}
+
+int watch_record(struct watch * watch, char const * file,
+		char const * matches, size_t size)
+{
+	struct watch_lib * lib;
+	char * copy = NULL;
+	char * name = NULL;
+	size_t i;
+	int ret = 0;
+
+	if (size)
+	{
+		copy = malloc(size);
+		if (!copy)
+			return -ENOMEM;
+		memcpy(copy, matches, size);
+	}
+
+	pthread_mutex_lock(&watch->lock);
+
+	i = watch_lib_index(watch, file);
+	lib = &watch->libs[i];
+
+	if (i < watch->lib_nb && !strcmp(lib->file, file))
+	{
+		if (!size)
+		{
+			watch_lib_remove(watch, i);
+			goto END;
+		}
+
+		free(lib->matches);
+		lib->matches = copy;
+		lib->size = size;
+		copy = NULL;
+		goto END;
+	}
+
+	/* Libraries without any match are not worth remembering. */
+	if (!size)
+		goto END;
+
+	if (watch->lib_nb == watch->lib_capacity)
+	{
+		size_t capacity = watch->lib_capacity ? watch->lib_capacity * 2 :
+			64;
+		struct watch_lib * libs = realloc(watch->libs,
+				capacity * sizeof(*libs));
+
+		if (!libs)
+		{
+			ret = -ENOMEM;
+			goto END;
+		}
+		watch->libs = libs;
+		watch->lib_capacity = capacity;
+		lib = &watch->libs[i];
+	}
+
+	name = strdup(file);
+	if (!name)
+	{
+		ret = -ENOMEM;
+		goto END;
+	}
+
+	memmove(lib + 1, lib, (watch->lib_nb - i) * sizeof(*lib));
+	lib->file = name;
+	lib->matches = copy;
+	lib->size = size;
+	watch->lib_nb++;
+	copy = NULL;
+
+END:
+	pthread_mutex_unlock(&watch->lock);
+
+	free(copy);
+
+	return ret;
+}
+
+/* @brief Split matches in lines, sorted. */
+static struct line * split_lines(char const * matches, size_t size,
+		size_t * count)
+{
+	struct line * lines;
+	size_t nb = 0;
+
+	for (size_t i = 0; i < size; ++i)
+		nb += matches[i] == '\n';
+	if (size && matches[size - 1] != '\n')
+		nb++;
+
+	lines = malloc((nb ? nb : 1) * sizeof(*lines));
+	if (!lines)
+		return NULL;
+
+	*count = 0;
+	while (size)
+	{
+		char const * end = memchr(matches, '\n', size);
+		size_t len = end ? (size_t)(end - matches) : size;
+
+		lines[*count].str = matches;
+		lines[(*count)++].len = len;
+
+		len = end ? len + 1 : len;
+		matches += len;
+		size -= len;
+	}
+
+	return lines;
+}
+
+static int line_compare(void const * l1, void const * l2)
+{
+	struct line const * line1 = l1;
+	struct line const * line2 = l2;
+	size_t len = line1->len < line2->len ? line1->len : line2->len;
+	int ret = memcmp(line1->str, line2->str, len);
+
+	if (ret)
+		return ret;
+
+	return (line1->len > line2->len) - (line1->len < line2->len);
+}
+
+/* @brief Print the lines lost as "-" and the lines gained as "+". */
+static int print_delta(char const * old, size_t old_size, char const * new,
+		size_t new_size)
+{
+	struct line * old_lines;
+	struct line * new_lines;
+	size_t old_nb = 0;
+	size_t new_nb = 0;
+	size_t i = 0;
+	size_t j = 0;
+
+	old_lines = split_lines(old, old_size, &old_nb);
+	new_lines = split_lines(new, new_size, &new_nb);
+	if (!old_lines || !new_lines)
+	{
+		free(old_lines);
+		free(new_lines);
+		return -ENOMEM;
+	}
+
+	qsort(old_lines, old_nb, sizeof(*old_lines), line_compare);
+	qsort(new_lines, new_nb, sizeof(*new_lines), line_compare);
+
+	while (i < old_nb || j < new_nb)
+	{
+		int cmp = i == old_nb ? 1 : j == new_nb ? -1 :
+			line_compare(&old_lines[i], &new_lines[j]);
+
+		if (cmp < 0)
+		{
+			printf("-%.*s\n", (int)old_lines[i].len, old_lines[i].str);
+			i++;
+		}
+		else if (cmp > 0)
+		{
+			printf("+%.*s\n", (int)new_lines[j].len, new_lines[j].str);
+			j++;
+		}
+		else
+		{
+			i++;
+			j++;
+		}
+	}
+
+	free(old_lines);
+	free(new_lines);
+
+	return 0;
+}
+
+/* @brief Search a library again and print how its matches changed.
+ *
+ * A library that is gone, or is no longer one, loses all its matches.
+ */
+static int watch_refresh(struct args * args, char const * file)
+{
+	struct watch * watch = args->watch;
+	struct scan_ctx * ctx = &args->scan_ctxs[0];
+	struct watch_lib * lib;
+	struct stat statbuff;
+	size_t i;
+	int ret;
+
+	if (!stat(file, &statbuff) && S_ISREG(statbuff.st_mode))
+		search_file(args, ctx, file, ctx->out);
+
+	if (fflush(ctx->out))
+		return -ENOMEM;
+
+	i = watch_lib_index(watch, file);
+	lib = i < watch->lib_nb && !strcmp(watch->libs[i].file, file) ?
+		&watch->libs[i] : NULL;
+
+	ret = print_delta(lib ? lib->matches : NULL, lib ? lib->size : 0,
+			ctx->out_buffer, ctx->out_size);
+	if (!ret)
+		ret = watch_record(watch, file, ctx->out_buffer, ctx->out_size);
+
+	/* Rewind the stream, its buffer is reused for the next file. */
+	fseek(ctx->out, 0, SEEK_SET);
+
+	return ret;
+}
+
+/* @brief Forget everything below a directory that went away. */
+static void watch_forget(struct watch * watch, char const * path)
+{
+	char * prefix = path_join(path, "");
+	size_t len;
+	size_t i;
+
+	if (!prefix)
+		return;
+	len = strlen(prefix);
+
+	i = watch_lib_index(watch, prefix);
+	while (i < watch->lib_nb && !strncmp(watch->libs[i].file, prefix, len))
+	{
+		print_delta(watch->libs[i].matches, watch->libs[i].size, NULL, 0);
+		watch_lib_remove(watch, i);
+	}
+
+	/* The kernel confirms with IN_IGNORED, the directory is forgotten
+	 * then. */
+	for (size_t d = 0; d < watch->dir_nb; ++d)
+	{
+		if (!strncmp(watch->dirs[d].path, prefix, len) ||
+				!strcmp(watch->dirs[d].path, path))
+			inotify_rm_watch(watch->fd, watch->dirs[d].wd);
+	}
+
+	free(prefix);
+}
+
+/* @brief Watch a directory that appeared and search its libraries. */
+static int watch_scan(struct args * args, char const * path)
+{
+	struct dirent * dirent;
+	DIR * dir;
+	int ret;
+
+	ret = watch_directory(args->watch, path);
+	if (ret < 0)
+		return ret;
+
+	dir = opendir(path);
+	if (!dir)
+		return 0;
+
+	while ((dirent = readdir(dir)))
+	{
+		struct stat statbuff;
+		char * file;
+
+		/* Skip hidden files, '.' and '..' */
+		if (dirent->d_name[0] == '.')
+			continue;
+
+		file = path_join(path, dirent->d_name);
+		if (!file)
+		{
+			ret = -ENOMEM;
+			break;
+		}
+
+		if (!stat(file, &statbuff) && S_ISDIR(statbuff.st_mode))
+			ret = watch_scan(args, file);
+		else
+			ret = watch_refresh(args, file);
+
+		free(file);
+		if (ret == -ENOMEM)
+			break;
+	}
+
+	closedir(dir);
+
+	return ret;
+}
+
+/* @brief Search again the libraries of a watched directory, and watch its
+ * new subdirectories. */
+static int watch_rescan_dir(struct args * args, size_t d)
+{
+	struct watch * watch = args->watch;
+	struct dirent * dirent;
+	char * path;
+	char * only;
+	DIR * dir;
+	int ret = 0;
+
+	/* The array moves as subdirectories are watched. */
+	path = strdup(watch->dirs[d].path);
+	only = watch->dirs[d].only ? strdup(watch->dirs[d].only) : NULL;
+	if (!path || (watch->dirs[d].only && !only))
+	{
+		ret = -ENOMEM;
+		goto END;
+	}
+
+	dir = opendir(path);
+	if (!dir)
+	{
+		/* Gone, its IN_IGNORED may have been lost with the rest. */
+		if (inotify_rm_watch(watch->fd, watch->dirs[d].wd) < 0)
+			watch_dir_remove(watch, d);
+		goto END;
+	}
+
+	while ((dirent = readdir(dir)))
+	{
+		struct stat statbuff;
+		char * file;
+
+		if (dirent->d_name[0] == '.' ||
+				(only && strcmp(only, dirent->d_name)))
+			continue;
+
+		file = path_join(path, dirent->d_name);
+		if (!file)
+		{
+			ret = -ENOMEM;
+			break;
+		}
+
+		if (!stat(file, &statbuff) && S_ISDIR(statbuff.st_mode))
+		{
+			/* Watched subdirectories have their own turn. */
+			if (!only && !watch_find_path(watch, file))
+				ret = watch_scan(args, file);
+		}
+		else
+			ret = watch_refresh(args, file);
+
+		free(file);
+		if (ret == -ENOMEM)
+			break;
+	}
+
+	closedir(dir);
+
+END:
+	free(path);
+	free(only);
+
+	return ret;
+}
+
+/* @brief Search the watched directories again, after the kernel dropped
+ * some of their changes.
+ *
+ * The libraries still there are searched again and the ones that went away
+ * lose their matches, so the deltas printed add up to what the lost events
+ * would have given.
+ */
+static int watch_rescan(struct args * args)
+{
+	struct watch * watch = args->watch;
+	size_t dir_nb = watch->dir_nb;
+	size_t i = 0;
+	int ret;
+
+	printf("Warning: too many changes at once, some were lost, searching "
+		"the watched directories again.\n");
+
+	/* Directories removed on the way are replaced by the last one. */
+	for (size_t d = dir_nb; d-- > 0; )
+	{
+		if (d >= watch->dir_nb)
+			continue;
+
+		ret = watch_rescan_dir(args, d);
+		if (ret == -ENOMEM)
+			return ret;
+	}
+
+	while (i < watch->lib_nb)
+	{
+		struct stat statbuff;
+		char * file;
+
+		if (!stat(watch->libs[i].file, &statbuff) &&
+				S_ISREG(statbuff.st_mode))
+		{
+			++i;
+			continue;
+		}
+
+		/* Searching it again forgets it, and frees its path. */
+		file = strdup(watch->libs[i].file);
+		if (!file)
+			return -ENOMEM;
+		ret = watch_refresh(args, file);
+		if (i < watch->lib_nb && !strcmp(watch->libs[i].file, file))
+			++i;
+		free(file);
+		if (ret == -ENOMEM)
+			return ret;
+	}
+
+	return 0;
+}
+
+/* @brief Act on a change in a watched directory. */
+static int watch_event(struct args * args, struct inotify_event const * event)
+{
+	struct watch * watch = args->watch;
+	struct watch_dir * dir;
+	struct stat statbuff;
+	char * path;
+	int ret = 0;
+
+	/* The queue overflowed: the event is not tied to any directory, and
+	 * the changes it stands for are unknown. */
+	if (event->mask & IN_Q_OVERFLOW)
+		return watch_rescan(args);
+
+	dir = watch_find_dir(watch, event->wd);
+	if (!dir)
+		return 0;
+
+	if (event->mask & IN_IGNORED)
+	{
+		watch_dir_remove(watch, (size_t)(dir - watch->dirs));
+		return 0;
+	}
+
+	/* Skip hidden files, like the scan does. */
+	if (!event->len || event->name[0] == '.' ||
+			(dir->only && strcmp(dir->only, event->name)))
+		return 0;
+
+	path = path_join(dir->path, event->name);
+	if (!path)
+		return -ENOMEM;
+
+	if (event->mask & IN_ISDIR)
+	{
+		if (event->mask & (IN_MOVED_FROM | IN_DELETE))
+			watch_forget(watch, path);
+		else if (!dir->only)
+			ret = watch_scan(args, path);
+	}
+	else if (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO |
+				IN_MOVED_FROM | IN_DELETE))
+	{
+		ret = watch_refresh(args, path);
+	}
+	else if (event->mask & IN_CREATE)
+	{
+		/* A file being created is searched once written, but a
+		 * symbolic link is complete right away. */
+		if (!lstat(path, &statbuff) && S_ISLNK(statbuff.st_mode))
+			ret = watch_refresh(args, path);
+	}
+
+	free(path);
+
+	return ret;
+}
+
+int watch_run(struct args * args)
+{
+	char buffer[64 * 1024]
+		__attribute__((aligned(__alignof__(struct inotify_event))));
+
+	fflush(stdout);
+
+	while (1)
+	{
+		ssize_t len = read(args->watch->fd, buffer, sizeof(buffer));
+
+		if (len < 0 && errno == EINTR)
+			continue;
+		if (len <= 0)
+		{
+			printf("Error: failed to read the changes: %s\n",
+				strerror(len < 0 ? errno : EIO));
+			return len < 0 ? -errno : -EIO;
+		}
+
+		for (char * p = buffer; p < buffer + len; )
+		{
+			struct inotify_event const * event = (void *)p;
+
+			if (watch_event(args, event) == -ENOMEM)
+			{
+				printf("Failed to allocate memory: %s\n",
+					strerror(ENOMEM));
+				return -ENOMEM;
+			}
+
+			p += sizeof(*event) + event->len;
+		}
+
+		fflush(stdout);
+	}
+}
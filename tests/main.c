@@ -16,6 +16,7 @@
  */
 
 #include <stdio.h>
+#include <string.h>
 
 #include "levenshtein.h"
 
@@ -44,5 +45,29 @@ int main()
 	printf("%d\n", lev_string_dist(ok, empty));
 	printf("%d\n", lev_string_dist(empty, empty));
 
+	/* Longer than a bit-vector word, compared against the reference. */
+	char const * mangled = "_ZNSt7__cxx1112basic_stringIcSt11char_traitsIcE"
+		"SaIcEE12_M_constructIPKcEEvT_S8_St20forward_iterator_tag";
+	char const * mangled2 = "_ZNSt7__cxx1112basic_stringIwSt11char_traitsIwE"
+		"SaIwEE12_M_constructIPKwEEvT_S8_St20forward_iterator_tag";
+	printf("%d %d\n", lev_string_dist(mangled, mangled2),
+		lev_string_dist_dp(mangled, mangled2));
+	printf("%d %d\n", lev_string_dist(mangled, ok),
+		lev_string_dist_dp(mangled, ok));
+
+	printf("%d\n", lev_string_dist_bounded(chiens, niche, 5));
+	printf("%d\n", lev_string_dist_bounded(chiens, niche, 4)
+		== LEV_EXCEEDS_BOUND);
+	printf("%d\n", lev_string_dist_bounded(mangled, mangled2, 4));
+	printf("%d\n", lev_string_dist_bounded(mangled, mangled2, 3)
+		== LEV_EXCEEDS_BOUND);
+	printf("%d\n", lev_max_edits(70.0, strlen(bob), strlen(chiens)));
+
+	char const * batch[] = { bib, chiens, niche, empty, mangled2 };
+	int dists[5];
+	lev_batch_dist(bob, batch, 5, dists);
+	printf("%d %d %d %d %d\n", dists[0], dists[1], dists[2], dists[3],
+		dists[4]);
+
 	return 0;
 }